@@ -0,0 +1,195 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "bench.h"
+
+// Every allocation is counted, whether it comes from operator new or straight from malloc
+// (command_block, strdup in the PAM conversation).
+static std::atomic<uint64_t> allocation_count(0);
+static std::atomic<uint64_t> allocation_bytes(0);
+
+#ifndef _APPLE
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* p, size_t size);
+
+    void* malloc(size_t size) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(count * size, std::memory_order_relaxed);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* p, size_t size) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+        return __libc_realloc(p, size);
+    }
+}
+#else
+// There is no portable way to interpose malloc, so only operator new is counted.
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+#endif
+
+namespace rau {
+    namespace bench {
+        namespace {
+            struct benchmark {
+                std::string name;
+                function f;
+                std::vector<size_t> args;
+            };
+
+            std::vector<benchmark>& benchmarks() {
+                static std::vector<benchmark> list;
+                return list;
+            }
+        }
+
+        state::state(size_t arg, uint64_t iterations)
+            : _arg(arg)
+            , _iterations(iterations)
+            , _remaining(iterations)
+            , _timing(false)
+            , _start_allocations(0)
+            , _start_allocated_bytes(0)
+            , _elapsed(0)
+            , _allocations(0)
+            , _allocated_bytes(0) {
+        }
+
+        void state::start_timing() {
+            _timing = true;
+            _start_allocations = allocation_count.load(std::memory_order_relaxed);
+            _start_allocated_bytes = allocation_bytes.load(std::memory_order_relaxed);
+            _start = std::chrono::steady_clock::now();
+        }
+
+        void state::stop_timing() {
+            if (!_timing) {
+                return;
+            }
+            _elapsed += std::chrono::steady_clock::now() - _start;
+            _allocations += allocation_count.load(std::memory_order_relaxed) - _start_allocations;
+            _allocated_bytes += allocation_bytes.load(std::memory_order_relaxed) - _start_allocated_bytes;
+            _timing = false;
+        }
+
+        void state::skip(const std::string& reason) {
+            stop_timing();
+            _remaining = 0;
+            _skipped = reason;
+        }
+
+        registration::registration(const char* name, function f, std::initializer_list<size_t> args) {
+            benchmarks().push_back({ name, f, args });
+        }
+    }
+}
+
+namespace {
+    // Runs the benchmark with more and more iterations until a run takes at least min_time,
+    // and returns the state of that last run.
+    rau::bench::state run(rau::bench::function f, size_t arg, std::chrono::nanoseconds min_time) {
+        uint64_t iterations = 1;
+        for (;;) {
+            rau::bench::state state(arg, iterations);
+            f(state);
+
+            if (!state.skipped().empty() || state.elapsed() >= min_time || iterations >= 1000000000) {
+                return state;
+            }
+
+            // Aim 40% past min_time, but grow by at most 10x per step so that a noisy short run
+            // can't make the next one take forever.
+            double per_iteration = std::max<double>(state.elapsed().count(), 1.0) / iterations;
+            double wanted = 1.4 * min_time.count() / per_iteration;
+            iterations = static_cast<uint64_t>(std::min(std::max(wanted, iterations + 1.0), iterations * 10.0));
+        }
+    }
+}
+
+// usage: Microsoft.R.Host.RunAsUser.Benchmarks [-f filter] [-t milliseconds]
+//    -f: Only run the benchmarks whose name contains filter
+//    -t: Minimum time to measure each benchmark for (default 500)
+int main(int argc, char** argv) {
+    std::string filter;
+    std::chrono::milliseconds min_time(500);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:")) != -1) {
+        switch (opt) {
+        case 'f':
+            filter = optarg;
+            break;
+        case 't':
+            min_time = std::chrono::milliseconds(strtoul(optarg, nullptr, 10));
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    printf("%-40s %12s %14s %12s %12s\n", "Benchmark", "Iterations", "ns/op", "allocs/op", "bytes/op");
+    for (const auto& b : rau::bench::benchmarks()) {
+        if (b.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        for (size_t arg : b.args) {
+            std::string name = b.name + "/" + std::to_string(arg);
+            rau::bench::state state = run(b.f, arg, min_time);
+            if (!state.skipped().empty()) {
+                printf("%-40s skipped: %s\n", name.c_str(), state.skipped().c_str());
+                continue;
+            }
+
+            double iterations = static_cast<double>(state.iterations());
+            printf("%-40s %12llu %14.1f %12.2f %12.1f\n", name.c_str(),
+                   static_cast<unsigned long long>(state.iterations()),
+                   state.elapsed().count() / iterations,
+                   state.allocations() / iterations,
+                   state.allocated_bytes() / iterations);
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace bench {
+        // Passed to a benchmark function, which repeats the operation being measured
+        // while keep_running() returns true:
+        //
+        //     void parse_request(rau::bench::state& state) {
+        //         std::string frame = make_request(state.arg());
+        //         while (state.keep_running()) {
+        //             ...
+        //         }
+        //     }
+        //
+        // Only the time and allocations between the first and the last keep_running() count.
+        // Benchmarks that can't use the loop, such as the ones that run several threads,
+        // call start_timing() and stop_timing() around iterations() operations themselves.
+        class state {
+        public:
+            state(size_t arg, uint64_t iterations);
+
+            // The payload size (or thread count, ...) the benchmark was registered with.
+            size_t arg() const {
+                return _arg;
+            }
+
+            uint64_t iterations() const {
+                return _iterations;
+            }
+
+            bool keep_running() {
+                if (_remaining == _iterations && !_timing) {
+                    start_timing();
+                }
+                if (_remaining == 0) {
+                    stop_timing();
+                    return false;
+                }
+                --_remaining;
+                return true;
+            }
+
+            void start_timing();
+            void stop_timing();
+
+            // Gives up on the benchmark, for instance because it needs privileges it doesn't
+            // have; the reason is reported instead of the results.
+            void skip(const std::string& reason);
+
+            std::chrono::nanoseconds elapsed() const {
+                return _elapsed;
+            }
+
+            uint64_t allocations() const {
+                return _allocations;
+            }
+
+            uint64_t allocated_bytes() const {
+                return _allocated_bytes;
+            }
+
+            const std::string& skipped() const {
+                return _skipped;
+            }
+
+        private:
+            size_t _arg;
+            uint64_t _iterations;
+            uint64_t _remaining;
+            bool _timing;
+            std::chrono::steady_clock::time_point _start;
+            uint64_t _start_allocations, _start_allocated_bytes;
+            std::chrono::nanoseconds _elapsed;
+            uint64_t _allocations, _allocated_bytes;
+            std::string _skipped;
+        };
+
+        typedef void (*function)(state& state);
+
+        // Adds a benchmark that is run once for every arg.
+        struct registration {
+            registration(const char* name, function f, std::initializer_list<size_t> args);
+        };
+
+        // Keeps the compiler from optimizing away a result that is otherwise unused.
+        template<typename T>
+        inline void do_not_optimize(const T& value) {
+            asm volatile("" : : "r,m"(value) : "memory");
+        }
+    }
+}
+
+#define RAU_BENCHMARK(NAME, FUNCTION, ...) \
+    static rau::bench::registration FUNCTION##_registration(NAME, FUNCTION, { __VA_ARGS__ })
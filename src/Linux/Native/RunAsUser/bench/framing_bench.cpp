@@ -0,0 +1,75 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "bench.h"
+#include "framing.h"
+
+namespace {
+    // Reads frames of arg bytes from a file, so that every frame_buffer refill is a real
+    // read(); the file is rewound whenever its end is reached.
+    void read_frames(rau::bench::state& state) {
+        char path[] = "/tmp/rau-bench-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd == -1) {
+            state.skip(strerror(errno));
+            return;
+        }
+        unlink(path);
+
+        std::string payload(state.arg(), 'x');
+        rau::framing::frame_header header(static_cast<uint32_t>(payload.size()));
+        size_t count = std::max<size_t>(1, 0x100000 / (sizeof header + payload.size()));
+        for (size_t i = 0; i < count; ++i) {
+            write(fd, &header, sizeof header);
+            write(fd, payload.data(), payload.size());
+        }
+        lseek(fd, 0, SEEK_SET);
+
+        rau::framing::frame_reader reader(fd);
+        boost::string_ref frame;
+        while (state.keep_running()) {
+            if (reader.read(frame) == rau::framing::frame_reader::status::eof) {
+                lseek(fd, 0, SEEK_SET);
+                reader.read(frame);
+            }
+            rau::bench::do_not_optimize(frame);
+        }
+        close(fd);
+    }
+
+    // Queues and sends one frame of arg bytes at a time, as the one-shot helper does.
+    void write_frames(rau::bench::state& state) {
+        int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        std::string payload(state.arg(), 'x');
+
+        rau::framing::frame_writer writer(fd);
+        while (state.keep_running()) {
+            writer.write(payload);
+            writer.flush();
+        }
+        close(fd);
+    }
+}
+
+RAU_BENCHMARK("framing/read", read_frames, 64, 1024, 16384, 262144);
+RAU_BENCHMARK("framing/write", write_frames, 64, 1024, 16384, 262144);
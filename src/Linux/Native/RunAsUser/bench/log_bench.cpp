@@ -0,0 +1,75 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "bench.h"
+#include "log.h"
+
+using namespace rau::log;
+
+namespace {
+    void start_log() {
+        static std::once_flag once;
+        std::call_once(once, [] {
+            init_log("bench", fs::temp_directory_path(), log_verbosity::traffic);
+        });
+    }
+
+    // Records of arg bytes from a single thread. The time includes writing them all out,
+    // so it is the throughput of the writer rather than just the cost of queueing.
+    void log_records(rau::bench::state& state) {
+        start_log();
+        const std::string text(state.arg(), 'x');
+
+        state.start_timing();
+        for (uint64_t i = 0; i < state.iterations(); ++i) {
+            logf(log_verbosity::normal, "Benchmark record %llu: %s\n", static_cast<unsigned long long>(i), text.c_str());
+        }
+        flush_log();
+        state.stop_timing();
+    }
+
+    // 100-byte records from arg threads at once, the way workers of the socket server log.
+    void log_records_contended(rau::bench::state& state) {
+        start_log();
+        const std::string text(100, 'x');
+        uint64_t per_thread = std::max<uint64_t>(1, state.iterations() / state.arg());
+
+        state.start_timing();
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < state.arg(); ++t) {
+            threads.emplace_back([&text, per_thread, t] {
+                for (uint64_t i = 0; i < per_thread; ++i) {
+                    logf(log_verbosity::normal, "Benchmark thread %zu record %llu: %s\n", t, static_cast<unsigned long long>(i), text.c_str());
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        flush_log();
+        state.stop_timing();
+    }
+}
+
+RAU_BENCHMARK("log/vlogf", log_records, 16, 128, 900);
+RAU_BENCHMARK("log/vlogf_threads", log_records_contended, 1, 2, 4, 8);
@@ -0,0 +1,91 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "picojson.h"
+#include "bench.h"
+#include "codec.h"
+#include "request.h"
+
+namespace {
+    // An AuthAndRun request of about size bytes, most of it environment, as sent by RTVS.
+    picojson::value make_request(size_t size) {
+        picojson::object request;
+        request["name"] = picojson::value("AuthAndRun");
+        request["username"] = picojson::value("rtvs_user");
+        request["password"] = picojson::value("p@ss\"word\\");
+        request["workingDirectory"] = picojson::value("/home/rtvs_user");
+
+        picojson::array arguments;
+        arguments.push_back(picojson::value("--rhost-name"));
+        arguments.push_back(picojson::value("RTVS"));
+        request["arguments"] = picojson::value(arguments);
+
+        picojson::array environment;
+        size_t length = picojson::value(request).serialize().size();
+        for (int i = 0; length < size; ++i) {
+            std::string variable = "RTVS_VARIABLE_" + std::to_string(i) + "=/usr/lib/R/library:/usr/local/lib/R/site-library";
+            length += variable.size() + 3;
+            environment.push_back(picojson::value(variable));
+        }
+        request["environment"] = picojson::value(environment);
+        return picojson::value(request);
+    }
+
+    void parse(rau::bench::state& state, rau::codec::wire_encoding encoding) {
+        const std::string source = rau::codec::encode(make_request(state.arg()), encoding);
+        std::string frame;
+        rau::request::request request;
+        std::string error;
+        while (state.keep_running()) {
+            // The decoder unescapes in place, so it gets a fresh copy each time; the copy
+            // reuses frame's storage.
+            frame.assign(source);
+            rau::request::parse(frame, encoding, request, error);
+            rau::bench::do_not_optimize(request);
+        }
+    }
+
+    void parse_json(rau::bench::state& state) {
+        parse(state, rau::codec::wire_encoding::json);
+    }
+
+    void parse_binary(rau::bench::state& state) {
+        parse(state, rau::codec::wire_encoding::binary);
+    }
+
+    // What the streaming decoder replaced: a complete picojson document per request.
+    void parse_picojson(rau::bench::state& state) {
+        const std::string source = make_request(state.arg()).serialize();
+        std::string frame;
+        while (state.keep_running()) {
+            frame.assign(source);
+            picojson::value value;
+            picojson::parse(value, frame);
+            rau::bench::do_not_optimize(value);
+        }
+    }
+}
+
+RAU_BENCHMARK("request/parse_json", parse_json, 256, 4096, 65536);
+RAU_BENCHMARK("request/parse_binary", parse_binary, 256, 4096, 65536);
+RAU_BENCHMARK("request/picojson", parse_picojson, 256, 4096, 65536);
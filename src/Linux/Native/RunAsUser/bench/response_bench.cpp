@@ -0,0 +1,80 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "bench.h"
+#include "response.h"
+#include "pam_conv.h"
+
+namespace {
+    // Keeps the size of every frame written to it, and nothing else.
+    class null_channel : public rau::response_channel {
+    public:
+        void write_frame(const std::string& frame) override {
+            rau::bench::do_not_optimize(frame.size());
+        }
+    };
+
+    void write_response(rau::bench::state& state, rau::codec::wire_encoding encoding) {
+        null_channel channel;
+        channel.request_encoding(encoding);
+        channel.apply_encoding();
+
+        const std::string result(state.arg(), 'x');
+        while (state.keep_running()) {
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_RESULT, result);
+        }
+    }
+
+    void write_json_response(rau::bench::state& state) {
+        write_response(state, rau::codec::wire_encoding::json);
+    }
+
+    void write_binary_response(rau::bench::state& state) {
+        write_response(state, rau::codec::wire_encoding::binary);
+    }
+
+    // A password prompt followed by a text message of arg bytes, such as a login banner,
+    // with the responses freed the way PAM does.
+    void pam_conversation(rau::bench::state& state) {
+        null_channel channel;
+        conv_data appdata = { "p@ssword", &channel };
+
+        const std::string text(state.arg(), 'x');
+        pam_message prompt = { PAM_PROMPT_ECHO_OFF, "Password: " };
+        pam_message info = { PAM_TEXT_INFO, text.c_str() };
+        const pam_message* messages[] = { &prompt, &info };
+
+        while (state.keep_running()) {
+            pam_response* responses = nullptr;
+            rtvs_conv(2, messages, &responses, &appdata);
+            for (int i = 0; i < 2; ++i) {
+                free(responses[i].resp);
+            }
+            free(responses);
+        }
+    }
+}
+
+RAU_BENCHMARK("response/write_json", write_json_response, 16, 1024, 65536);
+RAU_BENCHMARK("response/write_binary", write_binary_response, 16, 1024, 65536);
+RAU_BENCHMARK("pam/rtvs_conv", pam_conversation, 16, 1024, 16384);
@@ -0,0 +1,95 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "bench.h"
+#include "spawn.h"
+
+namespace {
+    void build_command_block(rau::bench::state& state) {
+        std::vector<std::string> storage = { "--rhost-name", "RTVS", "--rhost-reparent-to", "12345" };
+        size_t arguments = storage.size();
+        for (size_t length = 0; length < state.arg(); ) {
+            storage.push_back("RTVS_VARIABLE_" + std::to_string(storage.size()) + "=/usr/lib/R/library:/usr/local/lib/R/site-library");
+            length += storage.back().size() + 1 + sizeof(char*);
+        }
+
+        std::vector<boost::string_ref> args(storage.begin(), storage.begin() + arguments);
+        std::vector<boost::string_ref> env(storage.begin() + arguments, storage.end());
+        while (state.keep_running()) {
+            rau::spawn::command_block command;
+            command.assign("/usr/lib/rtvs/Microsoft.R.Host", args, env);
+            rau::bench::do_not_optimize(command.argv());
+        }
+    }
+
+    // Starts /bin/true as the current user and waits for it, from a process with arg MiB
+    // of memory in use, which is what makes fork slower as a long-lived helper grows.
+    void spawn_true(rau::bench::state& state, rau::spawn::spawn_method method) {
+        std::vector<char> ballast(state.arg() << 20);
+        for (size_t i = 0; i < ballast.size(); i += 4096) {
+            ballast[i] = 1;
+        }
+
+        std::vector<gid_t> groups(getgroups(0, nullptr));
+        groups.resize(getgroups(groups.size(), groups.data()));
+
+        std::vector<boost::string_ref> args, env;
+        rau::spawn::command_block command;
+        command.assign("/bin/true", args, env);
+
+        rau::spawn::launch_options options;
+        options.path = "/bin/true";
+        options.argv = command.argv();
+        options.envp = command.envp();
+        options.cwd = nullptr;
+        options.uid = geteuid();
+        options.gid = getegid();
+        options.groups = &groups;
+        options.method = method;
+
+        while (state.keep_running()) {
+            const char* failed_step = nullptr;
+            pid_t pid = rau::spawn::spawn_process(options, &failed_step);
+            if (pid == -1) {
+                state.skip(std::string(failed_step ? failed_step : "fork") + ": " + strerror(errno));
+                return;
+            }
+            int status;
+            waitpid(pid, &status, 0);
+        }
+    }
+
+    void spawn_fork(rau::bench::state& state) {
+        spawn_true(state, rau::spawn::spawn_method::fork);
+    }
+
+    void spawn_vfork(rau::bench::state& state) {
+        spawn_true(state, rau::spawn::spawn_method::vfork);
+    }
+}
+
+RAU_BENCHMARK("spawn/command_block", build_command_block, 1024, 16384, 131072);
+RAU_BENCHMARK("spawn/fork", spawn_fork, 0, 256);
+#ifndef _APPLE
+RAU_BENCHMARK("spawn/vfork", spawn_vfork, 0, 256);
+#endif
@@ -11,16 +11,22 @@ Usage: $0 [options]
     -o dir      Use the specified directory for build output.
     -i dir      Use the specified directory for build artifacts.
     -m          Don't colorize build output.
+    -b          Also build the microbenchmarks.
+    -l          Also build the load test tools.
+    -u          Also build the unit tests.
 EOF
 }
 
 ROOT_DIR=$(dirname "$0")
 BUILD_TYPE=Release
 COLORIZE=yes
+BENCHMARKS=OFF
+LOAD_TEST=OFF
+TESTS=OFF
 
 OPTIND=1
 
-while getopts "h?t:a:o:i:m" opt; do
+while getopts "h?t:a:o:i:mblu" opt; do
     case "$opt" in
     h|\?)
         usage
@@ -41,6 +47,15 @@ while getopts "h?t:a:o:i:m" opt; do
     m)  
         COLORIZE=no
         ;;
+    b)
+        BENCHMARKS=ON
+        ;;
+    l)
+        LOAD_TEST=ON
+        ;;
+    u)
+        TESTS=ON
+        ;;
     esac
 done
 
@@ -56,7 +71,7 @@ ROOT_DIR=$(pwd)
 
 mkdir -p "$INT_DIR" && \
     cd "$INT_DIR" && \
-    cmake -G "Unix Makefiles" -DCMAKE_BUILD_TYPE=$BUILD_TYPE -DTARGET_ARCH=$TARGET_ARCH -DCMAKE_COLOR_MAKEFILE=$COLORIZE "-DCMAKE_RUNTIME_OUTPUT_DIRECTORY=$OUT_DIR" "$ROOT_DIR" && \
+    cmake -G "Unix Makefiles" -DCMAKE_BUILD_TYPE=$BUILD_TYPE -DTARGET_ARCH=$TARGET_ARCH -DCMAKE_COLOR_MAKEFILE=$COLORIZE -DRUNASUSER_BENCHMARKS=$BENCHMARKS -DRUNASUSER_LOAD_TEST=$LOAD_TEST -DRUNASUSER_TESTS=$TESTS "-DCMAKE_RUNTIME_OUTPUT_DIRECTORY=$OUT_DIR" "$ROOT_DIR" && \
     make
 
 popd >/dev/null
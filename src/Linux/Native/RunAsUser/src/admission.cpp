@@ -0,0 +1,213 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "admission.h"
+#include "log.h"
+
+using namespace rau::log;
+
+namespace rau {
+    namespace admission {
+        namespace {
+            typedef std::chrono::steady_clock clock;
+
+            // How often a waiting launch looks at the pressure again. avg10 moves slowly,
+            // so there is little point in looking more often.
+            constexpr std::chrono::milliseconds poll_interval(500);
+
+            thresholds current;
+
+            // Launches that are waiting, in this process; see admit.
+            std::atomic<int> waiting{ 0 };
+            std::timed_mutex queue;
+
+            // "some avg10" of /proc/pressure/<resource>, or -1 if the kernel doesn't have it.
+            double pressure(const char* resource) {
+                std::ifstream file(std::string("/proc/pressure/") + resource);
+                std::string line;
+                if (!std::getline(file, line) || line.compare(0, 5, "some ") != 0) {
+                    return -1;
+                }
+                size_t pos = line.find("avg10=");
+                if (pos == std::string::npos) {
+                    return -1;
+                }
+                return strtod(line.c_str() + pos + 6, nullptr);
+            }
+
+            // MemAvailable in bytes, or 0 if it can't be read.
+            uint64_t available_memory() {
+                std::ifstream meminfo("/proc/meminfo");
+                std::string line;
+                while (std::getline(meminfo, line)) {
+                    if (line.compare(0, 13, "MemAvailable:") == 0) {
+                        return strtoull(line.c_str() + 13, nullptr, 10) * 1024;
+                    }
+                }
+                return 0;
+            }
+
+            bool check_pressure(const char* resource, double limit, std::string& reason) {
+                if (limit <= 0) {
+                    return false;
+                }
+                double value = pressure(resource);
+                if (value < 0) {
+                    static std::atomic<bool> warned{ false };
+                    if (!warned.exchange(true)) {
+                        logf(log_verbosity::minimal, "Error: No pressure stall information in /proc/pressure; only free memory is checked before launches.\n");
+                    }
+                    return false;
+                }
+                if (value < limit) {
+                    return false;
+                }
+                char text[96];
+                snprintf(text, sizeof text, "%s pressure %.2f%% (limit %.2f%%)", resource, value, limit);
+                reason = text;
+                return true;
+            }
+
+            // Whether anything is over its threshold; if so, reason says what.
+            bool over(const thresholds& t, std::string& reason) {
+                if (check_pressure("memory", t.memory, reason) ||
+                    check_pressure("io", t.io, reason) ||
+                    check_pressure("cpu", t.cpu, reason)) {
+                    return true;
+                }
+                if (t.min_available) {
+                    uint64_t available = available_memory();
+                    if (available && available < t.min_available) {
+                        reason = "available memory " + std::to_string(available >> 20) + " MiB (limit " + std::to_string(t.min_available >> 20) + " MiB)";
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // Waits for the launches ahead, then for the pressure to drop, for queue_timeout at most.
+            bool wait_in_line(const thresholds& t, std::string& reason) {
+                auto deadline = clock::now() + t.queue_timeout;
+                std::unique_lock<std::timed_mutex> lock(queue, std::defer_lock);
+                if (!lock.try_lock_until(deadline)) {
+                    if (!over(t, reason)) {
+                        reason = "launches queued ahead";
+                    }
+                    return false;
+                }
+
+                logf(log_verbosity::traffic, "Holding a launch back, %s.\n", reason.empty() ? "launches queued ahead" : reason.c_str());
+                for (;;) {
+                    reason.clear();
+                    if (!over(t, reason)) {
+                        return true;
+                    }
+                    auto now = clock::now();
+                    if (now >= deadline) {
+                        return false;
+                    }
+                    std::this_thread::sleep_for(std::min<clock::duration>(poll_interval, deadline - now));
+                }
+            }
+
+            bool parse_size(const std::string& text, uint64_t& out) {
+                char* end;
+                out = strtoull(text.c_str(), &end, 10);
+                if (end == text.c_str()) {
+                    return false;
+                }
+                switch (toupper(static_cast<unsigned char>(*end))) {
+                case 'G':
+                    out <<= 10;
+                    // fall through
+                case 'M':
+                    out <<= 10;
+                    // fall through
+                case 'K':
+                    out <<= 10;
+                    ++end;
+                    break;
+                }
+                return *end == '\0';
+            }
+        }
+
+        bool parse_thresholds(const std::string& text, thresholds& out) {
+            size_t start = 0;
+            while (start < text.size()) {
+                size_t end = text.find(',', start);
+                if (end == std::string::npos) {
+                    end = text.size();
+                }
+                std::string item = text.substr(start, end - start);
+                start = end + 1;
+
+                size_t eq = item.find('=');
+                if (eq == std::string::npos) {
+                    return false;
+                }
+                std::string key = item.substr(0, eq), value = item.substr(eq + 1);
+                if (key == "available") {
+                    if (!parse_size(value, out.min_available)) {
+                        return false;
+                    }
+                    continue;
+                }
+
+                double* limit = key == "memory" ? &out.memory : key == "cpu" ? &out.cpu : key == "io" ? &out.io : nullptr;
+                char* rest;
+                if (!limit || value.empty() || (*limit = strtod(value.c_str(), &rest), *rest != '\0') || *limit < 0 || *limit > 100) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void set_thresholds(const thresholds& t) {
+            current = t;
+        }
+
+        const thresholds& current_thresholds() {
+            return current;
+        }
+
+        bool admit(std::string& reason) {
+            const thresholds& t = current;
+            if (t.memory <= 0 && t.cpu <= 0 && t.io <= 0 && !t.min_available) {
+                return true;
+            }
+
+            // Launches that arrive while others wait get in line behind them, instead of
+            // slipping past as soon as the pressure dips. The line is per process, so
+            // one-shot helpers only ever wait on their own.
+            if (waiting == 0 && !over(t, reason)) {
+                return true;
+            }
+
+            ++waiting;
+            bool admitted = wait_in_line(t, reason);
+            --waiting;
+            return admitted;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace admission {
+        // When the machine is too loaded to start another host. A value of 0 turns its check off.
+        struct thresholds {
+            // Share of the last 10 seconds, in percent, in which some tasks were stalled on
+            // memory, CPU or I/O, from "some avg10" of /proc/pressure/{memory,cpu,io}.
+            double memory = 20;
+            double cpu = 0;
+            double io = 0;
+            // MemAvailable of /proc/meminfo, in bytes.
+            uint64_t min_available = 0;
+            // How long a launch waits for the pressure to drop before it is turned away;
+            // 0 turns it away at once.
+            std::chrono::milliseconds queue_timeout{ 10000 };
+        };
+
+        // Parses a list such as "memory=20,cpu=90,io=50,available=512M".
+        bool parse_thresholds(const std::string& text, thresholds& out);
+
+        // Sets the thresholds; -P and -t on the command line.
+        void set_thresholds(const thresholds& t);
+
+        const thresholds& current_thresholds();
+
+        // Blocks until the machine is below the thresholds, behind launches that were waiting
+        // already, or until queue_timeout has passed. Returns false in that case, with what
+        // was over its threshold in reason. Pressure that the kernel doesn't report (no PSI)
+        // is taken as none.
+        bool admit(std::string& reason);
+    }
+}
@@ -0,0 +1,172 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "cgroup.h"
+#include "log.h"
+
+using namespace rau::log;
+
+namespace rau {
+    namespace cgroup {
+        namespace {
+            std::string root_path;
+            std::atomic<uint64_t> next_session{ 1 };
+
+            // Writes value to the control file name in dir. Returns false with errno set.
+            bool write_control(const std::string& dir, const char* name, const std::string& value) {
+                std::string path = dir + "/" + name;
+                int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+                if (fd == -1) {
+                    return false;
+                }
+                ssize_t n = write(fd, value.data(), value.size());
+                int err = errno;
+                close(fd);
+                if (n != static_cast<ssize_t>(value.size())) {
+                    errno = n < 0 ? err : EIO;
+                    return false;
+                }
+                return true;
+            }
+
+            bool make_dir(const std::string& path) {
+                return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+            }
+
+            // Lets the children of dir use controller. Already enabled is fine; the write
+            // fails if the controller isn't available to dir at all.
+            bool enable_controller(const std::string& dir, const char* controller) {
+                if (!write_control(dir, "cgroup.subtree_control", std::string("+") + controller)) {
+                    logf(log_verbosity::normal, "Error [cgroup]: Can't enable %s in %s: %s\n", controller, dir.c_str(), strerror(errno));
+                    return false;
+                }
+                return true;
+            }
+
+            bool apply(const std::string& dir, const char* name, uint64_t value) {
+                if (value == 0) {
+                    return true;
+                }
+                if (!write_control(dir, name, std::to_string(value))) {
+                    int err = errno;
+                    logf(log_verbosity::minimal, "Error [cgroup]: Can't set %s/%s to %llu: %s\n", dir.c_str(), name, static_cast<unsigned long long>(value), strerror(err));
+                    errno = err;
+                    return false;
+                }
+                return true;
+            }
+        }
+
+        bool set_root(const std::string& path) {
+#ifndef _APPLE
+            struct statfs fs;
+            if (statfs(path.c_str(), &fs) == -1) {
+                return false;
+            }
+            if (fs.f_type != CGROUP2_SUPER_MAGIC) {
+                errno = ENOTSUP;
+                return false;
+            }
+            root_path = path;
+            return true;
+#else
+            errno = ENOTSUP;
+            return false;
+#endif
+        }
+
+        bool enabled() {
+            return !root_path.empty();
+        }
+
+        bool prepare(uid_t uid, const limits& limits, placement& out) {
+            std::string user_dir = root_path + "/user-" + std::to_string(uid);
+            bool cpu = limits.cpu_weight != 0;
+            bool memory = limits.memory_high != 0 || limits.memory_max != 0;
+            bool io = limits.io_weight != 0;
+
+            auto enable_controllers = [&](const std::string& dir) {
+                return (!cpu || enable_controller(dir, "cpu")) && (!memory || enable_controller(dir, "memory")) && (!io || enable_controller(dir, "io"));
+            };
+
+            // Controllers have to be enabled all the way down to the parent of the cgroup
+            // whose files are written.
+            if (!make_dir(root_path) || !make_dir(user_dir)) {
+                return false;
+            }
+            if (!enable_controllers(root_path) || (limits.scope == scope::session && !enable_controllers(user_dir))) {
+                errno = ENOTSUP;
+                return false;
+            }
+
+            std::string limited_dir;
+            if (limits.scope == scope::user) {
+                limited_dir = user_dir;
+                out.path = user_dir + "/hosts";
+                out.owned = false;
+            } else {
+                out.path = user_dir + "/session-" + std::to_string(getpid()) + "-" + std::to_string(next_session++);
+                out.owned = true;
+                limited_dir = out.path;
+            }
+            if (!make_dir(out.path)) {
+                return false;
+            }
+
+            if (!apply(limited_dir, "cpu.weight", limits.cpu_weight) ||
+                !apply(limited_dir, "io.weight", limits.io_weight) ||
+                !apply(limited_dir, "memory.high", limits.memory_high) ||
+                !apply(limited_dir, "memory.max", limits.memory_max)) {
+                int err = errno;
+                release(out);
+                errno = err;
+                return false;
+            }
+
+            out.procs_fd = open((out.path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+            if (out.procs_fd == -1) {
+                int err = errno;
+                release(out);
+                errno = err;
+                return false;
+            }
+            return true;
+        }
+
+        void close_procs(placement& p) {
+            if (p.procs_fd != -1) {
+                close(p.procs_fd);
+                p.procs_fd = -1;
+            }
+        }
+
+        void release(const placement& p) {
+            if (!p.owned || p.path.empty()) {
+                return;
+            }
+            if (rmdir(p.path.c_str()) == -1 && errno != ENOENT) {
+                logf(log_verbosity::normal, "Error [cgroup]: Can't remove %s: %s\n", p.path.c_str(), strerror(errno));
+            }
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace cgroup {
+        enum class scope {
+            // All hosts of a user share one cgroup, and the limits apply to them together.
+            user,
+            // Each host gets a cgroup of its own, removed again once the host has exited.
+            session
+        };
+
+        // Resource controls for a host, from the "cgroup" object of AuthAndRun.
+        struct limits {
+            cgroup::scope scope = scope::session;
+            // cpu.weight and io.weight, 1 to 10000; 0 leaves the setting alone.
+            uint64_t cpu_weight = 0;
+            uint64_t io_weight = 0;
+            // memory.high and memory.max in bytes; 0 leaves the setting alone.
+            uint64_t memory_high = 0;
+            uint64_t memory_max = 0;
+        };
+
+        // The cgroup a host is to be started in.
+        struct placement {
+            // Directory of the cgroup; empty if the host isn't placed anywhere.
+            std::string path;
+            // Whether the cgroup belongs to this host alone, and is removed once it has exited.
+            bool owned = false;
+            // The cgroup's cgroup.procs, open for writing. The child of spawn_process writes
+            // "0" to it, which moves the child itself, before it drops root.
+            int procs_fd = -1;
+        };
+
+        // Sets the cgroup v2 directory, delegated to the helper, under which hosts get cgroups:
+        // <root>/user-<uid> per user, with the hosts in a "hosts" child for user scope and in
+        // "session-<n>" children for session scope. cgroup v2 only allows processes in leaves
+        // once controllers are enabled, which is why user scope hosts don't live in
+        // user-<uid> itself, and why the helper mustn't run in path. Until it is set, hosts
+        // stay in the helper's cgroup. Returns false with errno set if path isn't in a cgroup2
+        // file system.
+        bool set_root(const std::string& path);
+
+        bool enabled();
+
+        // Creates or reuses the cgroup for a host of uid, enables the controllers that the
+        // limits need, applies them, and opens its cgroup.procs. Returns false with errno set.
+        bool prepare(uid_t uid, const limits& limits, placement& out);
+
+        // Closes procs_fd; called once the host has been started, or failed to.
+        void close_procs(placement& p);
+
+        // Removes an owned cgroup after its host has exited. A cgroup that processes the host
+        // left behind still live in is kept, and logged.
+        void release(const placement& p);
+    }
+}
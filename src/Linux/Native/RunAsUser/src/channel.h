@@ -0,0 +1,145 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "codec.h"
+
+namespace rau {
+    // Destination for the response frames produced while a request is handled.
+    // The classic one-shot helper writes them to stdout; the socket server
+    // writes them to the connection the request arrived on.
+    class response_channel {
+    public:
+        response_channel()
+            : _encoding(codec::wire_encoding::json), _next_encoding(codec::wire_encoding::json) {}
+
+        virtual ~response_channel() {}
+
+        // Encoding of the requests and responses on this channel.
+        virtual codec::wire_encoding encoding() const {
+            return _encoding;
+        }
+
+        // A switch requested by the client takes effect once the request asking for it has been
+        // answered in the old encoding, with apply_encoding().
+        virtual void request_encoding(codec::wire_encoding encoding) {
+            _next_encoding = encoding;
+        }
+
+        virtual void apply_encoding() {
+            _encoding = _next_encoding;
+        }
+
+        virtual void write_frame(const std::string& frame) = 0;
+
+        // Called when PAM asks for its failure delay after a failed authentication. The
+        // remaining responses to the request must not reach the caller before the delay has
+        // passed. By default the calling thread just sleeps, as PAM itself would have.
+        virtual void delay_responses(std::chrono::microseconds delay) {
+            std::this_thread::sleep_for(delay);
+        }
+
+        // Returns a reference that keeps the channel open after the request has completed, for
+        // responses that only come later, such as the exit of a supervised host. Null if the
+        // channel doesn't outlive the request.
+        virtual std::shared_ptr<response_channel> share() {
+            return nullptr;
+        }
+
+        // The client's requestId for the request being answered, which every response frame
+        // carries right after its type; null if it didn't send one.
+        virtual const picojson::value* correlation_id() const {
+            return nullptr;
+        }
+
+        // Called once the request turns out to carry a requestId. Its responses can then be
+        // told apart from those to other requests, so the next request on the channel may
+        // start before this one is answered. By default requests still run one at a time.
+        virtual void allow_overlap() {
+        }
+
+        // Whether other requests on the channel are still being answered, whose remaining
+        // responses would be written in the new encoding if this request switched it.
+        virtual bool others_in_flight() const {
+            return false;
+        }
+
+    private:
+        // Exit notifications for supervised hosts can be written while a request is switching.
+        std::atomic<codec::wire_encoding> _encoding;
+        codec::wire_encoding _next_encoding;
+    };
+
+    // Passes the responses to one request on to the channel it arrived on, tagged with the
+    // requestId the client sent along with it.
+    class correlated_channel : public response_channel {
+    public:
+        correlated_channel(response_channel& inner, const picojson::value& id, std::shared_ptr<response_channel> keep_alive = nullptr)
+            : _inner(inner), _id(id), _keep_alive(keep_alive) {}
+
+        codec::wire_encoding encoding() const override {
+            return _inner.encoding();
+        }
+
+        void request_encoding(codec::wire_encoding encoding) override {
+            _inner.request_encoding(encoding);
+        }
+
+        void apply_encoding() override {
+            _inner.apply_encoding();
+        }
+
+        void write_frame(const std::string& frame) override {
+            _inner.write_frame(frame);
+        }
+
+        void delay_responses(std::chrono::microseconds delay) override {
+            _inner.delay_responses(delay);
+        }
+
+        // Responses that come later, such as rtvs-exit, carry the id of the request that
+        // asked for them too.
+        std::shared_ptr<response_channel> share() override {
+            std::shared_ptr<response_channel> inner = _inner.share();
+            return inner ? std::make_shared<correlated_channel>(*inner, _id, inner) : nullptr;
+        }
+
+        const picojson::value* correlation_id() const override {
+            return &_id;
+        }
+
+        void allow_overlap() override {
+            _inner.allow_overlap();
+        }
+
+        bool others_in_flight() const override {
+            return _inner.others_in_flight();
+        }
+
+    private:
+        response_channel& _inner;
+        picojson::value _id;
+        std::shared_ptr<response_channel> _keep_alive;
+    };
+}
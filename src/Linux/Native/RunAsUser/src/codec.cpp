@@ -0,0 +1,237 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "codec.h"
+
+namespace rau {
+    namespace codec {
+        namespace {
+            // Requests are flat; anything nested deeper than this is not one of ours.
+            constexpr int max_binary_depth = 32;
+
+            void put_length(std::string& out, size_t length) {
+                boost::endian::little_uint32_buf_t buf(static_cast<uint32_t>(length));
+                out.append(reinterpret_cast<const char*>(&buf), sizeof buf);
+            }
+
+            void put_string(std::string& out, const std::string& s) {
+                put_length(out, s.size());
+                out.append(s);
+            }
+
+            void encode_binary(std::string& out, const picojson::value& value) {
+                if (value.is<bool>()) {
+                    out.push_back(value.get<bool>() ? binary_type::true_value : binary_type::false_value);
+                } else if (value.is<double>()) {
+                    boost::endian::little_float64_buf_t buf(value.get<double>());
+                    out.push_back(binary_type::number);
+                    out.append(reinterpret_cast<const char*>(&buf), sizeof buf);
+                } else if (value.is<std::string>()) {
+                    out.push_back(binary_type::string);
+                    put_string(out, value.get<std::string>());
+                } else if (value.is<picojson::array>()) {
+                    const picojson::array& items = value.get<picojson::array>();
+                    out.push_back(binary_type::array);
+                    put_length(out, items.size());
+                    for (const auto& item : items) {
+                        encode_binary(out, item);
+                    }
+                } else if (value.is<picojson::object>()) {
+                    const picojson::object& members = value.get<picojson::object>();
+                    out.push_back(binary_type::object);
+                    put_length(out, members.size());
+                    for (const auto& member : members) {
+                        put_string(out, member.first);
+                        encode_binary(out, member.second);
+                    }
+                } else {
+                    out.push_back(binary_type::null);
+                }
+            }
+
+            class binary_decoder {
+            public:
+                binary_decoder(const std::string& frame)
+                    : _p(frame.data()), _end(frame.data() + frame.size()) {}
+
+                bool decode(picojson::value& value, int depth) {
+                    uint8_t type;
+                    if (depth > max_binary_depth) {
+                        return fail("nesting too deep");
+                    }
+                    if (!take(&type, 1)) {
+                        return false;
+                    }
+
+                    switch (type) {
+                    case binary_type::null:
+                        value = picojson::value();
+                        return true;
+                    case binary_type::false_value:
+                    case binary_type::true_value:
+                        value = picojson::value(type == binary_type::true_value);
+                        return true;
+                    case binary_type::number: {
+                        boost::endian::little_float64_buf_t buf;
+                        if (!take(&buf, sizeof buf)) {
+                            return false;
+                        }
+                        value = picojson::value(buf.value());
+                        return true;
+                    }
+                    case binary_type::string: {
+                        std::string s;
+                        if (!take_string(s)) {
+                            return false;
+                        }
+                        value = picojson::value(s);
+                        return true;
+                    }
+                    case binary_type::array: {
+                        uint32_t count;
+                        if (!take_count(count)) {
+                            return false;
+                        }
+                        picojson::array items(count);
+                        for (auto& item : items) {
+                            if (!decode(item, depth + 1)) {
+                                return false;
+                            }
+                        }
+                        value = picojson::value(items);
+                        return true;
+                    }
+                    case binary_type::object: {
+                        uint32_t count;
+                        if (!take_count(count)) {
+                            return false;
+                        }
+                        picojson::object members;
+                        for (uint32_t i = 0; i < count; ++i) {
+                            std::string name;
+                            if (!take_string(name) || !decode(members[name], depth + 1)) {
+                                return false;
+                            }
+                        }
+                        value = picojson::value(members);
+                        return true;
+                    }
+                    default:
+                        return fail("unknown type " + std::to_string(type));
+                    }
+                }
+
+                bool at_end() const {
+                    return _p == _end;
+                }
+
+                const std::string& error() const {
+                    return _error;
+                }
+
+            private:
+                bool fail(const std::string& error) {
+                    _error = error;
+                    return false;
+                }
+
+                bool take(void* out, size_t size) {
+                    if (static_cast<size_t>(_end - _p) < size) {
+                        return fail("unexpected end of frame");
+                    }
+                    memcpy(out, _p, size);
+                    _p += size;
+                    return true;
+                }
+
+                // Every element takes at least one byte, so a count can never exceed what is
+                // left of the frame; checking that up front keeps bogus counts from allocating.
+                bool take_count(uint32_t& count) {
+                    boost::endian::little_uint32_buf_t buf;
+                    if (!take(&buf, sizeof buf)) {
+                        return false;
+                    }
+                    count = buf.value();
+                    if (count > static_cast<size_t>(_end - _p)) {
+                        return fail("count exceeds frame");
+                    }
+                    return true;
+                }
+
+                bool take_string(std::string& s) {
+                    uint32_t size;
+                    if (!take_count(size)) {
+                        return false;
+                    }
+                    s.assign(_p, size);
+                    _p += size;
+                    return true;
+                }
+
+                const char* _p;
+                const char* _end;
+                std::string _error;
+            };
+        }
+
+        bool parse_encoding(const std::string& name, wire_encoding& encoding) {
+            if (name == "json") {
+                encoding = wire_encoding::json;
+            } else if (name == "binary") {
+                encoding = wire_encoding::binary;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        const char* encoding_name(wire_encoding encoding) {
+            return encoding == wire_encoding::binary ? "binary" : "json";
+        }
+
+        std::string encode(const picojson::value& value, wire_encoding encoding) {
+            if (encoding == wire_encoding::json) {
+                return value.serialize();
+            }
+
+            std::string out;
+            encode_binary(out, value);
+            return out;
+        }
+
+        std::string decode(const std::string& frame, wire_encoding encoding, picojson::value& value) {
+            if (encoding == wire_encoding::json) {
+                return picojson::parse(value, frame);
+            }
+
+            binary_decoder decoder(frame);
+            if (!decoder.decode(value, 0)) {
+                return decoder.error();
+            }
+            if (!decoder.at_end()) {
+                return "trailing data after value";
+            }
+            return std::string();
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "picojson.h"
+
+namespace rau {
+    namespace codec {
+        // How requests and responses are encoded inside a frame. JSON is the default; a client
+        // of a long-lived helper can switch its connection to binary with a SetEncoding request.
+        enum class wire_encoding {
+            json,
+            binary
+        };
+
+        // The binary encoding stores the same values as JSON, as a type byte followed by:
+        //   0x00 null, 0x01 false, 0x02 true:  nothing
+        //   0x03 number:  IEEE 754 double, little endian
+        //   0x04 string:  uint32 byte count, little endian, then that many bytes of UTF-8
+        //   0x05 array:   uint32 element count, then the elements
+        //   0x06 object:  uint32 member count, then for each member its name (as a string
+        //                 without the type byte) and its value
+        // Nothing is escaped or formatted, and every length is known before it is read.
+        namespace binary_type {
+            constexpr uint8_t null = 0x00;
+            constexpr uint8_t false_value = 0x01;
+            constexpr uint8_t true_value = 0x02;
+            constexpr uint8_t number = 0x03;
+            constexpr uint8_t string = 0x04;
+            constexpr uint8_t array = 0x05;
+            constexpr uint8_t object = 0x06;
+        }
+
+        bool parse_encoding(const std::string& name, wire_encoding& encoding);
+        const char* encoding_name(wire_encoding encoding);
+
+        std::string encode(const picojson::value& value, wire_encoding encoding);
+
+        // Returns an empty string on success, or what is wrong with the frame.
+        std::string decode(const std::string& frame, wire_encoding encoding, picojson::value& value);
+    }
+}
@@ -0,0 +1,189 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "framing.h"
+
+namespace rau {
+    namespace framing {
+        namespace {
+            constexpr size_t read_chunk_size = 0x10000;
+        }
+
+        frame_buffer::frame_buffer(size_t max_frame_size)
+            : _begin(0)
+            , _end(0)
+            , _max_frame_size(max_frame_size)
+            , _consumed(0) {}
+
+        char* frame_buffer::prepare(size_t size) {
+            if (_data.size() - _end < size) {
+                // Move what is left of the stream to the front before growing.
+                if (_begin > 0) {
+                    memmove(_data.data(), _data.data() + _begin, _end - _begin);
+                    _end -= _begin;
+                    _begin = 0;
+                }
+                if (_data.size() - _end < size) {
+                    _data.resize(_end + size);
+                }
+            }
+            return _data.data() + _end;
+        }
+
+        void frame_buffer::commit(size_t size) {
+            _end += size;
+        }
+
+        frame_buffer::status frame_buffer::next(boost::string_ref& frame) {
+            if (_end - _begin < sizeof(frame_header)) {
+                return status::incomplete;
+            }
+
+            frame_header header;
+            memcpy(&header, _data.data() + _begin, sizeof header);
+            size_t size = header.value();
+            if (size > _max_frame_size) {
+                return status::too_large;
+            }
+            if (_end - _begin < sizeof header + size) {
+                return status::incomplete;
+            }
+
+            frame = boost::string_ref(_data.data() + _begin + sizeof header, size);
+            _begin += sizeof header + size;
+            _consumed += sizeof header + size;
+            if (_begin == _end) {
+                _begin = _end = 0;
+            }
+            return status::complete;
+        }
+
+        size_t frame_buffer::missing() const {
+            size_t available = _end - _begin;
+            if (available < sizeof(frame_header)) {
+                return sizeof(frame_header) - available;
+            }
+
+            frame_header header;
+            memcpy(&header, _data.data() + _begin, sizeof header);
+            size_t size = sizeof header + std::min<size_t>(header.value(), _max_frame_size);
+            return size > available ? size - available : 0;
+        }
+
+        frame_reader::frame_reader(int fd, size_t max_frame_size)
+            : _fd(fd)
+            , _buffer(max_frame_size)
+            , _has_next(false)
+            , _next_status(frame_buffer::status::incomplete) {}
+
+        frame_reader::status frame_reader::read(boost::string_ref& frame) {
+            for (;;) {
+                frame_buffer::status result;
+                if (_has_next) {
+                    result = _next_status;
+                    frame = _next;
+                    _has_next = false;
+                } else {
+                    result = _buffer.next(frame);
+                }
+
+                if (result == frame_buffer::status::complete) {
+                    return status::ok;
+                } else if (result == frame_buffer::status::too_large) {
+                    return status::too_large;
+                }
+
+                // Read as much as there is, but at least the rest of the current frame.
+                size_t size = std::max(read_chunk_size, _buffer.missing());
+                ssize_t n = ::read(_fd, _buffer.prepare(size), size);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return status::error;
+                } else if (n == 0) {
+                    return status::eof;
+                }
+                _buffer.commit(n);
+            }
+        }
+
+        bool frame_reader::buffered() {
+            // Peeking has to take the frame out of the buffer, so it is kept for the next read().
+            if (!_has_next) {
+                _next_status = _buffer.next(_next);
+                _has_next = _next_status != frame_buffer::status::incomplete;
+            }
+            return _has_next;
+        }
+
+        frame_writer::frame_writer(int fd)
+            : _fd(fd) {}
+
+        void frame_writer::write(std::string payload) {
+            _headers.emplace_back(static_cast<uint32_t>(payload.size()));
+            _payloads.push_back(std::move(payload));
+        }
+
+        bool frame_writer::flush() {
+            size_t written = 0; // of the first header and payload, after a partial writev
+            while (!_payloads.empty()) {
+                iovec iov[64];
+                int count = 0;
+                for (size_t i = 0; i < _payloads.size() && count + 2 <= 64; ++i) {
+                    iov[count++] = { &_headers[i], sizeof(frame_header) };
+                    iov[count++] = { &_payloads[i][0], _payloads[i].size() };
+                }
+
+                // Skip whatever a previous partial write already sent.
+                int first = 0;
+                for (size_t skip = written; skip > 0 && first < count;) {
+                    size_t part = std::min(skip, iov[first].iov_len);
+                    iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + part;
+                    iov[first].iov_len -= part;
+                    skip -= part;
+                    if (iov[first].iov_len == 0) {
+                        ++first;
+                    }
+                }
+
+                ssize_t n = writev(_fd, iov + first, count - first);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+
+                // Drop the frames that are now completely written.
+                written += n;
+                while (!_payloads.empty() && written >= sizeof(frame_header) + _payloads.front().size()) {
+                    written -= sizeof(frame_header) + _payloads.front().size();
+                    _headers.pop_front();
+                    _payloads.pop_front();
+                }
+            }
+            return true;
+        }
+    }
+}
@@ -0,0 +1,124 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace framing {
+        // Messages are a 32-bit little endian length followed by that many bytes of JSON.
+        typedef boost::endian::little_uint32_buf_t frame_header;
+
+        // Requests are small JSON documents; anything near the 4 GiB a header can announce is
+        // a bogus or hostile length prefix, not a request.
+        constexpr size_t default_max_frame_size = 0x100000;
+
+        // Receive buffer that splits a byte stream into frames. The storage is reused from one
+        // frame to the next, and only grows up to the largest frame allowed.
+        class frame_buffer {
+        public:
+            enum class status {
+                complete,
+                incomplete,
+                too_large
+            };
+
+            explicit frame_buffer(size_t max_frame_size = default_max_frame_size);
+
+            // Returns space for at least size more bytes, to be followed by commit().
+            char* prepare(size_t size);
+            void commit(size_t size);
+
+            // Takes the next frame if it has been received completely. frame points into the
+            // buffer and stays valid until the next call to prepare().
+            status next(boost::string_ref& frame);
+
+            // Bytes still needed to complete the frame at the front of the buffer.
+            size_t missing() const;
+
+            // Total bytes committed and taken as frames so far; positions in the stream.
+            uint64_t received() const {
+                return _consumed + (_end - _begin);
+            }
+
+            uint64_t consumed() const {
+                return _consumed;
+            }
+
+        private:
+            std::vector<char> _data;
+            size_t _begin, _end;
+            size_t _max_frame_size;
+            uint64_t _consumed;
+        };
+
+        // Reads frames from a blocking file descriptor, as many bytes per read() as are
+        // available.
+        class frame_reader {
+        public:
+            enum class status {
+                ok,
+                eof,
+                too_large,
+                error
+            };
+
+            frame_reader(int fd, size_t max_frame_size = default_max_frame_size);
+
+            // frame stays valid until the next call. On error, errno is set.
+            status read(boost::string_ref& frame);
+
+            // Whether the next read() can return without blocking.
+            bool buffered();
+
+        private:
+            int _fd;
+            frame_buffer _buffer;
+            bool _has_next;
+            frame_buffer::status _next_status;
+            boost::string_ref _next;
+        };
+
+        // Writes frames to a blocking file descriptor. Frames are queued until flush(), which
+        // sends everything queued with a single writev where possible; a caller that flushes
+        // only before it waits for more input gets its responses coalesced for free.
+        class frame_writer {
+        public:
+            explicit frame_writer(int fd);
+
+            void write(std::string payload);
+
+            // Returns false with errno set if the descriptor could not be written to.
+            bool flush();
+
+            bool empty() const {
+                return _payloads.empty();
+            }
+
+        private:
+            int _fd;
+            std::deque<frame_header> _headers;
+            std::deque<std::string> _payloads;
+        };
+    }
+}
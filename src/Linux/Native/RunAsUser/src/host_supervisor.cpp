@@ -0,0 +1,198 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "host_supervisor.h"
+
+namespace rau {
+#ifndef _APPLE
+    namespace {
+        constexpr int max_events = 64;
+
+        int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+            return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+            errno = ENOSYS;
+            return -1;
+#endif
+        }
+    }
+
+    // Shared with the fallback waiter threads, which may outlive the supervisor.
+    struct host_supervisor::state {
+        int epfd;
+        int event_fd;
+
+        mutable std::mutex mutex;
+        // Watched hosts by pidfd; fallback hosts are only counted.
+        std::unordered_map<int, std::pair<pid_t, exit_handler>> pidfds;
+        size_t waiting_threads = 0;
+        std::vector<exited_host> reaped;
+
+        state()
+            : epfd(epoll_create1(EPOLL_CLOEXEC))
+            , event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = event_fd;
+            if (epfd != -1 && event_fd != -1) {
+                epoll_ctl(epfd, EPOLL_CTL_ADD, event_fd, &ev);
+            }
+        }
+
+        ~state() {
+            for (auto& entry : pidfds) {
+                close(entry.first);
+            }
+            if (event_fd != -1) {
+                close(event_fd);
+            }
+            if (epfd != -1) {
+                close(epfd);
+            }
+        }
+    };
+
+    host_supervisor::host_supervisor()
+        : _state(std::make_shared<state>()) {}
+
+    host_supervisor::~host_supervisor() {}
+
+    int host_supervisor::fd() const {
+        return _state->epfd;
+    }
+
+    bool host_supervisor::watch(pid_t pid, exit_handler handler) {
+        if (_state->epfd == -1 || _state->event_fd == -1) {
+            errno = EBADF;
+            return false;
+        }
+
+        int pidfd = open_pidfd(pid);
+        if (pidfd != -1) {
+            std::lock_guard<std::mutex> lock(_state->mutex);
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = pidfd;
+            if (epoll_ctl(_state->epfd, EPOLL_CTL_ADD, pidfd, &ev) == -1) {
+                int err = errno;
+                close(pidfd);
+                errno = err;
+                return false;
+            }
+            _state->pidfds.emplace(pidfd, std::make_pair(pid, std::move(handler)));
+            return true;
+        }
+
+        if (errno != ENOSYS) {
+            return false;
+        }
+
+        // Kernels before 5.3 have no pidfds; block a thread in waitpid instead, which is still
+        // much cheaper than a whole helper process.
+        std::shared_ptr<state> shared = _state;
+        {
+            std::lock_guard<std::mutex> lock(shared->mutex);
+            ++shared->waiting_threads;
+        }
+        std::thread([shared, pid, handler]() {
+            int status = 0;
+            while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {}
+
+            {
+                std::lock_guard<std::mutex> lock(shared->mutex);
+                --shared->waiting_threads;
+                shared->reaped.push_back({ pid, status, handler });
+            }
+            uint64_t one = 1;
+            write(shared->event_fd, &one, sizeof one);
+        }).detach();
+        return true;
+    }
+
+    std::vector<host_supervisor::exited_host> host_supervisor::collect_exited() {
+        epoll_event events[max_events];
+        int count = epoll_wait(_state->epfd, events, max_events, 0);
+
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        std::vector<exited_host> exited;
+        exited.swap(_state->reaped);
+
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == _state->event_fd) {
+                uint64_t value;
+                read(fd, &value, sizeof value);
+                continue;
+            }
+
+            auto it = _state->pidfds.find(fd);
+            if (it == _state->pidfds.end()) {
+                continue;
+            }
+
+            // A readable pidfd means the process has exited, so this doesn't block.
+            int status = 0;
+            pid_t pid = it->second.first;
+            if (waitpid(pid, &status, WNOHANG) == 0) {
+                continue;
+            }
+
+            epoll_ctl(_state->epfd, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            exited.push_back({ pid, status, std::move(it->second.second) });
+            _state->pidfds.erase(it);
+        }
+
+        return exited;
+    }
+
+    size_t host_supervisor::watched() const {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        return _state->pidfds.size() + _state->waiting_threads;
+    }
+#else
+    struct host_supervisor::state {};
+
+    host_supervisor::host_supervisor() {}
+
+    host_supervisor::~host_supervisor() {}
+
+    int host_supervisor::fd() const {
+        return -1;
+    }
+
+    bool host_supervisor::watch(pid_t pid, exit_handler handler) {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    std::vector<host_supervisor::exited_host> host_supervisor::collect_exited() {
+        return std::vector<exited_host>();
+    }
+
+    size_t host_supervisor::watched() const {
+        return 0;
+    }
+#endif
+}
@@ -0,0 +1,66 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    // Keeps track of the Microsoft.R.Host processes started by a long-lived helper, so that
+    // one event loop can wait for all of them instead of a blocked helper process (and its
+    // open PAM session) per R session. Where the kernel supports pidfds, every host is a
+    // pidfd in the supervisor's epoll set; on older kernels a thread per host waits for it.
+    class host_supervisor {
+    public:
+        // Called with the pid and wait status once a watched host has exited and been reaped.
+        typedef std::function<void(pid_t pid, int status)> exit_handler;
+
+        struct exited_host {
+            pid_t pid;
+            int status;
+            exit_handler handler;
+        };
+
+        host_supervisor();
+        ~host_supervisor();
+
+        // Becomes readable when a watched host has exited; belongs in the caller's event loop.
+        int fd() const;
+
+        // Starts watching pid, which must be a child of this process. Can be called from any
+        // thread. Returns false with errno set if the process cannot be watched.
+        bool watch(pid_t pid, exit_handler handler);
+
+        // Reaps the hosts that have exited since the last call. Their handlers have not been
+        // run; the caller decides on which thread they run.
+        std::vector<exited_host> collect_exited();
+
+        size_t watched() const;
+
+    private:
+        struct state;
+        std::shared_ptr<state> _state;
+
+        host_supervisor(const host_supervisor&) = delete;
+        host_supervisor& operator=(const host_supervisor&) = delete;
+    };
+}
@@ -22,65 +22,319 @@
 
 #include "stdafx.h"
 #include "log.h"
+#include "log_sink.h"
 
 using namespace std::literals;
 
 namespace rau {
     namespace log {
         namespace {
-            std::mutex log_mutex, terminate_mutex;
+            // A formatted log record. Longer messages are cut off.
+            constexpr size_t record_text_size = 1000;
+            // Records that can be waiting for the writer; a power of two.
+            constexpr size_t record_capacity = 2048;
+            // How long the writer lets records pile up after being woken, so that a steady
+            // trickle of messages doesn't cost a wakeup and a write() each.
+            constexpr auto batch_window = 100us;
+            // How long, at most, a caller waits for room when the queue is full.
+            constexpr auto push_retry_interval = 50us;
+            constexpr int max_push_retries = 200;
+
+            struct record {
+                std::atomic<size_t> sequence;
+                log_level level;
+                // Already formatted by the process that sent it to this one's collector.
+                bool forwarded;
+                uint16_t length;
+                uint64_t request_id;
+                timespec time;
+                char text[record_text_size];
+            };
+
+            // Bounded queue that any number of threads can push to without locking, and that
+            // the writer thread alone pops from. Each slot's sequence number says whose turn
+            // it is: a producer may fill slot i once sequence == i, the consumer may take it
+            // once sequence == i + 1.
+            class record_queue {
+            public:
+                record_queue() {
+                    for (size_t i = 0; i < record_capacity; ++i) {
+                        _slots[i].sequence.store(i, std::memory_order_relaxed);
+                    }
+                }
+
+                // Returns false, without waiting, if the queue is full.
+                bool try_push(log_level level, bool forwarded, uint64_t request_id, const timespec& time, const char* text, size_t length) {
+                    size_t pos = _enqueue.load(std::memory_order_relaxed);
+                    record* slot;
+                    for (;;) {
+                        slot = &_slots[pos & (record_capacity - 1)];
+                        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+                        if (diff == 0) {
+                            if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                                break;
+                            }
+                        } else if (diff < 0) {
+                            return false;
+                        } else {
+                            pos = _enqueue.load(std::memory_order_relaxed);
+                        }
+                    }
+
+                    slot->level = level;
+                    slot->forwarded = forwarded;
+                    slot->request_id = request_id;
+                    slot->time = time;
+                    slot->length = (uint16_t)length;
+                    memcpy(slot->text, text, length);
+                    slot->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+
+                // Consumer only.
+                bool ready() const {
+                    return _slots[_dequeue & (record_capacity - 1)].sequence.load(std::memory_order_acquire) == _dequeue + 1;
+                }
+
+                // Consumer only. Calls f with the next record, then frees its slot.
+                template<typename F>
+                bool try_pop(F&& f) {
+                    if (!ready()) {
+                        return false;
+                    }
+                    record& slot = _slots[_dequeue & (record_capacity - 1)];
+                    f(slot);
+                    slot.sequence.store(_dequeue + record_capacity, std::memory_order_release);
+                    ++_dequeue;
+                    return true;
+                }
+
+                // Records pushed, or being pushed, so far.
+                size_t enqueued() const {
+                    return _enqueue.load(std::memory_order_acquire);
+                }
+
+                // Consumer only: records popped so far.
+                size_t dequeued() const {
+                    return _dequeue;
+                }
+
+            private:
+                record _slots[record_capacity];
+                std::atomic<size_t> _enqueue{ 0 };
+                // Keeps the producers' and the consumer's counters on separate cache lines.
+                char _padding[64];
+                size_t _dequeue = 0;
+            };
+
+            struct log_state {
+                record_queue queue;
+                // Records lost to a full queue since the writer last reported them.
+                std::atomic<size_t> dropped{ 0 };
+                // Set while the writer is (about to be) waiting on wake; only then do
+                // producers need to take wake_mutex.
+                std::atomic<bool> writer_idle{ false };
+                std::atomic<bool> flush_requested{ false };
+                std::atomic<bool> writer_started{ false };
+                std::mutex wake_mutex;
+                std::condition_variable wake, flushed;
+                // Records written out so far; guarded by wake_mutex.
+                size_t written = 0;
+                // Only used by the writer thread once it runs.
+                rotating_file file;
+                datagram_sink collector;
+                pid_t pid;
+            };
+
+            // Never destroyed, since the writer thread is never joined.
+            log_state& state() {
+                static log_state* s = new log_state();
+                return *s;
+            }
+
+            std::mutex terminate_mutex;
             fs::path log_filename;
-            FILE* logfile;
-            int indent;
+            std::atomic<int> indent{ 0 };
             log::log_verbosity current_verbosity;
+            thread_local uint64_t current_request_id;
 
-            void log_flush_thread() {
-                for (;;) {
-                    std::this_thread::sleep_for(1s);
-                    flush_log();
+            void write_all(int fd, const std::string& data) {
+                const char* p = data.data();
+                size_t left = data.size();
+                while (left > 0) {
+                    ssize_t n = write(fd, p, left);
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n <= 0) {
+                        // Nowhere left to report it.
+                        return;
+                    }
+                    p += n;
+                    left -= n;
                 }
             }
-        }
-        void init_log(const std::string& log_suffix, const fs::path& log_dir, log::log_verbosity verbosity) {
-            {
-                current_verbosity = verbosity;
 
-                std::string filename = "Microsoft.R.Host.RunAsUser_";
-                if (!log_suffix.empty()) {
-                    filename += log_suffix + "_";
+            void push_record(log_level level, bool forwarded, const char* text, size_t length) {
+                log_state& s = state();
+                timespec now;
+                clock_gettime(CLOCK_REALTIME, &now);
+
+                // If the writer has fallen behind, give it a little time to catch up before
+                // giving up on the record.
+                for (int attempt = 0; !s.queue.try_push(level, forwarded, current_request_id, now, text, length); ++attempt) {
+                    if (attempt == max_push_retries) {
+                        s.dropped.fetch_add(1, std::memory_order_relaxed);
+                        break;
+                    }
+                    std::this_thread::sleep_for(push_retry_interval);
                 }
 
-                time_t t;
-                time(&t);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (s.writer_idle.load(std::memory_order_relaxed)) {
+                    std::lock_guard<std::mutex> lock(s.wake_mutex);
+                    s.wake.notify_one();
+                }
+            }
 
-                tm tm;
-                localtime_r(&t, &tm);
+            // Turns a record into a line of the shared log:
+            // 2017-05-04 13:07:01.123 [pid:request] message
+            class record_formatter {
+            public:
+                void format(const record& r, pid_t pid, std::string& line) {
+                    line.clear();
+                    if (!r.forwarded) {
+                        if (r.time.tv_sec != _second) {
+                            _second = r.time.tv_sec;
+                            tm tm;
+                            localtime_r(&_second, &tm);
+                            strftime(_stamp, sizeof _stamp, "%Y-%m-%d %H:%M:%S", &tm);
+                        }
+
+                        char prefix[96];
+                        int n = r.request_id
+                            ? snprintf(prefix, sizeof prefix, "%s.%03ld [%d:%llu] ", _stamp, r.time.tv_nsec / 1000000, pid, (unsigned long long)r.request_id)
+                            : snprintf(prefix, sizeof prefix, "%s.%03ld [%d:-] ", _stamp, r.time.tv_nsec / 1000000, pid);
+                        line.append(prefix, n);
+                    }
+                    line.append(r.text, r.length);
+                    if (line.empty() || line.back() != '\n') {
+                        line += '\n';
+                    }
+                }
 
-                size_t len = filename.size();
-                filename.resize(len + 1 + PATH_MAX);
-                auto it = filename.begin() + len;
-                strftime(&*it, filename.end() - it, "%Y%m%d_%H%M%S", &tm);
-                filename.resize(strlen(filename.c_str()));
+            private:
+                time_t _second = -1;
+                char _stamp[32];
+            };
 
-                // Add PID to prevent conflicts in case two hosts with the same suffix
-                // get started at the same time.
-                filename += "_pid" + std::to_string(getpid());
+            // The only thread that touches the log file. Takes whatever records are
+            // available, writes them with one write() per destination, and sleeps until more
+            // arrive or a flush is requested.
+            void log_writer_thread() {
+                // Leave signal handling to the main thread (the socket server waits for
+                // SIGTERM on a signalfd, which only works if no other thread takes it).
+                sigset_t mask;
+                sigfillset(&mask);
+                pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+                log_state& s = state();
+                std::string file_batch, stderr_batch, line;
+                file_batch.reserve(0x10000);
+                record_formatter formatter;
+                auto append = [&](const record& r) {
+                    formatter.format(r, s.pid, line);
+                    if (!s.collector.is_open() || !s.collector.send(line.data(), line.size())) {
+                        file_batch += line;
+                    }
+                    // Don't log trace level messages to stderr by default.
+                    if (r.level != log_level::trace && !r.forwarded) {
+                        stderr_batch.append(r.text, r.length);
+                    }
+                };
+
+                for (;;) {
+                    size_t dropped = s.dropped.exchange(0);
+                    if (dropped) {
+                        std::string note = "Log queue overflow, " + std::to_string(dropped) + " records dropped.\n";
+                        file_batch += note;
+                        stderr_batch += note;
+                    }
 
-                log_filename = log_dir / (filename + ".log");
+                    while (file_batch.size() < 0x10000 && s.queue.try_pop(append)) {
+                    }
+
+                    if (!file_batch.empty()) {
+                        s.file.append(file_batch);
+                    }
+                    if (!stderr_batch.empty()) {
+                        write_all(STDERR_FILENO, stderr_batch);
+                    }
+                    file_batch.clear();
+                    stderr_batch.clear();
+
+                    std::unique_lock<std::mutex> lock(s.wake_mutex);
+                    s.written = s.queue.dequeued();
+                    s.flushed.notify_all();
+                    if (s.queue.ready()) {
+                        continue;
+                    }
+
+                    // Pairs with the fence in vlogf: either this thread sees the new record,
+                    // or the producer sees writer_idle and wakes it.
+                    s.writer_idle.store(true);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    s.wake.wait(lock, [&s] { return s.queue.ready() || s.dropped.load() != 0; });
+                    s.writer_idle.store(false, std::memory_order_relaxed);
+                    lock.unlock();
+
+                    if (!s.flush_requested.exchange(false)) {
+                        std::this_thread::sleep_for(batch_window);
+                    }
+                }
             }
+        }
+
+        void init_log(const std::string& log_suffix, const fs::path& log_dir, log::log_verbosity verbosity, const sink_options& options) {
+            current_verbosity = verbosity;
 
-            logfile = fopen(log_filename.make_preferred().string().c_str(), "w");
-            if (logfile) {
-                // Logging happens often, so use a large buffer to avoid hitting the disk all the time.
-                setvbuf(logfile, nullptr, _IOFBF, 0x100000);
+            // One file for every helper process, rather than one each.
+            std::string filename = "Microsoft.R.Host.RunAsUser";
+            if (!log_suffix.empty()) {
+                filename += "_" + log_suffix;
+            }
+            log_filename = log_dir / (filename + ".log");
 
-                // Start a thread that will flush the buffer periodically.
-                std::thread(log_flush_thread).detach();
-            } else {
-                std::string error = "Error creating logfile: " + log_filename.make_preferred().string() + "\r\n";
+            log_state& ls = state();
+            ls.pid = getpid();
+            if (!ls.file.open(log_filename.make_preferred(), options.max_size, options.max_age, options.keep)) {
+                std::string error = "Error opening logfile: " + log_filename.make_preferred().string() + "\r\n";
                 fprintf(stderr, "Error: %d\r\n", errno);
                 fputs(error.c_str(), stderr);
             }
+            if (!options.collector_path.empty()) {
+                ls.collector.open(options.collector_path);
+            }
+
+            // Messages still go to stderr without a log file, so the writer starts regardless.
+            if (!ls.writer_started.exchange(true)) {
+                std::thread(log_writer_thread).detach();
+            }
+        }
+
+        bool host_collector(const std::string& path) {
+            return start_collector(path, [](const char* data, size_t size) {
+                push_record(log_level::trace, true, data, std::min(size, record_text_size));
+            });
+        }
+
+        void set_request_id(uint64_t id) {
+            current_request_id = id;
+        }
+
+        uint64_t get_request_id() {
+            return current_request_id;
         }
 
         void vlogf(log_verbosity verbosity, log_level message_type, const char* format, va_list va) {
@@ -88,47 +342,47 @@ namespace rau {
                 return;
             }
 
-            std::lock_guard<std::mutex> lock(log_mutex);
-
-            va_list va2;
-            va_copy(va2, va);
-
-            if (logfile) {
-                for (int i = 0; i < indent; ++i) {
-                    fputc('\t', logfile);
-                }
-                vfprintf(logfile, format, va);
-
-#ifndef NDEBUG
-                // In Debug builds, flush on every write so that log is always up-to-date.
-                // In Release builds, we rely on flush_log being called on process shutdown.
-                fflush(logfile);
-#endif
+            log_state& s = state();
+            if (!s.writer_started.load(std::memory_order_relaxed)) {
+                return;
             }
 
-            // Don't log trace level messages to stderr by default.
-            if (message_type != log_level::trace) {
-                for (int i = 0; i < indent; ++i) {
-                    fputc('\t', stderr);
-                }
-                vfprintf(stderr, format, va2);
+            // Formatting has to happen here, while va is valid; the writer thread does the rest.
+            char text[record_text_size];
+            int tabs = std::min<int>(indent, 16);
+            memset(text, '\t', tabs);
+            int n = vsnprintf(text + tabs, sizeof text - tabs, format, va);
+            if (n < 0) {
+                return;
+            }
+            size_t length = tabs + n;
+            if (length >= sizeof text) {
+                static constexpr char cut[] = "...\n";
+                memcpy(text + sizeof text - sizeof cut, cut, sizeof cut);
+                length = sizeof text - 1;
             }
 
-            va_end(va2);
+            push_record(message_type, false, text, length);
         }
 
         void indent_log(int n) {
-            indent += n;
-            if (indent < 0) {
-                indent = 0;
+            int current = indent.load();
+            while (!indent.compare_exchange_weak(current, std::max(current + n, 0))) {
             }
         }
 
         void flush_log() {
-            std::lock_guard<std::mutex> lock(log_mutex);
-            if (logfile) {
-                fflush(logfile);
+            log_state& s = state();
+            if (!s.writer_started.load()) {
+                return;
             }
+
+            // Waits for everything logged before this call to be written out.
+            size_t target = s.queue.enqueued();
+            s.flush_requested.store(true);
+            std::unique_lock<std::mutex> lock(s.wake_mutex);
+            s.wake.notify_one();
+            s.flushed.wait(lock, [&s, target] { return s.written >= target; });
         }
 
 
@@ -138,10 +392,7 @@ namespace rau {
             char message[0xFFFF];
             vsprintf(message, format, va);
 
-            if (unexpected) {
-                logf(log_verbosity::minimal, "Fatal error: ");
-            }
-            logf(log_verbosity::minimal, unexpected ? log_level::error : log_level::information, "%s\n", message);
+            logf(log_verbosity::minimal, unexpected ? log_level::error : log_level::information, unexpected ? "Fatal error: %s\n" : "%s\n", message);
             flush_log();
             std::terminate();
         }
@@ -40,8 +40,38 @@ namespace rau {
             error
         };
 
-        void init_log(const std::string& log_suffix, const fs::path& log_dir, log_verbosity log_level);
+        struct sink_options {
+            // The shared log file is rotated once it's larger than this...
+            uint64_t max_size = 0x1000000;
+            // ...or this much time has passed since it was started.
+            std::chrono::seconds max_age = std::chrono::hours(24);
+            // Rotated files kept next to the current one.
+            int keep = 5;
+            // If set, records are sent to the collector listening on this datagram socket,
+            // and only go to the file while it isn't there.
+            std::string collector_path;
+        };
+
+        // Starts logging to <log_dir>/Microsoft.R.Host.RunAsUser[_<log_suffix>].log, which is
+        // shared with every other helper process using the same directory. Each line carries
+        // a timestamp, the pid, and the request id set by set_request_id.
+        void init_log(const std::string& log_suffix, const fs::path& log_dir, log_verbosity log_level, const sink_options& options = sink_options());
+
+        // Receives the records of other helper processes on a datagram socket at path and
+        // writes them to this process's log. Returns false with errno set on failure.
+        bool host_collector(const std::string& path);
+
+        // Tags what the calling thread logs from now on with a request id; 0 for none.
+        void set_request_id(uint64_t id);
+
+        // The id the calling thread tags its records with, for threads doing work on its behalf.
+        uint64_t get_request_id();
 
+        // Formats the message and queues it for a background writer thread, without taking
+        // a lock or touching the file. Messages longer than about 1000 bytes are cut off.
+        // Overflow: if the writer has fallen 2048 messages behind, the caller waits up to
+        // 10ms for room, then drops the message; the log notes how many were lost. Nothing
+        // is logged before init_log.
         void vlogf(log_verbosity level, log_level message_type, const char* format, va_list va);
 
         inline void logf(log_verbosity verbosity, log_level message_type, const char* format, ...) {
@@ -64,6 +94,7 @@ namespace rau {
 
         void indent_log(int n);
 
+        // Returns once everything logged so far has been written out.
         void flush_log();
 
         __attribute__((noreturn)) void terminate(const char* format, ...);
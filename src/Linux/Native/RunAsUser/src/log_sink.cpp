@@ -0,0 +1,314 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "log_sink.h"
+
+using namespace std::literals;
+
+namespace rau {
+    namespace log {
+        namespace {
+            constexpr auto recheck_interval = 1s;
+            // How long rotation waits for another process that holds the lock, at most.
+            constexpr int lock_attempts = 10;
+            constexpr auto lock_retry_interval = 5ms;
+            // Longest record a collector accepts; longer datagrams are cut off.
+            constexpr size_t max_datagram_size = 0x2000;
+
+            void write_all(int fd, const char* p, size_t left) {
+                while (left > 0) {
+                    ssize_t n = write(fd, p, left);
+                    if (n < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (n <= 0) {
+                        // Nowhere left to report it.
+                        return;
+                    }
+                    p += n;
+                    left -= n;
+                }
+            }
+
+            bool make_unix_address(const std::string& path, sockaddr_un& addr) {
+                if (path.size() >= sizeof addr.sun_path) {
+                    errno = ENAMETOOLONG;
+                    return false;
+                }
+                memset(&addr, 0, sizeof addr);
+                addr.sun_family = AF_UNIX;
+                memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+                return true;
+            }
+        }
+
+        rotating_file::~rotating_file() {
+            if (_fd != -1) {
+                close(_fd);
+            }
+        }
+
+        bool rotating_file::open(const fs::path& path, uint64_t max_size, std::chrono::seconds max_age, int keep) {
+            _path = path.string();
+            _lock_path = _path + ".lock";
+            _max_size = max_size;
+            _max_age = max_age;
+            _keep = std::max(keep, 1);
+            return open_current();
+        }
+
+        bool rotating_file::open_current() {
+            if (_fd != -1) {
+                close(_fd);
+                _fd = -1;
+            }
+
+            // The directory is usually world-writable /tmp, and this runs as root: don't
+            // follow links, and only append to a file that root owns. O_NONBLOCK keeps a FIFO
+            // planted there from blocking the open; it is cleared once the file checks out.
+            int fd = ::open(_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC, 0644);
+            if (fd == -1) {
+                return false;
+            }
+
+            struct stat st;
+            if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+                close(fd);
+                errno = EPERM;
+                return false;
+            }
+            int flags = fcntl(fd, F_GETFL);
+            if (flags == -1 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1) {
+                int err = errno;
+                close(fd);
+                errno = err;
+                return false;
+            }
+
+            // The lock file's mtime is when the current file was started.
+            int lock_fd = open_lock();
+            if (lock_fd != -1) {
+                close(lock_fd);
+            }
+
+            _fd = fd;
+            _ino = st.st_ino;
+            _dev = st.st_dev;
+            // Check for rotation on the first append, since a one-shot helper doesn't live
+            // long enough to see the interval pass.
+            _next_check = std::chrono::steady_clock::time_point();
+            return true;
+        }
+
+        int rotating_file::open_lock() {
+            // Like the log itself, the lock file must be root's own: anyone else could hold
+            // it forever, or backdate it to have the log rotated on every record. One that
+            // belongs to someone else is removed, which root may do even in sticky /tmp.
+            for (int attempt = 0; attempt < 2; ++attempt) {
+                int fd = ::open(_lock_path.c_str(), O_WRONLY | O_CREAT | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC, 0644);
+                struct stat st;
+                if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid() && st.st_nlink == 1) {
+                    return fd;
+                }
+                if (fd != -1) {
+                    close(fd);
+                }
+                if (unlink(_lock_path.c_str()) == -1 && errno != ENOENT) {
+                    break;
+                }
+            }
+            return -1;
+        }
+
+        void rotating_file::append(const std::string& data) {
+            if (_fd == -1) {
+                return;
+            }
+            rotate_if_due(data.size());
+            write_all(_fd, data.data(), data.size());
+        }
+
+        void rotating_file::rotate_if_due(size_t incoming) {
+            struct stat st;
+            if (fstat(_fd, &st) == -1) {
+                return;
+            }
+            bool due = st.st_size > 0 && (uint64_t)st.st_size + incoming > _max_size;
+
+            auto now = std::chrono::steady_clock::now();
+            if (!due && now >= _next_check) {
+                _next_check = now + recheck_interval;
+
+                // Another process may have rotated the file from under us.
+                struct stat current;
+                if (stat(_path.c_str(), &current) == -1 || current.st_ino != _ino || current.st_dev != _dev) {
+                    open_current();
+                    return;
+                }
+
+                if (st.st_size > 0) {
+                    int lock_fd = open_lock();
+                    struct stat lock_st;
+                    if (lock_fd != -1 && fstat(lock_fd, &lock_st) == 0) {
+                        due = time(nullptr) - lock_st.st_mtime >= _max_age.count();
+                    }
+                    if (lock_fd != -1) {
+                        close(lock_fd);
+                    }
+                }
+            }
+
+            // After the lock couldn't be had, the file just grows for a while.
+            if (due && now >= _next_rotation) {
+                rotate();
+            }
+        }
+
+        void rotating_file::rotate() {
+            int lock_fd = open_lock();
+            if (lock_fd == -1) {
+                _next_rotation = std::chrono::steady_clock::now() + recheck_interval;
+                return;
+            }
+            // Rotation takes the other processes a moment; one that holds the lock for longer
+            // is stuck, and the log writer mustn't be stuck with it.
+            int result = -1;
+            for (int attempt = 0; attempt < lock_attempts; ++attempt) {
+                if ((result = flock(lock_fd, LOCK_EX | LOCK_NB)) == 0 || (errno != EWOULDBLOCK && errno != EINTR)) {
+                    break;
+                }
+                std::this_thread::sleep_for(lock_retry_interval);
+            }
+            if (result == -1) {
+                close(lock_fd);
+                _next_rotation = std::chrono::steady_clock::now() + recheck_interval;
+                return;
+            }
+
+            // Whoever held the lock before may have rotated already.
+            struct stat current;
+            if (stat(_path.c_str(), &current) == 0 && current.st_ino == _ino && current.st_dev == _dev) {
+                for (int i = _keep - 1; i >= 1; --i) {
+                    rename((_path + "." + std::to_string(i)).c_str(), (_path + "." + std::to_string(i + 1)).c_str());
+                }
+                rename(_path.c_str(), (_path + ".1").c_str());
+                futimens(lock_fd, nullptr);
+            }
+
+            open_current();
+            close(lock_fd);
+        }
+
+        datagram_sink::~datagram_sink() {
+            if (_fd != -1) {
+                close(_fd);
+            }
+        }
+
+        void datagram_sink::open(const std::string& path) {
+            _path = path;
+            connect_socket();
+        }
+
+        bool datagram_sink::connect_socket() {
+            auto now = std::chrono::steady_clock::now();
+            if (now < _next_attempt) {
+                return false;
+            }
+            _next_attempt = now + recheck_interval;
+
+            if (_fd != -1) {
+                close(_fd);
+            }
+            _fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            if (_fd == -1) {
+                return false;
+            }
+
+            sockaddr_un addr;
+            if (!make_unix_address(_path, addr) || connect(_fd, (sockaddr*)&addr, sizeof addr) == -1) {
+                close(_fd);
+                _fd = -1;
+                return false;
+            }
+            return true;
+        }
+
+        bool datagram_sink::send(const char* data, size_t size) {
+            if (_fd == -1 && !connect_socket()) {
+                return false;
+            }
+
+            ssize_t n;
+            while ((n = ::send(_fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL)) == -1 && errno == EINTR);
+            if (n == -1) {
+                // The collector went away (or restarted at the same path); a full socket
+                // buffer is worth reconnecting over just the same.
+                close(_fd);
+                _fd = -1;
+                return false;
+            }
+            return true;
+        }
+
+        bool start_collector(const std::string& path, std::function<void(const char* data, size_t size)> handler) {
+            sockaddr_un addr;
+            if (!make_unix_address(path, addr)) {
+                return false;
+            }
+
+            int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+            if (fd == -1) {
+                return false;
+            }
+
+            unlink(path.c_str());
+            mode_t old_umask = umask(077);
+            int result = bind(fd, (sockaddr*)&addr, sizeof addr);
+            umask(old_umask);
+            if (result == -1) {
+                int err = errno;
+                close(fd);
+                errno = err;
+                return false;
+            }
+
+            std::thread([fd, handler]() {
+                sigset_t mask;
+                sigfillset(&mask);
+                pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+                std::vector<char> buffer(max_datagram_size);
+                for (;;) {
+                    ssize_t n = recv(fd, buffer.data(), buffer.size(), 0);
+                    if (n > 0) {
+                        handler(buffer.data(), n);
+                    } else if (n == -1 && errno != EINTR) {
+                        return;
+                    }
+                }
+            }).detach();
+            return true;
+        }
+    }
+}
@@ -0,0 +1,106 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace log {
+        // A log file shared by every helper process: each batch of whole records goes out with
+        // a single O_APPEND write(), so records from different processes never interleave.
+        // Once the file grows past max_size bytes, or max_age has passed since the last
+        // rotation, path is renamed to path.1 (path.1 to path.2, and so on, keeping `keep`
+        // old files) and a new file is started. Rotation is serialized between processes
+        // with flock on path.lock, whose mtime records when the current file was started;
+        // processes still writing to a renamed file notice within a second and reopen path.
+        class rotating_file {
+        public:
+            rotating_file() = default;
+            rotating_file(const rotating_file&) = delete;
+            rotating_file& operator=(const rotating_file&) = delete;
+            ~rotating_file();
+
+            // Returns false with errno set if the file can't be opened, or isn't a regular
+            // file owned by the effective user.
+            bool open(const fs::path& path, uint64_t max_size, std::chrono::seconds max_age, int keep);
+
+            bool is_open() const {
+                return _fd != -1;
+            }
+
+            // data must consist of whole records.
+            void append(const std::string& data);
+
+        private:
+            bool open_current();
+            // Opens the lock file, creating it if needed. Returns -1 unless it is a regular
+            // file owned by the effective user.
+            int open_lock();
+            void rotate_if_due(size_t incoming);
+            void rotate();
+
+            std::string _path;
+            std::string _lock_path;
+            uint64_t _max_size = 0;
+            std::chrono::seconds _max_age;
+            int _keep = 0;
+            int _fd = -1;
+            ino_t _ino = 0;
+            dev_t _dev = 0;
+            std::chrono::steady_clock::time_point _next_check;
+            // No rotation before then, since the lock couldn't be had.
+            std::chrono::steady_clock::time_point _next_rotation;
+        };
+
+        // Sends records to a collector's datagram socket, one record per datagram, without
+        // ever blocking. Reconnects at most once a second while the collector is missing.
+        class datagram_sink {
+        public:
+            datagram_sink() = default;
+            datagram_sink(const datagram_sink&) = delete;
+            datagram_sink& operator=(const datagram_sink&) = delete;
+            ~datagram_sink();
+
+            void open(const std::string& path);
+
+            bool is_open() const {
+                return !_path.empty();
+            }
+
+            // Returns false if the record didn't go out, so that it can be written elsewhere.
+            bool send(const char* data, size_t size);
+
+        private:
+            bool connect_socket();
+
+            std::string _path;
+            int _fd = -1;
+            std::chrono::steady_clock::time_point _next_attempt;
+        };
+
+        // Binds a datagram socket at path, accessible to root only, and calls handler with
+        // every record received on it from a background thread. Returns false with errno set
+        // if the socket can't be created.
+        bool start_collector(const std::string& path, std::function<void(const char* data, size_t size)> handler);
+    }
+}
@@ -23,67 +23,62 @@
 #include "stdafx.h"
 #include "picojson.h"
 #include "util.h"
+#include "response.h"
+#include "pam_conv.h"
 #include "log.h"
+#include "channel.h"
+#include "server.h"
+#include "nss_cache.h"
+#include "pam_stack.h"
+#include "policy.h"
+#include "spawn.h"
+#include "process.h"
+#include "host_supervisor.h"
+#include "cgroup.h"
+#include "placement.h"
+#include "admission.h"
+#include "framing.h"
+#include "request.h"
+#include "timing.h"
+#include "metrics.h"
 
 using namespace rau::log;
+using rau::timing::phase;
 
 static constexpr int RTVS_AUTH_OK           = 0;
 static constexpr int RTVS_AUTH_INIT_FAILED = 200;
 static constexpr int RTVS_AUTH_BAD_INPUT   = 201;
 static constexpr int RTVS_AUTH_NO_INPUT    = 202;
+static constexpr int RTVS_AUTH_BUSY        = 203;
+static constexpr int RTVS_AUTH_PRESSURE    = 204;
 
-static constexpr char RTVS_JSON_MSG_NAME[] = "name";
-static constexpr char RTVS_JSON_MSG_USERNAME[] = "username";
-static constexpr char RTVS_JSON_MSG_PASSWORD[] = "password";
-static constexpr char RTVS_JSON_MSG_ARGS[] = "arguments";
-static constexpr char RTVS_JSON_MSG_ENV[] = "environment";
-static constexpr char RTVS_JSON_MSG_CWD[] = "workingDirectory";
-static constexpr char RTVS_JSON_MSG_GRP[] = "allowedGroup";
 static constexpr char RTVS_JSON_MSG_PID[] = "processId";
-
-static constexpr char RTVS_RESPONSE_TYPE_PAM_INFO[] = "pam-info";
-static constexpr char RTVS_RESPONSE_TYPE_PAM_ERROR[] = "pam-error";
-static constexpr char RTVS_RESPONSE_TYPE_SYSTEM_ERROR[] = "unix-error";
-static constexpr char RTVS_RESPONSE_TYPE_JSON_ERROR[] = "json-error";
-static constexpr char RTVS_RESPONSE_TYPE_RTVS_RESULT[] = "rtvs-result";
-static constexpr char RTVS_RESPONSE_TYPE_RTVS_ERROR[] = "rtvs-error";
-
-static constexpr char RTVS_MSG_AUTH_ONLY[] = "AuthOnly";
-static constexpr char RTVS_MSG_AUTH_AND_RUN[] = "AuthAndRun";
-static constexpr char RTVS_MSG_KILL_PROCESS[] = "KillProcess";
+static constexpr char RTVS_JSON_MSG_SIGNAL[] = "signal";
+static constexpr char RTVS_JSON_MSG_EXIT_CODE[] = "exitCode";
 
 static constexpr char RTVS_RHOST_PATH[] = "/usr/lib/rtvs/Microsoft.R.Host";
-static constexpr char RTVS_KILL_PATH[] = "/bin/kill";
+static constexpr char RTVS_PAM_SERVICE[] = "rtvs";
 
-std::string read_string(FILE* stream) {
-    boost::endian::little_uint32_buf_t data_size;
-    if (fread(&data_size, sizeof data_size, 1, stream) != 1) {
-        return std::string();
-    }
+// Set by -e: log the arguments and environment of every Microsoft.R.Host launch.
+static bool log_host_command = false;
 
-    std::string str(data_size.value(), '\0');
-    if (!str.empty()) {
-        if (fread(&str[0], str.size(), 1, stream) != 1) {
-            return std::string();
-        }
-    }
+// Set by -j: how many entries of an AuthOnlyBatch are authenticated at the same time.
+static size_t batch_parallelism = 8;
 
-    return str;
-}
+// Most entries an AuthOnlyBatch may have.
+static constexpr size_t RTVS_MAX_BATCH_ENTRIES = 100;
 
-void write_string(FILE* stream, const std::string &data) {
-    boost::endian::little_uint32_buf_t data_size(static_cast<uint32_t>(data.size()));
+// AuthOnlyBatch is only for root, and for the clients root allowed on the socket server.
+static bool batches_allowed = false;
 
-    if (fwrite(&data_size, sizeof data_size, 1, stream) == 1) {
-        if (fwrite(data.data(), data.size(), 1, stream) == 1) {
-            fflush(stream);
-        } else {
-            std::terminate();
-        }
-    } else {
-        std::terminate();
-    }
-}
+// Largest cpu.weight and io.weight cgroup v2 accepts.
+static constexpr double RTVS_CGROUP_MAX_WEIGHT = 10000;
+
+// Upper bounds for a single step of a KillProcess signal sequence, for the number of steps,
+// and for all of its timeouts together, so that a request can't hold a worker indefinitely.
+static constexpr double RTVS_KILL_MAX_STEP_TIMEOUT_MS = 60000;
+static constexpr size_t RTVS_KILL_MAX_STEPS = 8;
+static constexpr double RTVS_KILL_MAX_TOTAL_TIMEOUT_MS = 120000;
 
 void logf_waitpid(uint err, pid_t pid, int ws) {
 #if _APPLE
@@ -101,250 +96,320 @@ logf(log_verbosity::minimal, "Error [fork]: %s\n", explain_errno_fork(err));
 #endif
 }
 
-template<class Arg, class... Args>
-inline void write_json(Arg&& arg, Args&&... args) {
-    picojson::array msg;
-    msg.push_back(picojson::value(std::forward<Arg>(arg)));
-    append_json(msg, std::forward<Args>(args)...);
-    write_string(stdout, picojson::value(msg).serialize());
-}
-
-int rtvs_conv(int num_msg, const pam_message **msgm, pam_response **response, void *appdata_ptr) {
-    if (num_msg < 0) {
-        return PAM_CONV_ERR;
-    }
-
-    pam_response *reply = (pam_response*) calloc(num_msg, sizeof(pam_response));
-    if (reply == nullptr) {
-        return PAM_CONV_ERR;
-    }
-
-    for (int count = 0; count < num_msg; ++count) {
-        char *str = nullptr;
-        switch (msgm[count]->msg_style) {
-        case PAM_PROMPT_ECHO_OFF:
-            str = strdup((char*)appdata_ptr);
-            break;
-        case PAM_PROMPT_ECHO_ON:
-            str = strdup((char*)appdata_ptr);
-            break;
-        case PAM_ERROR_MSG:
-            write_json(RTVS_RESPONSE_TYPE_PAM_ERROR, msgm[count]->msg);
-            break;
-        case PAM_TEXT_INFO:
-            write_json(RTVS_RESPONSE_TYPE_PAM_INFO, msgm[count]->msg);
-            break;
+// Writes responses to a pipe, normally stdout. With coalesce set, frames are only sent
+// on flush(), so that the responses to requests that were already waiting go out together.
+class stream_channel : public rau::response_channel {
+public:
+    stream_channel(int fd, bool coalesce)
+        : _writer(fd), _coalesce(coalesce) {}
+
+    void write_frame(const std::string& frame) override {
+        _writer.write(frame);
+        if (!_coalesce) {
+            flush();
         }
+    }
 
-        if (str) {
-            reply[count].resp_retcode = 0;
-            reply[count].resp = str;
-            str = nullptr;
+    void flush() {
+        if (!_writer.flush()) {
+            // Nobody is left to report anything to.
+            std::terminate();
         }
     }
 
-    *response = reply;
-    reply = nullptr;
-
-    return PAM_SUCCESS;
+private:
+    rau::framing::frame_writer _writer;
+    bool _coalesce;
+};
+
+// Reads the next request into message, and logs why if there is none.
+rau::framing::frame_reader::status read_request(rau::framing::frame_reader& reader, std::string& message) {
+    boost::string_ref frame;
+    auto status = reader.read(frame);
+    switch (status) {
+    case rau::framing::frame_reader::status::ok:
+        message.assign(frame.data(), frame.size());
+        break;
+    case rau::framing::frame_reader::status::too_large:
+        logf(log_verbosity::minimal, "Error: Request exceeds the maximum frame size.\n");
+        break;
+    case rau::framing::frame_reader::status::error:
+        logf(log_verbosity::minimal, "Error [read]: %s\n", strerror(errno));
+        break;
+    case rau::framing::frame_reader::status::eof:
+        break;
+    }
+    return status;
 }
 
-int rtvs_conv_quiet(int num_msg, const pam_message **msgm, pam_response **response, void *appdata_ptr) {
-    if (num_msg < 0) {
-        return PAM_CONV_ERR;
+// How the socket server runs AuthAndRun: Microsoft.R.Host gets the standard handles that
+// the client passed along with the request, and the supervisor waits for it instead of the
+// worker. Its exit is reported on the client's connection as an rtvs-exit response.
+struct supervised_launch {
+    rau::host_supervisor* supervisor;
+    // stdin, stdout and stderr
+    const std::vector<int>* stdio_fds;
+};
+
+// Logs a launch's command line and environment, which is only done on request: the
+// environment can be large, and may hold values that shouldn't end up in the log.
+void log_rhost_command(const rau::spawn::command_block& command) {
+    for (char* const* arg = command.argv(); *arg; ++arg) {
+        logf(log_verbosity::minimal, "Args: %s\n", *arg);
+    }
+    for (char* const* var = command.envp(); *var; ++var) {
+        logf(log_verbosity::minimal, "Env: %s\n", *var);
     }
+}
 
-    pam_response *reply = (pam_response*)calloc(num_msg, sizeof(pam_response));
-    if (reply == nullptr) {
-        return PAM_CONV_ERR;
+// Converts the optional "cgroup" object of an AuthAndRun request, such as
+// { "scope": "user", "cpuWeight": 100, "memoryHigh": 8589934592, "memoryMax": 10737418240 }.
+// Without it, limits is left null.
+bool parse_cgroup_limits(const rau::request::request& req, std::unique_ptr<rau::cgroup::limits>& limits) {
+    if (!req.has(rau::request::field::cgroup)) {
+        return true;
     }
 
-    for (int count = 0; count < num_msg; ++count) {
-        char *str = nullptr;
-        switch (msgm[count]->msg_style) {
-        case PAM_PROMPT_ECHO_OFF:
-            str = strdup((char*)appdata_ptr);
-            break;
-        case PAM_PROMPT_ECHO_ON:
-            str = strdup((char*)appdata_ptr);
-            break;
-        case PAM_ERROR_MSG:
-        case PAM_TEXT_INFO:
-            break;
-        }
+    const rau::request::cgroup_spec& spec = req.cgroup;
+    std::unique_ptr<rau::cgroup::limits> result(new rau::cgroup::limits());
+    if (spec.scope == "user") {
+        result->scope = rau::cgroup::scope::user;
+    } else if (spec.scope.empty() || spec.scope == "session") {
+        result->scope = rau::cgroup::scope::session;
+    } else {
+        return false;
+    }
 
-        if (str) {
-            reply[count].resp_retcode = 0;
-            reply[count].resp = str;
-            str = nullptr;
+    for (double weight : { spec.cpu_weight, spec.io_weight }) {
+        if (weight != 0 && (weight < 1 || weight > RTVS_CGROUP_MAX_WEIGHT)) {
+            return false;
         }
     }
+    if (spec.memory_high < 0 || spec.memory_max < 0) {
+        return false;
+    }
 
-    *response = reply;
-    reply = nullptr;
-
-    return PAM_SUCCESS;
+    result->cpu_weight = (uint64_t)spec.cpu_weight;
+    result->io_weight = (uint64_t)spec.io_weight;
+    result->memory_high = (uint64_t)spec.memory_high;
+    result->memory_max = (uint64_t)spec.memory_max;
+    limits = std::move(result);
+    return true;
 }
 
-std::string get_user_home(const std::string &username) {
-    struct passwd *pw = getpwnam(username.c_str());
-    if (pw && pw->pw_dir && pw->pw_dir[0] != '\0') {
-        return std::string(strdup(pw->pw_dir));
+// Converts the optional "placement" object of an AuthAndRun request, such as
+// { "policy": "least-loaded", "memoryPolicy": "bind" } or { "numaNode": 1 } or
+// { "cpus": "0-3" }. Without it, the helper's default policy applies.
+bool parse_placement(const rau::request::request& req, rau::placement::request& out) {
+    out = rau::placement::request();
+    if (!req.has(rau::request::field::placement)) {
+        return true;
     }
-    return std::string();
-}
 
-template<typename T>
-T calloc_or_exit(size_t count, size_t size) {
-    T v = (T)calloc(count, size);
-    if (!v) {
-        logf(log_verbosity::minimal, "Error [calloc]: Failed ot allocate %ld\n", (count * size));
-        _exit(EXIT_FAILURE);
+    const rau::request::placement_spec& spec = req.placement;
+    if (!spec.policy.empty() && !rau::placement::parse_policy(spec.policy.to_string(), out.policy)) {
+        return false;
     }
+    if (spec.node != -1) {
+        if (spec.node < 0 || spec.node != std::floor(spec.node)) {
+            return false;
+        }
+        out.node = (int)spec.node;
+    }
+    out.cpus = spec.cpus.to_string();
+    if (spec.memory_policy == "bind") {
+        out.bind_memory = true;
+    } else if (!spec.memory_policy.empty() && spec.memory_policy != "preferred") {
+        return false;
+    }
+    return true;
 }
 
-void start_rhost(const picojson::object& json) {
-    logf(log_verbosity::traffic, "Gathering Microsoft.R.Host arguments.\n");
-    // construct arguments
-    picojson::array json_args(json.at(RTVS_JSON_MSG_ARGS).get<picojson::array>());
-
-    // <binary path> <arg 1> <arg 2> ... <explicit null>
-    int argc = json_args.size() + 2;
-    char **argv = calloc_or_exit<char**>(argc, sizeof *argv);
-
-    // first item in the args must always be path to the binary
-    std::string pathname(RTVS_RHOST_PATH);
-    logf(log_verbosity::minimal, "Path: %s\n", pathname.c_str());
-    argv[0] = strdup(pathname.c_str());
-
-    for (int i = 1; i < (argc - 1); ++i) {
-        std::string item(json_args[i - 1].get<std::string>());
-        logf(log_verbosity::minimal, "Args: %s\n", item.c_str());
-        argv[i] = strdup(item.c_str());
+// Describes where a host was placed, for the rtvs-placement response.
+picojson::object describe_placement(const rau::placement::choice& where) {
+    picojson::object result;
+    if (where.node >= 0) {
+        result["numaNode"] = picojson::value((double)where.node);
+        result["memoryPolicy"] = picojson::value(where.bind_memory ? "bind" : "preferred");
+    }
+    if (!where.cpu_list.empty()) {
+        result["cpus"] = picojson::value(where.cpu_list);
     }
+    return result;
+}
 
-    // explicit null for the end of arguments
-    argv[argc - 1] = NULL;
+// Starts Microsoft.R.Host as user. With stdio_fds null it inherits the helper's own
+// standard handles. With limits set, it runs in the cgroup placement describes, which has
+// to be released once it has exited. where gives its CPUs and NUMA node.
+int start_rhost(const rau::request::request& req, const rau::nss::user_entry& user, const int* stdio_fds, const rau::cgroup::limits* limits,
+                const rau::placement::choice& where, rau::timing::phase_times& times, rau::cgroup::placement& placement, pid_t& pid) {
+    int err = 0;
+    std::string cwd(req.working_directory.data(), req.working_directory.size());
 
-    logf(log_verbosity::traffic, "Building Microsoft.R.Host environment.\n");
-    // construct environment
-    picojson::array json_env = json.at(RTVS_JSON_MSG_ENV).get<picojson::array>();
+    // What initgroups would set, resolved here because the spawned child can't do NSS lookups.
+    std::vector<gid_t> groups;
+    if (!times.measure(phase::getgrouplist, [&] { return rau::nss::get_group_list(user.name, user.gid, groups); })) {
+        err = errno;
+        logf(log_verbosity::minimal, "Error [getgrouplist]:[%d] %s\n", err, strerror(err));
+        return err;
+    }
 
-    // <key1=value1> <key2=value2> ... <explicit null>
-    int envc = json_env.size() + 1;
-    char **envp = calloc_or_exit<char**>(envc, sizeof *envp);
+    rau::spawn::command_block command;
+    if (!command.assign(RTVS_RHOST_PATH, req.arguments, req.environment)) {
+        err = errno;
+        logf(log_verbosity::minimal, "Error [malloc]: %s\n", strerror(err));
+        return err;
+    }
+    if (log_host_command) {
+        log_rhost_command(command);
+    }
 
-    for (int i = 0; i < (envc - 1); ++i) {
-        std::string env(json_env[i].get<std::string>());
-        logf(log_verbosity::minimal, "Env: %s", env.c_str());
-        envp[i] = strdup(env.c_str());
+    if (limits && !rau::cgroup::enabled()) {
+        static std::atomic<bool> warned{ false };
+        if (!warned.exchange(true)) {
+            logf(log_verbosity::minimal, "Error: Requests ask for cgroup limits, but no cgroup root was set with -g; ignoring them.\n");
+        }
+    } else if (limits && !times.measure(phase::cgroup, [&] { return rau::cgroup::prepare(user.uid, *limits, placement); })) {
+        err = errno;
+        logf(log_verbosity::minimal, "Error [cgroup]: %s\n", strerror(err));
+        return err;
     }
+    SCOPE_WARDEN(_close_procs, {
+        rau::cgroup::close_procs(placement);
+    });
 
-    // explicit null for the end of enironment
-    envp[envc - 1] = NULL;
+    rau::spawn::launch_options options;
+    options.path = RTVS_RHOST_PATH;
+    options.argv = command.argv();
+    options.envp = command.envp();
+    options.cwd = cwd.c_str();
+    options.uid = user.uid;
+    options.gid = user.gid;
+    options.groups = &groups;
+    options.stdio_fds = stdio_fds;
+    options.cgroup_procs_fd = placement.procs_fd;
+#ifndef _APPLE
+    if (!where.cpu_list.empty()) {
+        options.cpus = &where.cpus;
+    }
+#endif
+    options.memory_node = where.node;
+    options.memory_bind = where.bind_memory;
+    if (where.node >= 0 || !where.cpu_list.empty()) {
+        logf(log_verbosity::traffic, "Placing Microsoft.R.Host on node %d, CPUs %s\n", where.node, where.cpu_list.empty() ? "(any)" : where.cpu_list.c_str());
+    }
 
     logf(log_verbosity::traffic, "Starting Microsoft.R.Host Process\n");
-    execve(RTVS_RHOST_PATH, argv, envp);
-    int err = errno;
+    const char* failed_step;
+    pid = times.measure(phase::spawn, [&] { return rau::spawn::spawn_process(options, &failed_step); });
+    if (pid == -1) {
+        err = errno;
+        if (!failed_step || strcmp(failed_step, "fork") == 0) {
+            logf_fork(err);
+        } else if (strcmp(failed_step, "execve") == 0) {
 #ifdef _APPLE
-    logf(log_verbosity::minimal, "Error [execve]: %d\n", err);
+            logf(log_verbosity::minimal, "Error [execve]: %d\n", err);
 #else
-    logf(log_verbosity::minimal, "Error [execve]: %s\n", explain_errno_execve(err, RTVS_RHOST_PATH, argv, envp));
+            logf(log_verbosity::minimal, "Error [execve]: %s\n", explain_errno_execve(err, RTVS_RHOST_PATH, command.argv(), command.envp()));
 #endif
-    _exit(err);
-}
-
-template <typename TInt>
-static inline bool check_interrupted(TInt result) {
-    return result < 0 && errno == EINTR;
-}
+        } else {
+            logf(log_verbosity::minimal, "Error [%s]: %s\n", failed_step, strerror(err));
+        }
+        rau::cgroup::release(placement);
+        return err;
+    }
 
-int change_cwd(const char* cwd) {
-    int result;
-    while (check_interrupted(result = chdir(cwd)));
-    return result;
+    logf(log_verbosity::traffic, "Started Microsoft.R.Host pid %d\n", pid);
+    rau::metrics::host_launched();
+    return err;
 }
 
-int run_rhost(const picojson::object& json, const char* user, const gid_t gid, const uid_t uid) {
+// Logs how Microsoft.R.Host ended, and returns the helper's exit code for it.
+int log_rhost_exit(int ws) {
     int err = 0;
-    std::string cwd(json.at(RTVS_JSON_MSG_CWD).get<std::string>());
-
-    int pid = fork();
-    if (pid == -1) {
-        err = errno;
-        logf_fork(err);
-        return err;
-    } else if (pid == 0) {
-        logf(log_verbosity::traffic, "Child process initialization.\n");
-
-        if (!cwd.empty() && change_cwd(cwd.c_str()) == -1) {
-            err = errno != 0 ? errno : EXIT_FAILURE;
-            logf(log_verbosity::minimal, "Error [chdir]: %s\n", strerror(err));
-            _exit(err);
+    if (WIFEXITED(ws)) {
+        err = WEXITSTATUS(ws);
+        if (err) {
+            logf(log_verbosity::minimal, "Error Microsoft.R.Host exited:[%d] %s\n", err, strerror(err));
+        } else {
+            logf(log_verbosity::minimal, "Microsoft.R.Host exited normally.\n");
         }
+    } else if (WIFSIGNALED(ws)) {
+        logf(log_verbosity::minimal, "Error Microsoft.R.Host terminated by a signal: %d\n", WTERMSIG(ws));
+        err = ws;
+    }
 
-        if (initgroups(user, gid) == -1) {
-            err = errno;
-            logf(log_verbosity::minimal, "Error [initgroups]: %s\n", strerror(err));
-            _exit(err);
-        }
-        if (setgid(gid) == -1) {
-            err = errno;
-            logf(log_verbosity::minimal, "Error [setgid]: %s\n", strerror(err));
-            _exit(err);
-        }
-        if (setuid(uid) == -1) {
-            err = errno;
-            logf(log_verbosity::minimal, "Error [setuid]: %s\n", strerror(err));
-            _exit(err);
-        }
+    return err;
+}
 
-        start_rhost(json);
-    } else {
-        logf(log_verbosity::traffic, "Parent waiting for child pid: %d\n", pid);
-        int ws = 0;
-        pid_t hpid = waitpid(pid, &ws, 0);
-        if (hpid < 0) {
-            err = errno;
-            logf_waitpid(err, pid, ws);
-        }
-
-        if (WIFEXITED(ws)) {
-            err = WEXITSTATUS(ws);
-            if (err) {
-                logf(log_verbosity::minimal, "Error Microsoft.R.Host exited:[%d] %s\n", err, strerror(err));
-            } else {
-                logf(log_verbosity::minimal, "Microsoft.R.Host exited normally.\n");
-            }
-        } else if (WIFSIGNALED(ws)) {
-            logf(log_verbosity::minimal, "Error Microsoft.R.Host terminated by a signal: %d\n", WTERMSIG(ws));
-            err = ws;
-        }
+int wait_rhost(pid_t pid) {
+    logf(log_verbosity::traffic, "Parent waiting for child pid: %d\n", pid);
+    int ws = 0;
+    pid_t hpid = waitpid(pid, &ws, 0);
+    if (hpid < 0) {
+        int err = errno;
+        logf_waitpid(err, pid, ws);
+        return err;
     }
 
-    return err;
+    rau::metrics::host_exited();
+    return log_rhost_exit(ws);
 }
 
-int authenticate_and_run(const picojson::object& json) {
-    std::string msg_name(json.at(RTVS_JSON_MSG_NAME).get<std::string>());
-    bool auth_only = msg_name == RTVS_MSG_AUTH_ONLY;
+// What is known about a request beyond the message itself.
+struct request_context {
+    rau::timing::phase_times times;
+    // Set once PAM has accepted the user. Until then a failure is a PAM error code rather
+    // than an errno value, and the two overlap.
+    bool authenticated;
 
-    std::string username(json.at(RTVS_JSON_MSG_USERNAME).get<std::string>());
-    std::string password(json.at(RTVS_JSON_MSG_PASSWORD).get<std::string>());
+    void clear() {
+        times.clear();
+        authenticated = false;
+    }
+};
+
+int authenticate_and_run(const rau::request::request& req, request_context& context, rau::response_channel& channel, const supervised_launch* launch) {
+    bool auth_only = req.type == rau::request::message_type::auth_only;
+    // A host started by the one-shot helper owns its stdout, so only AuthOnly and supervised
+    // launches can report anything.
+    bool reply = auth_only || launch;
+
+    std::string username(req.username.data(), req.username.size());
+    std::string password(req.password.data(), req.password.size());
 
     if (username.empty() || password.empty()) {
         logf(log_verbosity::minimal, "Error: Username or password missing. %s\n");
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_RTVS_ERROR, (double)RTVS_AUTH_NO_INPUT);
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, (double)RTVS_AUTH_NO_INPUT);
         }
         return RTVS_AUTH_NO_INPUT;
     }
 
+    std::unique_ptr<rau::cgroup::limits> limits;
+    if (!auth_only && !parse_cgroup_limits(req, limits)) {
+        logf(log_verbosity::minimal, "Error: Invalid cgroup limits.\n");
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_InputFormatInvalid");
+        }
+        return RTVS_AUTH_BAD_INPUT;
+    }
+
+    rau::placement::request placement_request;
+    if (!auth_only && !parse_placement(req, placement_request)) {
+        logf(log_verbosity::minimal, "Error: Invalid placement.\n");
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_InputFormatInvalid");
+        }
+        return RTVS_AUTH_BAD_INPUT;
+    }
+
     pam_handle_t *pamh = nullptr;
     int err = 0;
+    conv_data conv_appdata = { password.c_str(), &channel };
     struct pam_conv conv = {
-        (auth_only ? rtvs_conv : rtvs_conv_quiet),
-        (void*)password.c_str()
+        (reply ? rtvs_conv : rtvs_conv_quiet),
+        &conv_appdata
     };
 
     bool pam_session_opened = false;
@@ -358,12 +423,13 @@ int authenticate_and_run(const picojson::object& json) {
     });
 
     logf(log_verbosity::traffic, "Starting PAM authentication session\n");
+    rau::pam_stack::refresh();
 
-    if ((err = pam_start("rtvs", username.c_str(), &conv, &pamh)) != PAM_SUCCESS || pamh == nullptr) {
+    if ((err = context.times.measure(phase::pam_start, [&] { return pam_start(RTVS_PAM_SERVICE, username.c_str(), &conv, &pamh); })) != PAM_SUCCESS || pamh == nullptr) {
         std::string pam_err(pam_strerror(pamh, err));
         logf(log_verbosity::minimal, "PAM Error [pam_start]: %s\n", pam_err.c_str());
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
         }
         return err;
     }
@@ -372,8 +438,8 @@ int authenticate_and_run(const picojson::object& json) {
     if ((err = gethostname(pam_rhost, sizeof(pam_rhost))) != 0) {
         std::string sys_err(strerror(err));
         logf(log_verbosity::minimal, "Error [gethostname]: %s\n", sys_err.c_str());
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_SYSTEM_ERROR, sys_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_SYSTEM_ERROR, sys_err.c_str());
         }
         return err;
     }
@@ -381,8 +447,8 @@ int authenticate_and_run(const picojson::object& json) {
     if ((err = pam_set_item(pamh, PAM_RHOST, pam_rhost)) != PAM_SUCCESS) {
         std::string pam_err(pam_strerror(pamh, err));
         logf(log_verbosity::minimal, "PAM Error [pam_set_item(PAM_RHOST)]: %s\n", pam_err.c_str());
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
         }
         return err;
     }
@@ -390,45 +456,56 @@ int authenticate_and_run(const picojson::object& json) {
     if ((err = pam_set_item(pamh, PAM_RUSER, "root")) != PAM_SUCCESS) {
         std::string pam_err(pam_strerror(pamh, err));
         logf(log_verbosity::minimal, "PAM Error [pam_set_item(PAM_RUSER)]: %s\n", pam_err.c_str());
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
         }
         return err;
     }
 
-    if ((err = pam_authenticate(pamh, 0)) != PAM_SUCCESS) {
+#ifdef PAM_FAIL_DELAY
+    if ((err = pam_set_item(pamh, PAM_FAIL_DELAY, (const void*)rtvs_fail_delay)) != PAM_SUCCESS) {
+        std::string pam_err(pam_strerror(pamh, err));
+        logf(log_verbosity::minimal, "PAM Error [pam_set_item(PAM_FAIL_DELAY)]: %s\n", pam_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
+        }
+        return err;
+    }
+#endif
+
+    if ((err = context.times.measure(phase::pam_authenticate, [&] { return pam_authenticate(pamh, 0); })) != PAM_SUCCESS) {
         std::string pam_err(pam_strerror(pamh, err));
         logf(log_verbosity::minimal, "PAM Error [pam_authenticate]: %s\n", pam_err.c_str());
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
         }
         return err;
     }
 
-    if ((err = pam_acct_mgmt(pamh, 0)) != PAM_SUCCESS) {
+    if ((err = context.times.measure(phase::pam_acct_mgmt, [&] { return pam_acct_mgmt(pamh, 0); })) != PAM_SUCCESS) {
         std::string pam_err(pam_strerror(pamh, err));
         logf(log_verbosity::minimal, "PAM Error [pam_acct_mgmt]: %s\n", pam_err.c_str());
         // This can fail if the user's password has expired
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
         }
         return err;
     }
 
-    if ((err = pam_setcred(pamh, PAM_ESTABLISH_CRED)) != PAM_SUCCESS) {
+    if ((err = context.times.measure(phase::pam_setcred, [&] { return pam_setcred(pamh, PAM_ESTABLISH_CRED); })) != PAM_SUCCESS) {
         std::string pam_err(pam_strerror(pamh, err));
         logf(log_verbosity::minimal, "PAM Error [pam_setcred]: %s\n", pam_err.c_str());
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
         }
         return err;
     }
 
-    if ((err = pam_open_session(pamh, 0)) != PAM_SUCCESS) {
+    if ((err = context.times.measure(phase::pam_open_session, [&] { return pam_open_session(pamh, 0); })) != PAM_SUCCESS) {
         std::string pam_err(pam_strerror(pamh, err));
         logf(log_verbosity::minimal, "PAM Error [pam_open_session]: %s\n", pam_err.c_str());
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
         }
         return err;
     }
@@ -438,167 +515,789 @@ int authenticate_and_run(const picojson::object& json) {
     if ((err = pam_get_item(pamh, PAM_USER, (const void **)&pam_user)) != PAM_SUCCESS) {
         std::string pam_err(pam_strerror(pamh, err));
         logf(log_verbosity::minimal, "PAM Error [pam_get_item(PAM_USER)]: %s\n", pam_err.c_str());
-        if (auth_only) {
-            write_json(RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_PAM_ERROR, pam_err.c_str());
         }
         return err;
     }
 
     logf(log_verbosity::minimal, "PAM authentication succeeded for %s\n", pam_user);
+    context.authenticated = true;
 
-    // Have to set errno to 0 as per man pages for getpwnam
-    errno = 0;
-    struct passwd *pw = getpwnam(pam_user);
-    if (!pw) {
+    rau::nss::user_entry user;
+    if (!context.times.measure(phase::getpwnam, [&] { return rau::nss::find_user(pam_user, user); })) {
         err = errno;
         logf(log_verbosity::minimal, "Error [getpwnam]: %s\n", strerror(err));
         return err;
     }
 
-    char *user_name = strdup(pw->pw_name);
-    gid_t user_gid = pw->pw_gid;
-    uid_t user_id = pw->pw_uid;
-
     if (auth_only) {
-        std::string allowed_group(json.at(RTVS_JSON_MSG_GRP).get<std::string>());
+        std::string allowed_group(req.allowed_group.data(), req.allowed_group.size());
         if (!allowed_group.empty()) {
-            struct group *gp = getgrnam(allowed_group.c_str());
-            if (!gp) {
-                err = errno;
-                logf(log_verbosity::minimal, "Error [getgrnam]:[%d] %s\n", err, strerror(err));
-                return err;
-            }
-
-            gid_t allowed_gid = gp->gr_gid;
+            auto policy = rau::policy::get_policy(allowed_group);
 
-#ifdef _APPLE
-            std::vector<gid_t> user_groups(NGROUPS_MAX);
-#else
-            int ngroups = 1000;
-            std::vector<gid_t> user_groups(ngroups);
-            if (getgrouplist(user_name, user_gid, user_groups.data(), &ngroups) == -1) {
+            std::vector<gid_t> user_groups;
+            if (policy->needs_groups() && !context.times.measure(phase::getgrouplist, [&] { return rau::nss::get_group_list(user.name, user.gid, user_groups); })) {
                 err = errno;
                 logf(log_verbosity::minimal, "Error [getgrouplist]:[%d] %s\n", err, strerror(err));
                 return err;
             }
-            user_groups.resize(ngroups);
-#endif
 
-             bool user_allowed = (std::find(user_groups.begin(), user_groups.end(), allowed_gid)) != user_groups.end();
-            if (!user_allowed) {
-                logf(log_verbosity::minimal, "Error: User [%s] is not in the allowed group [%s]\n", user_name, allowed_group.c_str());
+            if (!policy->allows(user, user_groups)) {
+                logf(log_verbosity::minimal, "Error: User [%s] is not allowed by the access policy [%s]\n", user.name.c_str(), allowed_group.c_str());
                 return EACCES;
             }
         }
 
-        std::string user_home = get_user_home(pam_user);
-        write_json(RTVS_RESPONSE_TYPE_RTVS_RESULT, user_home);
+        write_json(channel, RTVS_RESPONSE_TYPE_RTVS_RESULT, user.home);
         return err;
     }
 
     // we get here only for Authenticate and Run case
-    err = run_rhost(json, user_name, user_gid, user_id);
-    return err;
-}
 
-int kill_process(int kill_pid) {
-    int err = 0;
-    char** args = calloc_or_exit<char**>(4, sizeof(char*));
-    std::string arg1("-9"); // SIGKILL
-    char carg2[100] = {}; // pid
-    sprintf(carg2, "%d", kill_pid);
-    std::string arg2(carg2); // SIGKILL
-
-    std::string kill_path(RTVS_KILL_PATH);
-    args[0] = strdup(kill_path.c_str());
-    args[1] = strdup(arg1.c_str());
-    args[2] = strdup(arg2.c_str());
-    args[3] = NULL;
-
-    int pid = fork();
-    if (pid == -1) {
-        err = errno;
-        logf_fork(err);
+    // Another host would only slow down those already running while the machine is stalled
+    // on memory, CPU or I/O, so wait for it to recover a little, or give up.
+    std::string pressure;
+    if (!context.times.measure(phase::admission, [&] { return rau::admission::admit(pressure); })) {
+        logf(log_verbosity::minimal, "Error: Not starting Microsoft.R.Host, the machine is overloaded: %s\n", pressure.c_str());
+        // No host has been given a one-shot helper's stdout yet, so the broker learns why
+        // too, and can tell the user.
+        write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_HostOverloaded", pressure.c_str());
+        return RTVS_AUTH_PRESSURE;
+    }
+
+    // Chosen only now, so that least-loaded sees the load at launch time.
+    rau::placement::choice where;
+    if (!rau::placement::choose(placement_request, where)) {
+        logf(log_verbosity::minimal, "Error: No NUMA node or CPUs as requested on this machine.\n");
+        if (reply) {
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_InputFormatInvalid");
+        }
+        return RTVS_AUTH_BAD_INPUT;
+    }
+
+    rau::cgroup::placement placement;
+    if (!launch) {
+        // The host inherits stdout, so a one-shot helper has no way to send rtvs-placement;
+        // where the host runs is only in the log, from start_rhost.
+        pid_t pid;
+        if ((err = start_rhost(req, user, nullptr, limits.get(), where, context.times, placement, pid)) != 0) {
+            return err;
+        }
+        err = wait_rhost(pid);
+        rau::cgroup::release(placement);
         return err;
-    } 
-    
-    if (pid == 0) {
-        execv(RTVS_KILL_PATH, args);
-        int err = errno;
-    #if _APPLE
-        logf(log_verbosity::minimal, "Error [execv]: %u\n", err);
-    #else
-        logf(log_verbosity::minimal, "Error [execv]: %s\n", explain_errno_execv(err, RTVS_KILL_PATH, args));
-    #endif
-        _exit(err);
-    } else {
-        logf(log_verbosity::traffic, "Parent waiting for child pid: %d\n", pid);
-        int ws = 0;
-        pid_t hpid = waitpid(pid, &ws, 0);
-        if (hpid < 0) {
-            err = errno;
-            logf_waitpid(err, pid, ws);
-        }
-
-        if (WIFEXITED(ws)) {
-            err = WEXITSTATUS(ws);
-            if (err) {
-                logf(log_verbosity::minimal, "Error kill exited:[%d] %s\n", err, strerror(err));
-            } else {
-                logf(log_verbosity::minimal, "kill exited normally.\n");
+    }
+
+    pid_t pid;
+    if ((err = start_rhost(req, user, launch->stdio_fds->data(), limits.get(), where, context.times, placement, pid)) != 0) {
+        write_json(channel, RTVS_RESPONSE_TYPE_SYSTEM_ERROR, strerror(err));
+        return err;
+    }
+
+    // The PAM session now lives as long as the host. Its conversation must not point at this
+    // request's password and channel any more.
+    auto session_conv = std::make_shared<conv_data>(conv_data{ "", nullptr });
+    struct pam_conv session_pam_conv = { rtvs_conv_quiet, session_conv.get() };
+    pam_set_item(pamh, PAM_CONV, &session_pam_conv);
+
+    pam_handle_t* session = pamh;
+    std::shared_ptr<rau::response_channel> events = channel.share();
+    bool watched = launch->supervisor->watch(pid, [session, session_conv, events, placement](pid_t pid, int status) {
+        logf(log_verbosity::traffic, "Microsoft.R.Host pid %d ended, closing its PAM session.\n", pid);
+        log_rhost_exit(status);
+        rau::metrics::host_exited();
+        rau::cgroup::release(placement);
+
+        int err = pam_close_session(session, 0);
+        ::pam_end(session, err);
+
+        if (events) {
+            picojson::object exit_info;
+            exit_info[RTVS_JSON_MSG_PID] = picojson::value((double)pid);
+            if (WIFEXITED(status)) {
+                exit_info[RTVS_JSON_MSG_EXIT_CODE] = picojson::value((double)WEXITSTATUS(status));
+            } else if (WIFSIGNALED(status)) {
+                exit_info[RTVS_JSON_MSG_SIGNAL] = picojson::value((double)WTERMSIG(status));
             }
-        } else if (WIFSIGNALED(ws)) {
-            logf(log_verbosity::minimal, "Error kill terminated by a signal: %d\n", WTERMSIG(ws));
-            err = ws;
+            write_json(*events, RTVS_RESPONSE_TYPE_RTVS_EXIT, exit_info);
         }
+    });
+
+    if (!watched) {
+        // Nobody would ever reap the host or close its session, so don't leave it running.
+        err = errno;
+        logf(log_verbosity::minimal, "Error [pidfd_open]: %s\n", strerror(err));
+        kill(pid, SIGKILL);
+        wait_rhost(pid);
+        rau::cgroup::release(placement);
+        write_json(channel, RTVS_RESPONSE_TYPE_SYSTEM_ERROR, strerror(err));
+        return err;
     }
 
+    pamh = nullptr;
+    logf(log_verbosity::normal, "Supervising Microsoft.R.Host pid %d\n", pid);
+    if (where.node >= 0 || !where.cpu_list.empty()) {
+        write_json(channel, RTVS_RESPONSE_TYPE_RTVS_PLACEMENT, describe_placement(where));
+    }
+    write_json(channel, RTVS_RESPONSE_TYPE_RTVS_RESULT, (double)pid);
     return err;
 }
-int main(int argc, char **argv) {
-    bool quiet = getopt(argc, argv, "q") == 'q';
-#if NDEBUG
-    log_verbosity logVerb = log_verbosity::traffic;
-#else
-    log_verbosity logVerb = log_verbosity::normal;
-#endif
 
-    SCOPE_WARDEN(_main_exit, {
-        flush_log();
-    });
-    init_log("", fs::temp_directory_path(), logVerb);
+// Converts the optional "signals" sequence of a KillProcess request. Each step is an object
+// such as { "signal": "SIGTERM", "timeout": 5000 }, with the timeout in milliseconds.
+bool parse_kill_sequence(const rau::request::request& req, std::vector<rau::process::kill_step>& steps) {
+    if (!req.has(rau::request::field::signals)) {
+        steps = rau::process::default_kill_sequence();
+        return true;
+    }
+
+    if (req.signals.empty() || req.signals.size() > RTVS_KILL_MAX_STEPS) {
+        return false;
+    }
+
+    double total_timeout = 0;
+    for (const rau::request::kill_step_spec& step : req.signals) {
+        int signum = 0;
+        if (!step.signal_name.empty()) {
+            signum = rau::process::signal_from_name(std::string(step.signal_name.data(), step.signal_name.size()));
+        } else {
+            signum = (int)step.signal_number;
+        }
+        if (signum <= 0 || signum >= NSIG) {
+            return false;
+        }
+
+        if (step.timeout < 0 || step.timeout > RTVS_KILL_MAX_STEP_TIMEOUT_MS) {
+            return false;
+        }
+        total_timeout += step.timeout;
+        if (total_timeout > RTVS_KILL_MAX_TOTAL_TIMEOUT_MS) {
+            return false;
+        }
+
+        steps.push_back({ signum, std::chrono::milliseconds((long long)step.timeout) });
+    }
+
+    return true;
+}
+
+int kill_process(const rau::request::request& req, rau::timing::phase_times& times, rau::response_channel& channel, bool quiet) {
+    int kill_pid = (int)req.process_id;
+
+    std::vector<rau::process::kill_step> steps;
+    if (!parse_kill_sequence(req, steps)) {
+        if (!quiet) {
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_InputFormatInvalid");
+        }
+        return RTVS_AUTH_BAD_INPUT;
+    }
+
+    rau::process::kill_outcome outcome;
+    int err = times.measure(phase::terminate, [&] { return rau::process::terminate_process(kill_pid, steps, outcome); });
+    if (outcome.step >= 0) {
+        int signum = steps[outcome.step].signal;
+        logf(log_verbosity::minimal, "Process %d %s after step %d (signal %d).\n", kill_pid,
+            outcome.exited ? "exited" : "was signaled", outcome.step, signum);
 
-    picojson::value json_value;
-    std::string json_err = picojson::parse(json_value, read_string(stdin));
+        if (!quiet) {
+            picojson::object result;
+            result["step"] = picojson::value((double)outcome.step);
+            result["signal"] = picojson::value(std::string(rau::process::signal_name(signum)));
+            result["exited"] = picojson::value(outcome.exited);
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_RESULT, result);
+        }
+    }
 
-    if (!json_err.empty()) {
+    if (err) {
+        logf(log_verbosity::minimal, "Error [kill]:[%d] %s\n", err, strerror(err));
+    }
+
+    return err;
+}
+
+// Switches a long-lived helper's channel to another encoding, starting with the request
+// after this one.
+int set_encoding(const rau::request::request& req, rau::response_channel& channel, bool quiet) {
+    rau::codec::wire_encoding encoding;
+    if (!rau::codec::parse_encoding(std::string(req.encoding.data(), req.encoding.size()), encoding)) {
         if (!quiet) {
-            write_json(RTVS_RESPONSE_TYPE_JSON_ERROR, json_err);
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_InputFormatInvalid");
         }
         return RTVS_AUTH_BAD_INPUT;
     }
 
-    if (!json_value.is<picojson::object>()) {
+    // Requests overlapping this one would have their remaining responses switched midway,
+    // where the client can't tell which encoding they are in.
+    if (channel.others_in_flight()) {
+        logf(log_verbosity::normal, "Error: Can't switch encodings while other requests are running.\n");
         if (!quiet) {
-            write_json(RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_InputFormatInvalid");
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_RequestsInFlight");
+        }
+        return RTVS_AUTH_BUSY;
+    }
+
+    logf(log_verbosity::traffic, "Switching to %s encoding.\n", rau::codec::encoding_name(encoding));
+    channel.request_encoding(encoding);
+    write_json(channel, RTVS_RESPONSE_TYPE_RTVS_RESULT, rau::codec::encoding_name(encoding));
+    return RTVS_AUTH_OK;
+}
+
+// Reports the counters and latency percentiles collected since the helper started.
+int write_stats(rau::response_channel& channel, bool quiet) {
+    if (!quiet) {
+        write_json(channel, RTVS_RESPONSE_TYPE_RTVS_RESULT, rau::metrics::snapshot());
+    }
+    return RTVS_AUTH_OK;
+}
+
+// Keeps the responses to one entry of an AuthOnlyBatch instead of sending them, so that the
+// whole batch can be answered at once. PAM's failure delay is noted, and served by the
+// thread that authenticated the entry.
+class capture_channel : public rau::response_channel {
+public:
+    capture_channel()
+        : _delay(0) {}
+
+    void write_frame(const std::string& frame) override {
+        picojson::value response;
+        if (rau::codec::decode(frame, encoding(), response).empty()) {
+            _responses.push_back(response);
         }
+    }
+
+    void delay_responses(std::chrono::microseconds delay) override {
+        _delay = delay;
+    }
+
+    picojson::array& responses() {
+        return _responses;
+    }
+
+    std::chrono::microseconds delay() const {
+        return _delay;
+    }
+
+private:
+    picojson::array _responses;
+    std::chrono::microseconds _delay;
+};
+
+// Authenticates one entry of an AuthOnlyBatch as an AuthOnly request would, and describes
+// the outcome as { "result": <what rtvs-done would carry>, "home": <on success>,
+// "responses": [<pam-info, pam-error, ... responses>] }.
+picojson::value authenticate_entry(const rau::request::auth_entry& entry, capture_channel& channel) {
+    using namespace rau::request;
+
+    int result;
+    if (!entry.has(field::username | field::password | field::allowed_group)) {
+        result = RTVS_AUTH_BAD_INPUT;
+    } else {
+        request req;
+        req.clear();
+        req.type = message_type::auth_only;
+        req.present = field::name | entry.present;
+        req.username = entry.username;
+        req.password = entry.password;
+        req.allowed_group = entry.allowed_group;
+
+        request_context context;
+        context.clear();
+        try {
+            result = authenticate_and_run(req, context, channel, nullptr);
+            rau::timing::aggregate(context.times);
+        } catch (const std::exception& ex) {
+            logf(log_verbosity::minimal, "Error: Batch entry for %s failed: %s\n", req.username.to_string().c_str(), ex.what());
+            result = RTVS_AUTH_BAD_INPUT;
+        }
+    }
+
+    picojson::object outcome;
+    outcome["result"] = picojson::value((double)result);
+
+    // On success, AuthOnly's last response is an rtvs-result with the home directory.
+    picojson::array& responses = channel.responses();
+    if (result == RTVS_AUTH_OK && !responses.empty() && responses.back().is<picojson::array>()) {
+        const picojson::array& last = responses.back().get<picojson::array>();
+        if (last.size() == 2 && last[0].is<std::string>() && last[0].get<std::string>() == RTVS_RESPONSE_TYPE_RTVS_RESULT) {
+            outcome["home"] = last[1];
+            responses.pop_back();
+        }
+    }
+    outcome["responses"] = picojson::value(responses);
+    return picojson::value(outcome);
+}
+
+// Runs AuthOnly for every entry of an AuthOnlyBatch, batch_parallelism at a time, and answers
+// with a single rtvs-result holding one outcome per entry, in the order they were sent. A
+// thread serves PAM's failure delay for an entry before it takes the next one, so that a
+// batch costs as much time per failed password as separate requests would.
+int auth_only_batch(const rau::request::request& req, rau::response_channel& channel) {
+    size_t count = req.entries.size();
+    if (count > RTVS_MAX_BATCH_ENTRIES) {
+        logf(log_verbosity::minimal, "Error: AuthOnlyBatch with %zu entries, more than %zu.\n", count, RTVS_MAX_BATCH_ENTRIES);
+        write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_InputFormatInvalid");
         return RTVS_AUTH_BAD_INPUT;
     }
 
-    picojson::object json = json_value.get<picojson::object>();
-    std::string msg_name(json[RTVS_JSON_MSG_NAME].get<std::string>());
+    std::vector<capture_channel> captured(count);
+    picojson::array outcomes(count);
+    std::atomic<size_t> next_entry{ 0 };
+    uint64_t request_id = rau::log::get_request_id();
+
+    auto authenticate_entries = [&] {
+        rau::log::set_request_id(request_id);
+        for (size_t i; (i = next_entry++) < count;) {
+            outcomes[i] = authenticate_entry(req.entries[i], captured[i]);
+            if (captured[i].delay().count() > 0) {
+                std::this_thread::sleep_for(captured[i].delay());
+            }
+        }
+    };
+
+    // The calling thread takes entries too, so a batch of one starts no thread at all.
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < std::min(batch_parallelism, count); ++t) {
+        try {
+            threads.emplace_back(authenticate_entries);
+        } catch (const std::system_error& ex) {
+            logf(log_verbosity::normal, "Error: Can't start a batch thread: %s\n", ex.what());
+            break;
+        }
+    }
+    authenticate_entries();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    size_t authenticated = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (outcomes[i].get("result").get<double>() == RTVS_AUTH_OK) {
+            ++authenticated;
+        }
+    }
+    logf(log_verbosity::normal, "AuthOnlyBatch: %zu of %zu entries authenticated.\n", authenticated, count);
+
+    write_json(channel, RTVS_RESPONSE_TYPE_RTVS_RESULT, outcomes);
+    return RTVS_AUTH_OK;
+}
 
-    if (msg_name == RTVS_MSG_KILL_PROCESS) {
-        return kill_process((int)json[RTVS_JSON_MSG_PID].get<double>());
-    } else if (msg_name == RTVS_MSG_AUTH_ONLY || msg_name == RTVS_MSG_AUTH_AND_RUN) {
-        return authenticate_and_run(json);
+// Fields each message type can't do without.
+uint32_t required_fields(rau::request::message_type type) {
+    using namespace rau::request;
+    switch (type) {
+    case message_type::auth_only:
+        return field::username | field::password | field::allowed_group;
+    case message_type::auth_and_run:
+        return field::username | field::password | field::arguments | field::environment | field::working_directory;
+    case message_type::kill_process:
+        return field::process_id;
+    case message_type::set_encoding:
+        return field::encoding;
+    case message_type::stats:
+        return 0;
+    case message_type::auth_only_batch:
+        return field::entries;
+    default:
+        return 0;
+    }
+}
+
+int dispatch_message(const rau::request::request& req, request_context& context, rau::response_channel& channel, bool quiet, bool persistent, const supervised_launch* launch) {
+    using rau::request::message_type;
+
+    if (req.type == message_type::kill_process) {
+        return kill_process(req, context.times, channel, quiet);
+    } else if (req.type == message_type::set_encoding && persistent) {
+        return set_encoding(req, channel, quiet);
+    } else if (req.type == message_type::stats && persistent) {
+        return write_stats(channel, quiet);
+    } else if (req.type == message_type::auth_only_batch && batches_allowed) {
+        return auth_only_batch(req, channel);
+    } else if (req.type == message_type::auth_only || (req.type == message_type::auth_and_run && (!persistent || launch))) {
+        // In persistent mode stdin/stdout carry the request stream, so there is nothing
+        // for Microsoft.R.Host to inherit as its own standard handles; AuthAndRun needs
+        // either a dedicated helper process or handles passed over the socket.
+        return authenticate_and_run(req, context, channel, launch);
     } else {
         if (!quiet) {
-            write_json(RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_MessageTypeInvalid");
+            write_json(channel, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_MessageTypeInvalid");
         }
         return RTVS_AUTH_BAD_INPUT;
     }
 }
 
+// Reports how long each phase of the request took, in milliseconds.
+void write_timing(rau::response_channel& channel, const rau::timing::phase_times& times) {
+    picojson::object timing;
+    for (size_t i = 0; i < rau::timing::phase_count; ++i) {
+        phase p = static_cast<phase>(i);
+        if (times.measured(p)) {
+            timing[rau::timing::phase_name(p)] = picojson::value(std::chrono::duration<double, std::milli>(times.get(p)).count());
+        }
+    }
+    write_json(channel, RTVS_RESPONSE_TYPE_RTVS_TIMING, timing);
+}
+
+// The requestId the client sent with req, as it is echoed on the responses.
+picojson::value request_id_value(const rau::request::request& req) {
+    if (req.request_id_is_string) {
+        return picojson::value(req.request_id_string.to_string());
+    }
+    return picojson::value(req.request_id_number);
+}
+
+// Decodes message into req, which can be reused across requests to avoid allocating.
+int handle_message(std::string& message, rau::request::request& req, request_context& context, rau::response_channel& channel, bool quiet, bool persistent, const supervised_launch* launch) {
+    using rau::request::message_type;
+
+    auto start = rau::timing::clock::now();
+    std::string parse_err;
+    rau::request::parse_status status = rau::request::parse(message, channel.encoding(), req, parse_err);
+
+    if (status == rau::request::parse_status::syntax_error) {
+        if (!quiet) {
+            write_json(channel, RTVS_RESPONSE_TYPE_JSON_ERROR, parse_err);
+        }
+        return RTVS_AUTH_BAD_INPUT;
+    }
+
+    rau::correlated_channel tagged(channel, request_id_value(req));
+    rau::response_channel& responses = req.has(rau::request::field::request_id) ? tagged : channel;
+
+    if (status != rau::request::parse_status::ok || !req.has(rau::request::field::name | required_fields(req.type))) {
+        if (!parse_err.empty()) {
+            logf(log_verbosity::minimal, "Error: Malformed request: %s\n", parse_err.c_str());
+        }
+        if (!quiet) {
+            write_json(responses, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_InputFormatInvalid");
+        }
+        return RTVS_AUTH_BAD_INPUT;
+    }
+
+    // A switch of encoding holds up everything after it; set_encoding turns it down while
+    // anything before it is still running.
+    if (req.has(rau::request::field::request_id) && req.type != message_type::set_encoding) {
+        channel.allow_overlap();
+    }
+
+    int result = dispatch_message(req, context, responses, quiet, persistent, launch);
+    context.times.add(phase::total, rau::timing::clock::now() - start);
+
+    // Once the one-shot helper has started Microsoft.R.Host, stdout is the host's.
+    if (req.timing && !quiet && (persistent || req.type != message_type::auth_and_run)) {
+        write_timing(responses, context.times);
+    }
+    return result;
+}
+
+// Sorts the exit code of a request into the classes the metrics are kept by.
+rau::metrics::result_class classify_result(const rau::request::request& req, const request_context& context, int result) {
+    using rau::metrics::result_class;
+    using rau::request::message_type;
+
+    switch (result) {
+    case RTVS_AUTH_OK:
+        return result_class::ok;
+    case RTVS_AUTH_BAD_INPUT:
+    case RTVS_AUTH_NO_INPUT:
+        return result_class::bad_input;
+    case RTVS_AUTH_BUSY:
+        return result_class::busy;
+    case RTVS_AUTH_PRESSURE:
+        return result_class::overloaded;
+    }
+
+    if ((req.type == message_type::auth_only || req.type == message_type::auth_and_run) && !context.authenticated) {
+        return rau::metrics::classify_pam_error(result);
+    }
+    return (result == EACCES || result == EPERM) ? result_class::access_denied : result_class::system_error;
+}
+
+// Handles one request of a long-lived helper. Since there is no per-request exit code,
+// every request is completed with an rtvs-done response carrying the value that would
+// otherwise be the exit code.
+void serve_request(std::string& message, rau::response_channel& channel, bool quiet, const supervised_launch* launch) {
+    // Kept per thread so that its vectors keep their capacity from one request to the next.
+    static thread_local rau::request::request req;
+    static thread_local request_context context;
+    static std::atomic<uint64_t> next_request_id{ 1 };
+
+    rau::log::set_request_id(next_request_id++);
+    SCOPE_WARDEN(_clear_request_id, {
+        rau::log::set_request_id(0);
+    });
+
+    rau::metrics::request_started();
+    auto start = rau::timing::clock::now();
+
+    int result;
+    bool failed = false;
+    try {
+        context.clear();
+        result = handle_message(message, req, context, channel, quiet, true, launch);
+        rau::timing::aggregate(context.times);
+    } catch (const std::exception& ex) {
+        // Nothing that goes wrong with one request may take down the whole server.
+        logf(log_verbosity::minimal, "Error: Malformed request: %s\n", ex.what());
+        failed = true;
+        result = RTVS_AUTH_BAD_INPUT;
+    }
+
+    // The request has been decoded into req by now, as far as it could be.
+    rau::correlated_channel tagged(channel, request_id_value(req));
+    rau::response_channel& responses = req.has(rau::request::field::request_id) ? tagged : channel;
+    if (failed && !quiet) {
+        write_json(responses, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_InputFormatInvalid");
+    }
+
+    rau::metrics::request_finished(req.type, classify_result(req, context, result), rau::timing::clock::now() - start);
+    write_json(responses, RTVS_RESPONSE_TYPE_RTVS_DONE, (double)result);
+    channel.apply_encoding();
+}
+
+// Serves length-prefixed requests from stdin until the other end closes it, so that
+// process startup, dynamic linking and log initialization are paid for only once.
+int serve_requests(bool quiet, size_t max_frame_size) {
+    logf(log_verbosity::normal, "Serving requests until end of input.\n");
+
+    rau::framing::frame_reader reader(STDIN_FILENO, max_frame_size);
+    stream_channel channel(STDOUT_FILENO, true);
+    std::string message;
+    rau::framing::frame_reader::status status;
+    for (;;) {
+        // Responses are held back only while more requests are already waiting.
+        if (!reader.buffered()) {
+            channel.flush();
+        }
+        if ((status = read_request(reader, message)) != rau::framing::frame_reader::status::ok) {
+            break;
+        }
+        serve_request(message, channel, quiet, nullptr);
+    }
+    channel.flush();
+
+    if (status != rau::framing::frame_reader::status::eof) {
+        return RTVS_AUTH_BAD_INPUT;
+    }
+
+    logf(log_verbosity::normal, "End of input, shutting down.\n");
+    rau::timing::log_summary();
+    return RTVS_AUTH_OK;
+}
+
+int main(int argc, char **argv) {
+    bool quiet = false;
+    bool persistent = false;
+    rau::server::server_options server_options;
+    std::chrono::seconds nss_cache_ttl(30);
+    size_t max_frame_size = rau::framing::default_max_frame_size;
+    rau::log::sink_options sink_options;
+    std::string metrics_path;
+    std::string cgroup_root;
+    // The last option given that only root may use.
+    const char* set_by_root_only = nullptr;
+    rau::admission::thresholds admission = rau::admission::current_thresholds();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "qsel:u:w:b:c:m:r:a:d:p:j:i:g:n:P:t:")) != -1) {
+        switch (opt) {
+        case 'q':
+            quiet = true;
+            break;
+        case 'e':
+            log_host_command = true;
+            break;
+        case 's':
+            persistent = true;
+            break;
+        case 'l':
+            server_options.socket_path = optarg;
+            break;
+        case 'u': {
+            struct passwd *pw = getpwnam(optarg);
+            if (!pw) {
+                fprintf(stderr, "Error: Unknown user %s\n", optarg);
+                return RTVS_AUTH_BAD_INPUT;
+            }
+            server_options.allowed_uids.push_back(pw->pw_uid);
+            break;
+        }
+        case 'w':
+            server_options.workers = strtoul(optarg, nullptr, 10);
+            break;
+        case 'b':
+            server_options.max_queue_depth = strtoul(optarg, nullptr, 10);
+            break;
+        case 'c':
+            nss_cache_ttl = std::chrono::seconds(strtoul(optarg, nullptr, 10));
+            break;
+        case 'm':
+            max_frame_size = strtoul(optarg, nullptr, 10);
+            break;
+        case 'r':
+            sink_options.max_size = strtoull(optarg, nullptr, 10);
+            set_by_root_only = "-r";
+            break;
+        case 'a':
+            sink_options.max_age = std::chrono::seconds(strtoul(optarg, nullptr, 10));
+            set_by_root_only = "-a";
+            break;
+        case 'd':
+            sink_options.collector_path = optarg;
+            set_by_root_only = "-d";
+            break;
+        case 'p':
+            metrics_path = optarg;
+            break;
+        case 'j':
+            batch_parallelism = std::max<size_t>(1, strtoul(optarg, nullptr, 10));
+            set_by_root_only = "-j";
+            break;
+        case 'i':
+            server_options.max_in_flight = strtoul(optarg, nullptr, 10);
+            break;
+        case 'g':
+            cgroup_root = optarg;
+            break;
+        case 'n': {
+            rau::placement::policy policy;
+            if (!rau::placement::parse_policy(optarg, policy)) {
+                fprintf(stderr, "Error: Unknown placement policy %s\n", optarg);
+                return RTVS_AUTH_BAD_INPUT;
+            }
+            rau::placement::set_default_policy(policy);
+            break;
+        }
+        case 'P':
+            if (!rau::admission::parse_thresholds(optarg, admission)) {
+                fprintf(stderr, "Error: Invalid pressure thresholds %s\n", optarg);
+                return RTVS_AUTH_BAD_INPUT;
+            }
+            break;
+        case 't':
+            admission.queue_timeout = std::chrono::milliseconds(strtoul(optarg, nullptr, 10));
+            break;
+        }
+    }
+
+    // The binary is setuid root, so options that change how much it does for a caller, or
+    // what it does to files of root's, are for root only.
+    if (set_by_root_only && getuid() != 0) {
+        fprintf(stderr, "Error: Only root can use %s.\n", set_by_root_only);
+        return RTVS_AUTH_INIT_FAILED;
+    }
+    // Root, or with -l the clients that root allowed; their requests get here as root too.
+    batches_allowed = getuid() == 0;
+
+    // The binary is setuid root, so only let root itself create a listening socket.
+    if (!server_options.socket_path.empty() && getuid() != 0) {
+        fprintf(stderr, "Error: Only root can start the socket server.\n");
+        return RTVS_AUTH_INIT_FAILED;
+    }
+
+    // Metrics files are written and renamed into place as root, so root must pick where,
+    // and no one else may be able to swap things around in that directory.
+    if (!metrics_path.empty()) {
+        if (getuid() != 0 || server_options.socket_path.empty()) {
+            fprintf(stderr, "Error: Only root can export metrics, and only from the socket server.\n");
+            return RTVS_AUTH_INIT_FAILED;
+        }
+        if (!rau::metrics::check_export_path(metrics_path)) {
+            fprintf(stderr, "Error: Can't export metrics to %s: %s\n", metrics_path.c_str(), strerror(errno));
+            return RTVS_AUTH_INIT_FAILED;
+        }
+    }
+
+    rau::admission::set_thresholds(admission);
+
+    // Nor make it create cgroups anywhere but where root said.
+    if (!cgroup_root.empty()) {
+        if (getuid() != 0) {
+            fprintf(stderr, "Error: Only root can set the cgroup root.\n");
+            return RTVS_AUTH_INIT_FAILED;
+        }
+        if (!rau::cgroup::set_root(cgroup_root)) {
+            fprintf(stderr, "Error: %s is not a cgroup v2 directory: %s\n", cgroup_root.c_str(), strerror(errno));
+            return RTVS_AUTH_INIT_FAILED;
+        }
+    }
+
+#if NDEBUG
+    log_verbosity logVerb = log_verbosity::traffic;
+#else
+    log_verbosity logVerb = log_verbosity::normal;
+#endif
+
+    SCOPE_WARDEN(_main_exit, {
+        flush_log();
+    });
+    // The socket server is where the other helpers' records are collected, so it logs to
+    // the file itself.
+    std::string collector_path;
+    if (!server_options.socket_path.empty()) {
+        std::swap(collector_path, sink_options.collector_path);
+    }
+    init_log("", fs::temp_directory_path(), logVerb, sink_options);
+    if (!collector_path.empty() && !rau::log::host_collector(collector_path)) {
+        int err = errno;
+        logf(log_verbosity::minimal, "Error: Can't collect logs on %s: %s\n", collector_path.c_str(), strerror(err));
+        return RTVS_AUTH_INIT_FAILED;
+    }
+
+    if (persistent || !server_options.socket_path.empty()) {
+        rau::nss::set_cache_ttl(nss_cache_ttl);
+        rau::pam_stack::preload(RTVS_PAM_SERVICE);
+    }
+
+    // Metrics are written once more on the way out so that the last requests aren't lost.
+    SCOPE_WARDEN(_write_metrics, {
+        if (!metrics_path.empty()) {
+            rau::metrics::write_prometheus_file(metrics_path);
+        }
+    });
+    if (!metrics_path.empty()) {
+        rau::metrics::start_exporter(metrics_path, std::chrono::seconds(10));
+    }
+
+    if (!server_options.socket_path.empty()) {
+        rau::host_supervisor supervisor;
+        server_options.supervisor = &supervisor;
+        server_options.max_frame_size = max_frame_size;
+        int err = rau::server::run(server_options, [quiet, &supervisor](std::string& message, const std::vector<int>& fds, rau::response_channel& channel) {
+            supervised_launch launch = { &supervisor, &fds };
+            serve_request(message, channel, quiet, fds.size() == 3 ? &launch : nullptr);
+        }, [](std::string& message, const std::vector<int>&, rau::response_channel& channel) {
+            // Decoding doesn't block, and tells a client with other requests in flight which
+            // one was turned away.
+            static rau::request::request req;
+            std::string parse_err;
+            rau::request::parse(message, channel.encoding(), req, parse_err);
+            rau::correlated_channel tagged(channel, request_id_value(req));
+            rau::response_channel& responses = req.has(rau::request::field::request_id) ? tagged : channel;
+
+            rau::metrics::request_rejected();
+            write_json(responses, RTVS_RESPONSE_TYPE_RTVS_ERROR, "Error_RunAsUser_ServerBusy");
+            write_json(responses, RTVS_RESPONSE_TYPE_RTVS_DONE, (double)RTVS_AUTH_BUSY);
+        });
+        return err ? RTVS_AUTH_INIT_FAILED : RTVS_AUTH_OK;
+    }
+
+    if (persistent) {
+        return serve_requests(quiet, max_frame_size);
+    }
+
+    // Microsoft.R.Host inherits stdout after AuthAndRun, so nothing may be left buffered.
+    rau::framing::frame_reader reader(STDIN_FILENO, max_frame_size);
+    stream_channel channel(STDOUT_FILENO, false);
+    std::string message;
+    read_request(reader, message);
+    rau::log::set_request_id(1);
+    rau::request::request req;
+    request_context context;
+    context.clear();
+    return handle_message(message, req, context, channel, quiet, false, nullptr);
+}
+
 // g++ -std=c++14 -fexceptions -fpermissive -O0 -ggdb -I../src -I../lib/picojson -c ../src/*.c*
-// g++ -g -o Microsoft.R.Host.RunAsUser.out ./*.o -lpthread -L/usr/lib/x86_64-linux-gnu -lpam -lexplain
\ No newline at end of file
+// g++ -g -o Microsoft.R.Host.RunAsUser.out ./*.o -lpthread -L/usr/lib/x86_64-linux-gnu -lpam -lexplain
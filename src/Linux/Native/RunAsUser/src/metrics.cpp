@@ -0,0 +1,296 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "metrics.h"
+
+namespace rau {
+    namespace metrics {
+        namespace {
+            const char* const result_class_names[result_class_count] = {
+                "ok",
+                "bad_input",
+                "busy",
+                "overloaded",
+                "pam_auth",
+                "pam_account",
+                "pam_session",
+                "pam_other",
+                "access_denied",
+                "system_error",
+            };
+
+            struct registry {
+                std::atomic<uint64_t> requests[request::message_type_count][result_class_count];
+                std::atomic<int64_t> in_flight;
+                std::atomic<uint64_t> hosts_launched;
+                std::atomic<uint64_t> hosts_exited;
+                timing::histogram latency[request::message_type_count];
+
+                registry() : in_flight(0), hosts_launched(0), hosts_exited(0) {
+                    for (auto& by_type : requests) {
+                        for (auto& count : by_type) {
+                            count.store(0, std::memory_order_relaxed);
+                        }
+                    }
+                }
+            };
+
+            registry& metrics() {
+                static registry r;
+                return r;
+            }
+
+            const double quantiles[] = { 0.5, 0.95, 0.99 };
+
+            picojson::object latency_json(const timing::histogram::snapshot& s) {
+                picojson::object o;
+                o["count"] = picojson::value(static_cast<double>(s.count));
+                o["p50"] = picojson::value(s.percentile_us(0.5) / 1000);
+                o["p95"] = picojson::value(s.percentile_us(0.95) / 1000);
+                o["p99"] = picojson::value(s.percentile_us(0.99) / 1000);
+                o["max"] = picojson::value(s.max_us / 1000.0);
+                return o;
+            }
+
+            void append_summary(std::string& out, const char* name, const char* label, const char* value, const timing::histogram::snapshot& s) {
+                char line[256];
+                for (double q : quantiles) {
+                    snprintf(line, sizeof line, "%s{%s=\"%s\",quantile=\"%g\"} %.6f\n", name, label, value, q, s.percentile_us(q) / 1e6);
+                    out += line;
+                }
+                snprintf(line, sizeof line, "%s_sum{%s=\"%s\"} %.6f\n", name, label, value, s.sum_us / 1e6);
+                out += line;
+                snprintf(line, sizeof line, "%s_count{%s=\"%s\"} %llu\n", name, label, value, static_cast<unsigned long long>(s.count));
+                out += line;
+            }
+        }
+
+        const char* result_class_name(result_class result) {
+            return result_class_names[static_cast<size_t>(result)];
+        }
+
+        result_class classify_pam_error(int pam_err) {
+            switch (pam_err) {
+            case PAM_SUCCESS:
+                return result_class::ok;
+            case PAM_AUTH_ERR:
+            case PAM_USER_UNKNOWN:
+            case PAM_MAXTRIES:
+            case PAM_CRED_INSUFFICIENT:
+            case PAM_AUTHINFO_UNAVAIL:
+                return result_class::pam_auth;
+            case PAM_ACCT_EXPIRED:
+            case PAM_NEW_AUTHTOK_REQD:
+            case PAM_AUTHTOK_EXPIRED:
+            case PAM_PERM_DENIED:
+                return result_class::pam_account;
+            case PAM_SESSION_ERR:
+            case PAM_CRED_ERR:
+            case PAM_CRED_UNAVAIL:
+            case PAM_CRED_EXPIRED:
+                return result_class::pam_session;
+            default:
+                return result_class::pam_other;
+            }
+        }
+
+        void request_started() {
+            metrics().in_flight.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void request_finished(request::message_type type, result_class result, timing::clock::duration elapsed) {
+            registry& r = metrics();
+            r.in_flight.fetch_sub(1, std::memory_order_relaxed);
+            r.requests[static_cast<size_t>(type)][static_cast<size_t>(result)].fetch_add(1, std::memory_order_relaxed);
+            r.latency[static_cast<size_t>(type)].record(elapsed);
+        }
+
+        void request_rejected() {
+            metrics().requests[static_cast<size_t>(request::message_type::unknown)][static_cast<size_t>(result_class::busy)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void host_launched() {
+            metrics().hosts_launched.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void host_exited() {
+            metrics().hosts_exited.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        picojson::object snapshot() {
+            registry& r = metrics();
+            picojson::object requests, latency, phases;
+            for (size_t t = 0; t < request::message_type_count; ++t) {
+                const char* type = request::message_name(static_cast<request::message_type>(t));
+
+                picojson::object by_result;
+                for (size_t c = 0; c < result_class_count; ++c) {
+                    uint64_t n = r.requests[t][c].load(std::memory_order_relaxed);
+                    if (n) {
+                        by_result[result_class_names[c]] = picojson::value(static_cast<double>(n));
+                    }
+                }
+                if (!by_result.empty()) {
+                    requests[type] = picojson::value(by_result);
+                }
+
+                auto s = r.latency[t].get_snapshot();
+                if (s.count) {
+                    latency[type] = picojson::value(latency_json(s));
+                }
+            }
+
+            for (size_t p = 0; p < timing::phase_count; ++p) {
+                auto s = timing::phase_histogram(static_cast<timing::phase>(p)).get_snapshot();
+                if (s.count) {
+                    phases[timing::phase_name(static_cast<timing::phase>(p))] = picojson::value(latency_json(s));
+                }
+            }
+
+            picojson::object o;
+            o["requests"] = picojson::value(requests);
+            o["inFlight"] = picojson::value(static_cast<double>(r.in_flight.load(std::memory_order_relaxed)));
+            o["hostsLaunched"] = picojson::value(static_cast<double>(r.hosts_launched.load(std::memory_order_relaxed)));
+            o["hostsExited"] = picojson::value(static_cast<double>(r.hosts_exited.load(std::memory_order_relaxed)));
+            // In milliseconds.
+            o["latency"] = picojson::value(latency);
+            o["phases"] = picojson::value(phases);
+            return o;
+        }
+
+        std::string prometheus_text() {
+            registry& r = metrics();
+            std::string out;
+            char line[1024];
+
+            out += "# HELP rtvs_runasuser_requests_total Requests handled, by message type and result.\n"
+                   "# TYPE rtvs_runasuser_requests_total counter\n";
+            for (size_t t = 0; t < request::message_type_count; ++t) {
+                for (size_t c = 0; c < result_class_count; ++c) {
+                    uint64_t n = r.requests[t][c].load(std::memory_order_relaxed);
+                    if (n) {
+                        snprintf(line, sizeof line, "rtvs_runasuser_requests_total{type=\"%s\",result=\"%s\"} %llu\n",
+                                 request::message_name(static_cast<request::message_type>(t)), result_class_names[c], static_cast<unsigned long long>(n));
+                        out += line;
+                    }
+                }
+            }
+
+            snprintf(line, sizeof line,
+                     "# HELP rtvs_runasuser_requests_in_flight Requests being handled.\n"
+                     "# TYPE rtvs_runasuser_requests_in_flight gauge\n"
+                     "rtvs_runasuser_requests_in_flight %lld\n"
+                     "# HELP rtvs_runasuser_hosts_launched_total Microsoft.R.Host processes started.\n"
+                     "# TYPE rtvs_runasuser_hosts_launched_total counter\n"
+                     "rtvs_runasuser_hosts_launched_total %llu\n"
+                     "# HELP rtvs_runasuser_hosts_exited_total Microsoft.R.Host processes that have ended.\n"
+                     "# TYPE rtvs_runasuser_hosts_exited_total counter\n"
+                     "rtvs_runasuser_hosts_exited_total %llu\n",
+                     static_cast<long long>(r.in_flight.load(std::memory_order_relaxed)),
+                     static_cast<unsigned long long>(r.hosts_launched.load(std::memory_order_relaxed)),
+                     static_cast<unsigned long long>(r.hosts_exited.load(std::memory_order_relaxed)));
+            out += line;
+
+            out += "# HELP rtvs_runasuser_request_duration_seconds Time to handle a request, by message type.\n"
+                   "# TYPE rtvs_runasuser_request_duration_seconds summary\n";
+            for (size_t t = 0; t < request::message_type_count; ++t) {
+                auto s = r.latency[t].get_snapshot();
+                if (s.count) {
+                    append_summary(out, "rtvs_runasuser_request_duration_seconds", "type", request::message_name(static_cast<request::message_type>(t)), s);
+                }
+            }
+
+            out += "# HELP rtvs_runasuser_phase_duration_seconds Time spent in each phase of a request.\n"
+                   "# TYPE rtvs_runasuser_phase_duration_seconds summary\n";
+            for (size_t p = 0; p < timing::phase_count; ++p) {
+                auto s = timing::phase_histogram(static_cast<timing::phase>(p)).get_snapshot();
+                if (s.count) {
+                    append_summary(out, "rtvs_runasuser_phase_duration_seconds", "phase", timing::phase_name(static_cast<timing::phase>(p)), s);
+                }
+            }
+            return out;
+        }
+
+        bool check_export_path(const std::string& path) {
+            std::string dir = fs::path(path).parent_path().string();
+            struct stat st;
+            if (stat(dir.empty() ? "." : dir.c_str(), &st) == -1) {
+                return false;
+            }
+            if (!S_ISDIR(st.st_mode) || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+                errno = EPERM;
+                return false;
+            }
+            return true;
+        }
+
+        bool write_prometheus_file(const std::string& path) {
+            std::string text = prometheus_text();
+            std::string temp_path = path + ".tmp";
+
+            int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+            if (fd == -1) {
+                return false;
+            }
+
+            const char* p = text.data();
+            size_t left = text.size();
+            while (left > 0) {
+                ssize_t n = write(fd, p, left);
+                if (n == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    int err = errno;
+                    close(fd);
+                    unlink(temp_path.c_str());
+                    errno = err;
+                    return false;
+                }
+                p += n;
+                left -= n;
+            }
+
+            if (close(fd) == -1 || rename(temp_path.c_str(), path.c_str()) == -1) {
+                int err = errno;
+                unlink(temp_path.c_str());
+                errno = err;
+                return false;
+            }
+            return true;
+        }
+
+        void start_exporter(const std::string& path, std::chrono::seconds interval) {
+            std::thread([path, interval]() {
+                sigset_t mask;
+                sigfillset(&mask);
+                pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+                for (;;) {
+                    write_prometheus_file(path);
+                    std::this_thread::sleep_for(interval);
+                }
+            }).detach();
+        }
+    }
+}
@@ -0,0 +1,82 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "picojson.h"
+#include "request.h"
+#include "timing.h"
+
+namespace rau {
+    namespace metrics {
+        // What a finished request came to, coarse enough to count and alert on.
+        enum class result_class {
+            ok,
+            bad_input,
+            busy,
+            // AuthAndRun turned away because the machine was under memory, CPU or I/O pressure.
+            overloaded,
+            // Wrong password, unknown user, too many tries.
+            pam_auth,
+            // Expired or locked account, password change required.
+            pam_account,
+            // Credentials or session could not be established.
+            pam_session,
+            pam_other,
+            access_denied,
+            system_error,
+            count
+        };
+
+        constexpr size_t result_class_count = static_cast<size_t>(result_class::count);
+
+        const char* result_class_name(result_class result);
+
+        result_class classify_pam_error(int pam_err);
+
+        // Process-wide counters. All of them can be updated from any thread without locking.
+        void request_started();
+        void request_finished(request::message_type type, result_class result, timing::clock::duration elapsed);
+        // A request turned away before it was decoded, because all workers were busy.
+        void request_rejected();
+        void host_launched();
+        void host_exited();
+
+        // Everything collected so far, for the Stats message.
+        picojson::object snapshot();
+
+        // Everything collected so far, in the Prometheus text exposition format.
+        std::string prometheus_text();
+
+        // Whether path's directory belongs to root and no one else can write to it, so that
+        // the temporary file and the rename below can't be redirected. Sets errno if not.
+        bool check_export_path(const std::string& path);
+
+        // Replaces path with the current Prometheus text. The file is written next to path
+        // and renamed over it, so a scraper never sees it half-written.
+        bool write_prometheus_file(const std::string& path);
+
+        // Rewrites path every interval from a background thread.
+        void start_exporter(const std::string& path, std::chrono::seconds interval);
+    }
+}
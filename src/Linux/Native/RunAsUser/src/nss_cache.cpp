@@ -0,0 +1,300 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "nss_cache.h"
+#include "log.h"
+
+using namespace rau::log;
+
+namespace rau {
+    namespace nss {
+        namespace {
+            typedef std::chrono::steady_clock clock;
+
+            template<typename T>
+            struct cached {
+                T value;
+                clock::time_point expires;
+            };
+
+            template<typename K, typename T>
+            using cache_map = std::unordered_map<K, cached<T>>;
+
+            std::mutex cache_mutex;
+            clock::duration cache_ttl = clock::duration::zero();
+            cache_map<std::string, user_entry> users_by_name;
+            cache_map<uid_t, user_entry> users_by_uid;
+            cache_map<std::string, group_entry> groups_by_name;
+            cache_map<gid_t, group_entry> groups_by_gid;
+            cache_map<std::string, std::vector<gid_t>> group_lists;
+            cache_counters counters = {};
+
+            constexpr int max_group_list_size = 0x100000;
+            constexpr char passwd_path[] = "/etc/passwd";
+            constexpr char group_path[] = "/etc/group";
+
+#ifndef _APPLE
+            // Watches /etc rather than the files, since tools like useradd replace them by rename.
+            int inotify_fd = -1;
+#endif
+            bool watch_initialized = false;
+            timespec passwd_mtime = {}, group_mtime = {};
+
+            bool update_mtime(const char* path, timespec& mtime) {
+                struct stat st;
+                if (stat(path, &st) != 0) {
+                    return false;
+                }
+#ifdef _APPLE
+                const timespec& current = st.st_mtimespec;
+#else
+                const timespec& current = st.st_mtim;
+#endif
+                bool changed = current.tv_sec != mtime.tv_sec || current.tv_nsec != mtime.tv_nsec;
+                mtime = current;
+                return changed;
+            }
+
+            void drop_users_locked() {
+                users_by_name.clear();
+                users_by_uid.clear();
+                group_lists.clear();
+                ++counters.invalidations;
+            }
+
+            void drop_groups_locked() {
+                groups_by_name.clear();
+                groups_by_gid.clear();
+                group_lists.clear();
+                ++counters.invalidations;
+            }
+
+            void check_invalidation_locked() {
+                if (!watch_initialized) {
+                    watch_initialized = true;
+#ifndef _APPLE
+                    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                    if (inotify_fd != -1 &&
+                        inotify_add_watch(inotify_fd, "/etc", IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_DELETE) == -1) {
+                        logf(log_verbosity::normal, "Error [inotify_add_watch]: %s, falling back to mtime checks\n", strerror(errno));
+                        close(inotify_fd);
+                        inotify_fd = -1;
+                    }
+#endif
+                    update_mtime(passwd_path, passwd_mtime);
+                    update_mtime(group_path, group_mtime);
+                    return;
+                }
+
+#ifndef _APPLE
+                if (inotify_fd != -1) {
+                    alignas(inotify_event) char buf[4096];
+                    ssize_t n;
+                    while ((n = read(inotify_fd, buf, sizeof buf)) > 0) {
+                        for (char* p = buf; p < buf + n;) {
+                            auto ev = reinterpret_cast<inotify_event*>(p);
+                            if (ev->mask & IN_Q_OVERFLOW) {
+                                // Events were lost, and with them maybe a change to either file.
+                                logf(log_verbosity::normal, "inotify queue overflowed, dropping cached users and groups\n");
+                                drop_users_locked();
+                                drop_groups_locked();
+                            } else if (ev->len > 0) {
+                                if (strcmp(ev->name, "passwd") == 0) {
+                                    drop_users_locked();
+                                } else if (strcmp(ev->name, "group") == 0) {
+                                    drop_groups_locked();
+                                }
+                            }
+                            p += sizeof(inotify_event) + ev->len;
+                        }
+                    }
+                    return;
+                }
+#endif
+
+                if (update_mtime(passwd_path, passwd_mtime)) {
+                    drop_users_locked();
+                }
+                if (update_mtime(group_path, group_mtime)) {
+                    drop_groups_locked();
+                }
+            }
+
+            template<typename K, typename T>
+            bool find_cached(cache_map<K, T>& map, const K& key, T& value) {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                if (cache_ttl == clock::duration::zero()) {
+                    return false;
+                }
+
+                check_invalidation_locked();
+
+                auto it = map.find(key);
+                if (it == map.end() || it->second.expires <= clock::now()) {
+                    ++counters.misses;
+                    return false;
+                }
+
+                ++counters.hits;
+                value = it->second.value;
+                return true;
+            }
+
+            void store_user(const user_entry& entry) {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                if (cache_ttl != clock::duration::zero()) {
+                    auto expires = clock::now() + cache_ttl;
+                    users_by_name[entry.name] = { entry, expires };
+                    users_by_uid[entry.uid] = { entry, expires };
+                }
+            }
+
+            void store_group(const group_entry& entry) {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                if (cache_ttl != clock::duration::zero()) {
+                    auto expires = clock::now() + cache_ttl;
+                    groups_by_name[entry.name] = { entry, expires };
+                    groups_by_gid[entry.gid] = { entry, expires };
+                }
+            }
+
+            // Reentrant getpw*_r/getgr*_r wrapper that grows buf until the entry fits.
+            // Returns nullptr with errno set to 0 if there is no such entry.
+            template<typename T, typename K, typename F>
+            T* lookup_entry(F lookup, K key, T& entry, std::vector<char>& buf) {
+                buf.resize(1024);
+                T* found = nullptr;
+                int err;
+                while ((err = lookup(key, &entry, buf.data(), buf.size(), &found)) == ERANGE) {
+                    buf.resize(buf.size() * 2);
+                }
+                errno = err;
+                return found;
+            }
+
+            template<typename K, typename F>
+            bool load_user(F lookup, K key, user_entry& entry) {
+                struct passwd pwd;
+                std::vector<char> buf;
+                struct passwd* pw = lookup_entry(lookup, key, pwd, buf);
+                if (!pw) {
+                    return false;
+                }
+
+                entry.name = pw->pw_name;
+                entry.uid = pw->pw_uid;
+                entry.gid = pw->pw_gid;
+                entry.home = pw->pw_dir ? pw->pw_dir : "";
+                store_user(entry);
+                return true;
+            }
+
+            template<typename K, typename F>
+            bool load_group(F lookup, K key, group_entry& entry) {
+                struct group grp;
+                std::vector<char> buf;
+                struct group* gr = lookup_entry(lookup, key, grp, buf);
+                if (!gr) {
+                    return false;
+                }
+
+                entry.name = gr->gr_name;
+                entry.gid = gr->gr_gid;
+                store_group(entry);
+                return true;
+            }
+        }
+
+        void set_cache_ttl(std::chrono::seconds ttl) {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            cache_ttl = ttl;
+            users_by_name.clear();
+            users_by_uid.clear();
+            groups_by_name.clear();
+            groups_by_gid.clear();
+            group_lists.clear();
+        }
+
+        std::chrono::seconds get_cache_ttl() {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            return std::chrono::duration_cast<std::chrono::seconds>(cache_ttl);
+        }
+
+        bool find_user(const std::string& name, user_entry& entry) {
+            return find_cached(users_by_name, name, entry) || load_user(getpwnam_r, name.c_str(), entry);
+        }
+
+        bool find_user(uid_t uid, user_entry& entry) {
+            return find_cached(users_by_uid, uid, entry) || load_user(getpwuid_r, uid, entry);
+        }
+
+        bool find_group(const std::string& name, group_entry& entry) {
+            return find_cached(groups_by_name, name, entry) || load_group(getgrnam_r, name.c_str(), entry);
+        }
+
+        bool find_group(gid_t gid, group_entry& entry) {
+            return find_cached(groups_by_gid, gid, entry) || load_group(getgrgid_r, gid, entry);
+        }
+
+        bool get_group_list(const std::string& user, gid_t gid, std::vector<gid_t>& groups) {
+            std::string key = user + ":" + std::to_string(gid);
+            if (find_cached(group_lists, key, groups)) {
+                return true;
+            }
+
+            // getgrouplist reports the required size when the buffer is too small.
+            int ngroups = 64;
+            for (;;) {
+                groups.resize(ngroups);
+#ifdef _APPLE
+                int result = getgrouplist(user.c_str(), static_cast<int>(gid), reinterpret_cast<int*>(groups.data()), &ngroups);
+#else
+                int result = getgrouplist(user.c_str(), gid, groups.data(), &ngroups);
+#endif
+                if (result != -1) {
+                    break;
+                }
+                if (ngroups <= static_cast<int>(groups.size())) {
+                    ngroups = static_cast<int>(groups.size()) * 2;
+                }
+                if (ngroups > max_group_list_size) {
+                    errno = ERANGE;
+                    return false;
+                }
+            }
+            groups.resize(ngroups);
+
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            if (cache_ttl != clock::duration::zero()) {
+                group_lists[key] = { groups, clock::now() + cache_ttl };
+            }
+            return true;
+        }
+
+        cache_counters get_cache_counters() {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            return counters;
+        }
+    }
+}
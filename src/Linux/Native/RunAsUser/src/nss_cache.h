@@ -0,0 +1,66 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace nss {
+        struct user_entry {
+            std::string name;
+            uid_t uid;
+            gid_t gid;
+            std::string home;
+        };
+
+        struct group_entry {
+            std::string name;
+            gid_t gid;
+        };
+
+        struct cache_counters {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t invalidations;
+        };
+
+        // How long passwd and group data is reused before NSS is asked again. Zero, the
+        // default, disables caching, which is what one-shot helpers want. Cached data is
+        // also dropped as soon as /etc/passwd or /etc/group change.
+        void set_cache_ttl(std::chrono::seconds ttl);
+
+        std::chrono::seconds get_cache_ttl();
+
+        // Lookups return false and set errno if the entry can't be retrieved; errno is 0
+        // if there simply is no such user or group. Failed lookups are not cached.
+        bool find_user(const std::string& name, user_entry& entry);
+        bool find_user(uid_t uid, user_entry& entry);
+        bool find_group(const std::string& name, group_entry& entry);
+        bool find_group(gid_t gid, group_entry& entry);
+
+        // Supplementary groups of user plus gid, as getgrouplist, but without a size limit.
+        bool get_group_list(const std::string& user, gid_t gid, std::vector<gid_t>& groups);
+
+        cache_counters get_cache_counters();
+    }
+}
@@ -0,0 +1,112 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "response.h"
+#include "pam_conv.h"
+
+int rtvs_conv(int num_msg, const pam_message **msgm, pam_response **response, void *appdata_ptr) {
+    if (num_msg < 0) {
+        return PAM_CONV_ERR;
+    }
+
+    pam_response *reply = (pam_response*) calloc(num_msg, sizeof(pam_response));
+    if (reply == nullptr) {
+        return PAM_CONV_ERR;
+    }
+
+    for (int count = 0; count < num_msg; ++count) {
+        char *str = nullptr;
+        switch (msgm[count]->msg_style) {
+        case PAM_PROMPT_ECHO_OFF:
+            str = strdup(static_cast<conv_data*>(appdata_ptr)->password);
+            break;
+        case PAM_PROMPT_ECHO_ON:
+            str = strdup(static_cast<conv_data*>(appdata_ptr)->password);
+            break;
+        case PAM_ERROR_MSG:
+            write_json(*static_cast<conv_data*>(appdata_ptr)->channel, RTVS_RESPONSE_TYPE_PAM_ERROR, msgm[count]->msg);
+            break;
+        case PAM_TEXT_INFO:
+            write_json(*static_cast<conv_data*>(appdata_ptr)->channel, RTVS_RESPONSE_TYPE_PAM_INFO, msgm[count]->msg);
+            break;
+        }
+
+        if (str) {
+            reply[count].resp_retcode = 0;
+            reply[count].resp = str;
+            str = nullptr;
+        }
+    }
+
+    *response = reply;
+    reply = nullptr;
+
+    return PAM_SUCCESS;
+}
+
+int rtvs_conv_quiet(int num_msg, const pam_message **msgm, pam_response **response, void *appdata_ptr) {
+    if (num_msg < 0) {
+        return PAM_CONV_ERR;
+    }
+
+    pam_response *reply = (pam_response*)calloc(num_msg, sizeof(pam_response));
+    if (reply == nullptr) {
+        return PAM_CONV_ERR;
+    }
+
+    for (int count = 0; count < num_msg; ++count) {
+        char *str = nullptr;
+        switch (msgm[count]->msg_style) {
+        case PAM_PROMPT_ECHO_OFF:
+            str = strdup(static_cast<conv_data*>(appdata_ptr)->password);
+            break;
+        case PAM_PROMPT_ECHO_ON:
+            str = strdup(static_cast<conv_data*>(appdata_ptr)->password);
+            break;
+        case PAM_ERROR_MSG:
+        case PAM_TEXT_INFO:
+            break;
+        }
+
+        if (str) {
+            reply[count].resp_retcode = 0;
+            reply[count].resp = str;
+            str = nullptr;
+        }
+    }
+
+    *response = reply;
+    reply = nullptr;
+
+    return PAM_SUCCESS;
+}
+
+#ifdef PAM_FAIL_DELAY
+// Registered as PAM_FAIL_DELAY so that PAM doesn't sleep on failed authentication itself;
+// the response channel decides how the delay is served.
+void rtvs_fail_delay(int retval, unsigned usec_delay, void *appdata_ptr) {
+    if (retval != PAM_SUCCESS && usec_delay > 0 && appdata_ptr) {
+        static_cast<conv_data*>(appdata_ptr)->channel->delay_responses(std::chrono::microseconds(usec_delay));
+    }
+}
+#endif
@@ -0,0 +1,43 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "channel.h"
+
+// appdata_ptr passed to rtvs_conv and rtvs_conv_quiet.
+struct conv_data {
+    const char* password;
+    rau::response_channel* channel;
+};
+
+// PAM conversation of a request: answers every prompt with the password, and passes PAM's
+// messages on to the client as pam-info and pam-error responses.
+int rtvs_conv(int num_msg, const pam_message **msgm, pam_response **response, void *appdata_ptr);
+
+// Same as rtvs_conv, for requests that mustn't write anything.
+int rtvs_conv_quiet(int num_msg, const pam_message **msgm, pam_response **response, void *appdata_ptr);
+
+#ifdef PAM_FAIL_DELAY
+void rtvs_fail_delay(int retval, unsigned usec_delay, void *appdata_ptr);
+#endif
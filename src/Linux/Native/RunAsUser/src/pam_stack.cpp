@@ -0,0 +1,266 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "pam_stack.h"
+#include "log.h"
+
+using namespace rau::log;
+
+namespace rau {
+    namespace pam_stack {
+        namespace {
+            constexpr char config_dir[] = "/etc/pam.d";
+            // Where newer versions of Linux-PAM look when a service has no file in /etc/pam.d.
+            constexpr char vendor_config_dir[] = "/usr/lib/pam.d";
+            // Include chains deeper than this are taken to be loops.
+            constexpr int max_include_depth = 16;
+
+            std::mutex stack_mutex;
+            std::string stack_service;
+            std::vector<void*> loaded_modules;
+            std::vector<std::string> config_files;
+#ifndef _APPLE
+            int inotify_fd = -1;
+#endif
+
+            // Directory relative module names are resolved against, which is "security" next to
+            // libpam itself on every layout Linux-PAM is packaged in.
+            const std::string& module_dir() {
+                static std::string dir = [] {
+                    Dl_info info;
+                    if (dladdr(reinterpret_cast<void*>(&pam_start), &info) && info.dli_fname) {
+                        fs::path candidate = fs::path(info.dli_fname).parent_path() / "security";
+                        boost::system::error_code ec;
+                        if (fs::is_directory(candidate, ec)) {
+                            return candidate.string();
+                        }
+                    }
+                    for (const char* candidate : { "/lib/security", "/lib64/security", "/usr/lib/security", "/usr/lib64/security" }) {
+                        boost::system::error_code ec;
+                        if (fs::is_directory(candidate, ec)) {
+                            return std::string(candidate);
+                        }
+                    }
+                    return std::string("/lib/security");
+                }();
+                return dir;
+            }
+
+            std::string config_path(const std::string& name) {
+                if (!name.empty() && name[0] == '/') {
+                    return name;
+                }
+                std::string path = std::string(config_dir) + "/" + name;
+                if (access(path.c_str(), F_OK) != 0) {
+                    std::string vendor_path = std::string(vendor_config_dir) + "/" + name;
+                    if (access(vendor_path.c_str(), F_OK) == 0) {
+                        return vendor_path;
+                    }
+                }
+                return path;
+            }
+
+            // Splits a config line into its fields. A control field in brackets may contain
+            // spaces, as in [success=1 default=ignore].
+            std::vector<std::string> split_fields(const std::string& line) {
+                std::vector<std::string> fields;
+                size_t i = 0;
+                while (i < line.size()) {
+                    while (i < line.size() && isspace(static_cast<unsigned char>(line[i]))) {
+                        ++i;
+                    }
+                    if (i == line.size()) {
+                        break;
+                    }
+
+                    size_t start = i;
+                    if (line[i] == '[') {
+                        while (i < line.size() && line[i] != ']') {
+                            ++i;
+                        }
+                        if (i < line.size()) {
+                            ++i;
+                        }
+                    } else {
+                        while (i < line.size() && !isspace(static_cast<unsigned char>(line[i]))) {
+                            ++i;
+                        }
+                    }
+                    fields.push_back(line.substr(start, i - start));
+                }
+                return fields;
+            }
+
+            // Collects the config files and module paths of the stack in path.
+            void read_config(const std::string& path, int depth, std::vector<std::string>& files, std::vector<std::string>& modules) {
+                if (depth > max_include_depth || std::find(files.begin(), files.end(), path) != files.end()) {
+                    return;
+                }
+                files.push_back(path);
+
+                std::ifstream config(path);
+                if (!config) {
+                    logf(log_verbosity::normal, "Error: Can't read PAM config %s\n", path.c_str());
+                    return;
+                }
+
+                std::string line, logical;
+                while (std::getline(config, line)) {
+                    // A backslash at the end of a line continues it on the next.
+                    if (!line.empty() && line.back() == '\\') {
+                        logical += line.substr(0, line.size() - 1) + " ";
+                        continue;
+                    }
+                    logical += line;
+                    std::string text = logical.substr(0, logical.find('#'));
+                    logical.clear();
+
+                    std::vector<std::string> fields = split_fields(text);
+                    if (fields.empty()) {
+                        continue;
+                    }
+                    if (fields[0] == "@include") {
+                        if (fields.size() > 1) {
+                            read_config(config_path(fields[1]), depth + 1, files, modules);
+                        }
+                        continue;
+                    }
+                    if (fields.size() < 3) {
+                        continue;
+                    }
+                    if (fields[1] == "include" || fields[1] == "substack") {
+                        read_config(config_path(fields[2]), depth + 1, files, modules);
+                        continue;
+                    }
+
+                    std::string module = fields[2];
+                    if (module[0] != '/') {
+                        module = module_dir() + "/" + module;
+                    }
+                    if (std::find(modules.begin(), modules.end(), module) == modules.end()) {
+                        modules.push_back(module);
+                    }
+                }
+            }
+
+            void watch_configs_locked() {
+#ifndef _APPLE
+                if (inotify_fd != -1) {
+                    close(inotify_fd);
+                }
+                inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+                if (inotify_fd == -1) {
+                    logf(log_verbosity::normal, "Error [inotify_init1]: %s, PAM config changes won't be noticed\n", strerror(errno));
+                    return;
+                }
+
+                // Directories rather than files, since editors and package managers replace
+                // config files by rename.
+                std::vector<std::string> dirs;
+                for (const std::string& file : config_files) {
+                    std::string dir = fs::path(file).parent_path().string();
+                    if (std::find(dirs.begin(), dirs.end(), dir) == dirs.end()) {
+                        dirs.push_back(dir);
+                        if (inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE | IN_DELETE) == -1) {
+                            logf(log_verbosity::normal, "Error [inotify_add_watch]: %s: %s\n", dir.c_str(), strerror(errno));
+                        }
+                    }
+                }
+#endif
+            }
+
+            void load_locked() {
+                std::vector<std::string> files, modules;
+                read_config(config_path(stack_service), 0, files, modules);
+
+                // The new modules are loaded before the old ones are released, so that
+                // modules in both stay loaded throughout.
+                std::vector<void*> handles;
+                for (const std::string& module : modules) {
+                    void* handle = dlopen(module.c_str(), RTLD_NOW);
+                    if (handle) {
+                        handles.push_back(handle);
+                    } else {
+                        // pam_start will fail or skip it in the same way; nothing to do here.
+                        logf(log_verbosity::normal, "Error [dlopen]: %s\n", dlerror());
+                    }
+                }
+                for (void* handle : loaded_modules) {
+                    dlclose(handle);
+                }
+
+                loaded_modules.swap(handles);
+                config_files.swap(files);
+                watch_configs_locked();
+                logf(log_verbosity::normal, "Preloaded %zu PAM modules from %zu config files for service %s.\n",
+                     loaded_modules.size(), config_files.size(), stack_service.c_str());
+            }
+
+            // Whether anything happened to one of the config files since the last call.
+            bool configs_changed_locked() {
+#ifndef _APPLE
+                if (inotify_fd == -1) {
+                    return false;
+                }
+
+                bool changed = false;
+                alignas(inotify_event) char buf[4096];
+                ssize_t n;
+                while ((n = read(inotify_fd, buf, sizeof buf)) > 0) {
+                    for (char* p = buf; p < buf + n;) {
+                        auto ev = reinterpret_cast<inotify_event*>(p);
+                        if (ev->len > 0) {
+                            for (const std::string& file : config_files) {
+                                if (fs::path(file).filename() == ev->name) {
+                                    changed = true;
+                                }
+                            }
+                        }
+                        p += sizeof(inotify_event) + ev->len;
+                    }
+                }
+                return changed;
+#else
+                return false;
+#endif
+            }
+        }
+
+        void preload(const std::string& service) {
+            std::lock_guard<std::mutex> lock(stack_mutex);
+            stack_service = service;
+            load_locked();
+        }
+
+        void refresh() {
+            std::lock_guard<std::mutex> lock(stack_mutex);
+            if (stack_service.empty() || !configs_changed_locked()) {
+                return;
+            }
+
+            logf(log_verbosity::normal, "PAM config for service %s changed, loading it again.\n", stack_service.c_str());
+            load_locked();
+        }
+
+    }
+}
@@ -0,0 +1,40 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace pam_stack {
+        // Reads the PAM config of service (/etc/pam.d/<service>, following @include, include
+        // and substack) and loads every module it lists, keeping them loaded for the life of
+        // the process. pam_start still reads the config and dlopens the modules for every
+        // transaction, but they are then already mapped and relocated, and whatever they
+        // initialize once per load stays initialized. Meant for long-lived helpers only.
+        void preload(const std::string& service);
+
+        // Loads the stack again if any of its config files changed since it was last read.
+        // Cheap enough to call before every pam_start.
+        void refresh();
+    }
+}
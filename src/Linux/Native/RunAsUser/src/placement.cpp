@@ -0,0 +1,219 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "placement.h"
+#include "log.h"
+
+using namespace rau::log;
+
+namespace rau {
+    namespace placement {
+#ifndef _APPLE
+        namespace {
+            constexpr char node_dir[] = "/sys/devices/system/node";
+
+            struct node {
+                int id;
+                cpu_set_t cpus;
+                std::string cpu_list;
+            };
+
+            std::atomic<policy> current_default{ policy::none };
+
+            // Parses a kernel CPU list such as "0-3,8,10-11".
+            bool parse_cpu_list(const std::string& text, cpu_set_t& cpus) {
+                CPU_ZERO(&cpus);
+                const char* p = text.c_str();
+                bool any = false;
+                while (*p) {
+                    char* end;
+                    unsigned long first = strtoul(p, &end, 10), last = first;
+                    if (end == p) {
+                        return false;
+                    }
+                    p = end;
+                    if (*p == '-') {
+                        last = strtoul(++p, &end, 10);
+                        if (end == p || last < first) {
+                            return false;
+                        }
+                        p = end;
+                    }
+                    if (last >= CPU_SETSIZE) {
+                        return false;
+                    }
+                    for (unsigned long cpu = first; cpu <= last; ++cpu) {
+                        CPU_SET(cpu, &cpus);
+                        any = true;
+                    }
+                    if (*p == ',') {
+                        ++p;
+                    } else if (*p && *p != '\n') {
+                        return false;
+                    } else {
+                        break;
+                    }
+                }
+                return any;
+            }
+
+            std::string read_line(const std::string& path) {
+                std::ifstream file(path);
+                std::string line;
+                std::getline(file, line);
+                return line;
+            }
+
+            // Nodes with CPUs; a machine without NUMA support shows up as node 0.
+            const std::vector<node>& topology() {
+                static std::vector<node> nodes = [] {
+                    std::vector<node> result;
+                    boost::system::error_code ec;
+                    for (fs::directory_iterator it(node_dir, ec), end; !ec && it != end; it.increment(ec)) {
+                        std::string name = it->path().filename().string();
+                        if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !isdigit(static_cast<unsigned char>(name[4]))) {
+                            continue;
+                        }
+                        node n;
+                        n.id = atoi(name.c_str() + 4);
+                        n.cpu_list = read_line(it->path().string() + "/cpulist");
+                        if (parse_cpu_list(n.cpu_list, n.cpus)) {
+                            result.push_back(n);
+                        }
+                    }
+                    std::sort(result.begin(), result.end(), [](const node& a, const node& b) { return a.id < b.id; });
+                    logf(log_verbosity::normal, "Found %zu NUMA nodes with CPUs.\n", result.size());
+                    return result;
+                }();
+                return nodes;
+            }
+
+            // MemFree of a node in kB, 0 if it can't be read.
+            uint64_t free_memory(int id) {
+                std::ifstream meminfo(std::string(node_dir) + "/node" + std::to_string(id) + "/meminfo");
+                std::string line;
+                while (std::getline(meminfo, line)) {
+                    size_t pos = line.find("MemFree:");
+                    if (pos != std::string::npos) {
+                        return strtoull(line.c_str() + pos + 8, nullptr, 10);
+                    }
+                }
+                return 0;
+            }
+
+            const node* pick(policy p, const std::vector<node>& nodes) {
+                if (nodes.empty()) {
+                    return nullptr;
+                }
+                switch (p) {
+                case policy::round_robin: {
+                    // One-shot helpers start from their pid, so that consecutive ones still take
+                    // turns.
+                    static std::atomic<size_t> next{ static_cast<size_t>(getpid()) };
+                    return &nodes[next++ % nodes.size()];
+                }
+                case policy::least_loaded: {
+                    const node* best = nullptr;
+                    uint64_t best_free = 0;
+                    for (const node& n : nodes) {
+                        uint64_t free = free_memory(n.id);
+                        if (!best || free > best_free) {
+                            best = &n;
+                            best_free = free;
+                        }
+                    }
+                    return best;
+                }
+                default:
+                    return nullptr;
+                }
+            }
+        }
+#endif
+
+        bool parse_policy(const std::string& name, policy& out) {
+            if (name == "none") {
+                out = policy::none;
+            } else if (name == "round-robin") {
+                out = policy::round_robin;
+            } else if (name == "least-loaded") {
+                out = policy::least_loaded;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+#ifndef _APPLE
+        void set_default_policy(policy p) {
+            current_default = p;
+        }
+
+        policy default_policy() {
+            return current_default;
+        }
+
+        bool choose(const request& req, choice& out) {
+            const std::vector<node>& nodes = topology();
+            out = choice();
+
+            const node* chosen = nullptr;
+            if (req.node >= 0) {
+                auto it = std::find_if(nodes.begin(), nodes.end(), [&req](const node& n) { return n.id == req.node; });
+                if (it == nodes.end()) {
+                    return false;
+                }
+                chosen = &*it;
+            } else if (req.cpus.empty()) {
+                chosen = pick(req.policy, nodes);
+            }
+
+            if (chosen) {
+                out.node = chosen->id;
+                out.bind_memory = req.bind_memory;
+                out.cpus = chosen->cpus;
+                out.cpu_list = chosen->cpu_list;
+            }
+            if (!req.cpus.empty()) {
+                if (!parse_cpu_list(req.cpus, out.cpus)) {
+                    return false;
+                }
+                out.cpu_list = req.cpus;
+            }
+            return true;
+        }
+#else
+        void set_default_policy(policy p) {
+        }
+
+        policy default_policy() {
+            return policy::none;
+        }
+
+        bool choose(const request& req, choice& out) {
+            out = choice();
+            return req.node < 0 && req.cpus.empty();
+        }
+#endif
+    }
+}
@@ -0,0 +1,73 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace placement {
+        // How a host is given a NUMA node when the request doesn't name one.
+        enum class policy {
+            // Runs wherever the scheduler puts it, as before.
+            none,
+            // Nodes in turn.
+            round_robin,
+            // The node with the most free memory.
+            least_loaded
+        };
+
+        bool parse_policy(const std::string& name, policy& out);
+
+        // Sets the policy for requests that don't pick one; -n on the command line.
+        void set_default_policy(policy p);
+
+        policy default_policy();
+
+        // What the "placement" object of AuthAndRun asks for.
+        struct request {
+            placement::policy policy = default_policy();
+            // Explicit node; -1 to pick one by policy.
+            int node = -1;
+            // Explicit CPU list such as "0-3,8"; empty for the CPUs of the node.
+            std::string cpus;
+            // MPOL_BIND instead of MPOL_PREFERRED for the node's memory.
+            bool bind_memory = false;
+        };
+
+        // Where a host runs.
+        struct choice {
+            // -1 if the host's memory policy is left alone.
+            int node = -1;
+            bool bind_memory = false;
+            // Empty if the host's affinity is left alone.
+            std::string cpu_list;
+#ifndef _APPLE
+            cpu_set_t cpus;
+#endif
+        };
+
+        // Resolves req against the machine's topology, which is read once from
+        // /sys/devices/system/node. Returns false if the node or CPU list doesn't exist here.
+        bool choose(const request& req, choice& out);
+    }
+}
@@ -0,0 +1,167 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "policy.h"
+#include "log.h"
+
+using namespace rau::log;
+
+namespace rau {
+    namespace policy {
+        namespace {
+            typedef std::chrono::steady_clock clock;
+
+            // Specs come from clients, so a long-lived helper keeps only this many of them.
+            constexpr size_t max_policies = 256;
+
+            constexpr char user_prefix[] = "user:";
+            constexpr char group_prefix[] = "group:";
+
+            struct compiled_policy {
+                std::shared_ptr<const access_policy> policy;
+                uint64_t nss_generation;
+                clock::time_point expires;
+            };
+
+            std::mutex policies_mutex;
+            std::unordered_map<std::string, compiled_policy> policies;
+
+            bool starts_with(const std::string& s, const char* prefix) {
+                return s.compare(0, strlen(prefix), prefix) == 0;
+            }
+
+            std::string trim(const std::string& s) {
+                auto first = s.find_first_not_of(" \t");
+                if (first == std::string::npos) {
+                    return std::string();
+                }
+                return s.substr(first, s.find_last_not_of(" \t") - first + 1);
+            }
+        }
+
+        access_policy::access_policy(const std::string& spec)
+            : _has_allow_entries(false)
+            , _has_group_entries(false)
+            , _has_unresolved_denies(false) {
+            std::string::size_type start = 0;
+            while (start <= spec.size()) {
+                auto end = spec.find(',', start);
+                if (end == std::string::npos) {
+                    end = spec.size();
+                }
+                std::string entry = trim(spec.substr(start, end - start));
+                start = end + 1;
+
+                if (entry.empty()) {
+                    continue;
+                }
+
+                bool deny = entry[0] == '!';
+                if (deny) {
+                    entry = trim(entry.substr(1));
+                } else {
+                    _has_allow_entries = true;
+                }
+
+                if (starts_with(entry, user_prefix)) {
+                    std::string name = entry.substr(strlen(user_prefix));
+                    nss::user_entry user;
+                    if (nss::find_user(name, user)) {
+                        (deny ? _denied_uids : _allowed_uids).insert(user.uid);
+                    } else {
+                        logf(log_verbosity::minimal, "Error: Unknown user [%s] in access policy\n", name.c_str());
+                        _has_unresolved_denies = _has_unresolved_denies || deny;
+                    }
+                } else {
+                    std::string name = starts_with(entry, group_prefix) ? entry.substr(strlen(group_prefix)) : entry;
+                    _has_group_entries = true;
+                    nss::group_entry group;
+                    if (nss::find_group(name, group)) {
+                        (deny ? _denied_gids : _allowed_gids).insert(group.gid);
+                    } else {
+                        logf(log_verbosity::minimal, "Error: Unknown group [%s] in access policy\n", name.c_str());
+                        _has_unresolved_denies = _has_unresolved_denies || deny;
+                    }
+                }
+            }
+        }
+
+        bool access_policy::allows(const nss::user_entry& user, const std::vector<gid_t>& groups) const {
+            if (_has_unresolved_denies || _denied_uids.count(user.uid)) {
+                return false;
+            }
+
+            bool allowed = !_has_allow_entries || _allowed_uids.count(user.uid);
+            if (_has_group_entries) {
+                for (gid_t gid : groups) {
+                    if (_denied_gids.count(gid)) {
+                        return false;
+                    }
+                    allowed = allowed || _allowed_gids.count(gid);
+                }
+            }
+
+            return allowed;
+        }
+
+        std::shared_ptr<const access_policy> get_policy(const std::string& spec) {
+            uint64_t generation = nss::get_cache_counters().invalidations;
+            auto now = clock::now();
+
+            {
+                std::lock_guard<std::mutex> lock(policies_mutex);
+                auto it = policies.find(spec);
+                if (it != policies.end() && it->second.nss_generation == generation && it->second.expires > now) {
+                    return it->second.policy;
+                }
+            }
+
+            auto policy = std::make_shared<const access_policy>(spec);
+
+            std::lock_guard<std::mutex> lock(policies_mutex);
+            policies.erase(spec);
+            if (!policy->resolved()) {
+                return policy;
+            }
+
+            if (policies.size() >= max_policies) {
+                // Stale entries go first; if there are none, the one compiled longest ago.
+                for (auto it = policies.begin(); it != policies.end();) {
+                    if (it->second.nss_generation != generation || it->second.expires <= now) {
+                        it = policies.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                if (policies.size() >= max_policies) {
+                    policies.erase(std::min_element(policies.begin(), policies.end(), [](const std::pair<const std::string, compiled_policy>& a, const std::pair<const std::string, compiled_policy>& b) {
+                        return a.second.expires < b.second.expires;
+                    }));
+                }
+            }
+            policies[spec] = { policy, generation, now + nss::get_cache_ttl() };
+            return policy;
+        }
+    }
+}
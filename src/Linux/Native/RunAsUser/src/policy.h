@@ -0,0 +1,75 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "nss_cache.h"
+
+namespace rau {
+    namespace policy {
+        // Who may authenticate, compiled from a comma separated list of entries:
+        //
+        //   name | group:name   members of group name are allowed
+        //   user:name          user name is allowed
+        //   !group:name, !name members of group name are denied
+        //   !user:name         user name is denied
+        //
+        // Denies win over allows. A policy without allow entries allows everyone who
+        // isn't denied; the empty policy allows everyone. A single group name is the
+        // original allowedGroup syntax. Names are resolved to ids when the policy is
+        // compiled, and names that don't resolve are logged. An allow entry that doesn't
+        // resolve is ignored; a deny entry that doesn't resolve denies everyone, since a
+        // directory service that is briefly unreachable mustn't widen access.
+        class access_policy {
+        public:
+            explicit access_policy(const std::string& spec);
+
+            // Whether the user's groups have to be looked up to evaluate the policy.
+            bool needs_groups() const {
+                return _has_group_entries;
+            }
+
+            // Whether every deny entry resolved; a policy where one didn't allows no one.
+            bool resolved() const {
+                return !_has_unresolved_denies;
+            }
+
+            // groups is the user's full group list (primary group included) and is only
+            // looked at when needs_groups() is true.
+            bool allows(const nss::user_entry& user, const std::vector<gid_t>& groups) const;
+
+        private:
+            bool _has_allow_entries;
+            bool _has_group_entries;
+            bool _has_unresolved_denies;
+            std::unordered_set<uid_t> _allowed_uids, _denied_uids;
+            std::unordered_set<gid_t> _allowed_gids, _denied_gids;
+        };
+
+        // Returns the compiled policy for spec, compiling it only if it hasn't been seen
+        // since passwd/group data last changed or the NSS cache TTL passed. A policy that
+        // didn't fully resolve isn't kept, so the next request tries again. At most 256
+        // policies are kept; stale ones, then the oldest, make room for new ones.
+        std::shared_ptr<const access_policy> get_policy(const std::string& spec);
+    }
+}
@@ -0,0 +1,171 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+
+#include "stdafx.h"
+#include "process.h"
+
+namespace rau {
+    namespace process {
+        namespace {
+            struct named_signal {
+                const char* name;
+                int signal;
+            };
+
+            const named_signal known_signals[] = {
+                { "SIGHUP", SIGHUP },
+                { "SIGINT", SIGINT },
+                { "SIGQUIT", SIGQUIT },
+                { "SIGKILL", SIGKILL },
+                { "SIGUSR1", SIGUSR1 },
+                { "SIGUSR2", SIGUSR2 },
+                { "SIGTERM", SIGTERM },
+            };
+
+            // How often the fallback path checks whether the process is still there.
+            constexpr std::chrono::milliseconds poll_interval(10);
+
+            // A process handle that is a pidfd where available and a plain pid otherwise.
+            class process_handle {
+            public:
+                explicit process_handle(pid_t pid)
+                    : _pid(pid), _fd(-1) {
+#if !defined(_APPLE) && defined(SYS_pidfd_open) && defined(SYS_pidfd_send_signal)
+                    _fd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#endif
+                }
+
+                ~process_handle() {
+                    if (_fd != -1) {
+                        close(_fd);
+                    }
+                }
+
+                process_handle(const process_handle&) = delete;
+                process_handle& operator=(const process_handle&) = delete;
+
+                bool exists() const {
+                    return _fd != -1 || kill(_pid, 0) == 0 || errno != ESRCH;
+                }
+
+                bool send(int signal) {
+#if !defined(_APPLE) && defined(SYS_pidfd_send_signal)
+                    if (_fd != -1) {
+                        return syscall(SYS_pidfd_send_signal, _fd, signal, nullptr, 0) == 0;
+                    }
+#endif
+                    return kill(_pid, signal) == 0;
+                }
+
+                // Waits up to timeout for the process to exit. Returns true if it did.
+                bool wait_exit(std::chrono::milliseconds timeout) {
+                    auto deadline = std::chrono::steady_clock::now() + timeout;
+                    for (;;) {
+                        auto now = std::chrono::steady_clock::now();
+                        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+                        if (_fd != -1) {
+                            // A pidfd becomes readable once the process has exited, whether or
+                            // not it is our child.
+                            pollfd pfd = { _fd, POLLIN, 0 };
+                            int result = poll(&pfd, 1, left.count() > 0 ? static_cast<int>(left.count()) : 0);
+                            if (result > 0) {
+                                return true;
+                            }
+                            if (result == 0 || errno != EINTR) {
+                                return false;
+                            }
+                        } else {
+                            if (kill(_pid, 0) == -1 && errno == ESRCH) {
+                                return true;
+                            }
+                            if (left.count() <= 0) {
+                                return false;
+                            }
+                            std::this_thread::sleep_for(std::min(left, poll_interval));
+                        }
+                    }
+                }
+
+            private:
+                pid_t _pid;
+                int _fd;
+            };
+        }
+
+        std::vector<kill_step> default_kill_sequence() {
+            return { { SIGKILL, std::chrono::milliseconds(0) } };
+        }
+
+        int signal_from_name(const std::string& name) {
+            for (const named_signal& known : known_signals) {
+                if (name == known.name || name == known.name + 3) {
+                    return known.signal;
+                }
+            }
+            return 0;
+        }
+
+        const char* signal_name(int signal) {
+            for (const named_signal& known : known_signals) {
+                if (signal == known.signal) {
+                    return known.name;
+                }
+            }
+            return "";
+        }
+
+        int terminate_process(pid_t pid, const std::vector<kill_step>& steps, kill_outcome& outcome) {
+            outcome = kill_outcome();
+            if (pid <= 0) {
+                // kill() would signal a whole process group for these.
+                return EINVAL;
+            }
+
+            process_handle process(pid);
+            if (!process.exists()) {
+                return ESRCH;
+            }
+
+            for (size_t i = 0; i < steps.size(); ++i) {
+                if (!process.send(steps[i].signal)) {
+                    int err = errno;
+                    if (err == ESRCH && outcome.step >= 0) {
+                        // Exited between the previous step's timeout and this signal.
+                        outcome.exited = true;
+                        return 0;
+                    }
+                    return err;
+                }
+
+                outcome.step = static_cast<int>(i);
+                if (steps[i].timeout.count() > 0 && process.wait_exit(steps[i].timeout)) {
+                    outcome.exited = true;
+                    return 0;
+                }
+            }
+
+            return steps.empty() || steps.back().timeout.count() == 0 ? 0 : ETIMEDOUT;
+        }
+    }
+}
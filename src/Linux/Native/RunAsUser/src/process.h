@@ -0,0 +1,57 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace process {
+        struct kill_step {
+            int signal;
+            // How long to wait for the process to exit before moving on to the next step.
+            // Zero means the signal is sent without waiting.
+            std::chrono::milliseconds timeout;
+        };
+
+        struct kill_outcome {
+            // Index of the last step whose signal was delivered, or -1.
+            int step = -1;
+            // True if the process was seen to exit within that step's timeout.
+            bool exited = false;
+        };
+
+        // Same behavior as the old "kill -9 <pid>".
+        std::vector<kill_step> default_kill_sequence();
+
+        // Returns the signal number for names like "SIGTERM" or "TERM", or 0 if unknown.
+        int signal_from_name(const std::string& name);
+        const char* signal_name(int signal);
+
+        // Sends the signals in steps to pid, stopping as soon as the process exits. Signals are
+        // delivered through a pidfd where the kernel supports it, so a recycled pid can't be hit
+        // by a later step. Returns 0 if the process exited or the last signal was delivered,
+        // ESRCH if there was no such process to begin with, ETIMEDOUT if it outlived the last
+        // step's timeout, or the errno of the failed call.
+        int terminate_process(pid_t pid, const std::vector<kill_step>& steps, kill_outcome& outcome);
+    }
+}
@@ -0,0 +1,1177 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "request.h"
+
+namespace rau {
+    namespace request {
+        namespace {
+            // Every key and message name the helper knows about.
+            enum class token {
+                none,
+                name,
+                username,
+                password,
+                arguments,
+                environment,
+                working_directory,
+                allowed_group,
+                process_id,
+                signals,
+                encoding,
+                timing,
+                signal,
+                timeout,
+                auth_only,
+                auth_and_run,
+                kill_process,
+                set_encoding,
+                stats,
+                entries,
+                auth_only_batch,
+                request_id,
+                cgroup,
+                scope,
+                cpu_weight,
+                io_weight,
+                memory_high,
+                memory_max,
+                placement,
+                policy,
+                numa_node,
+                cpus,
+                memory_policy
+            };
+
+            struct keyword {
+                const char* text;
+                size_t length;
+                token value;
+            };
+
+            constexpr keyword keywords[] = {
+                { "name", 4, token::name },
+                { "username", 8, token::username },
+                { "password", 8, token::password },
+                { "arguments", 9, token::arguments },
+                { "environment", 11, token::environment },
+                { "workingDirectory", 16, token::working_directory },
+                { "allowedGroup", 12, token::allowed_group },
+                { "processId", 9, token::process_id },
+                { "signals", 7, token::signals },
+                { "encoding", 8, token::encoding },
+                { "timing", 6, token::timing },
+                { "signal", 6, token::signal },
+                { "timeout", 7, token::timeout },
+                { "AuthOnly", 8, token::auth_only },
+                { "AuthAndRun", 10, token::auth_and_run },
+                { "KillProcess", 11, token::kill_process },
+                { "SetEncoding", 11, token::set_encoding },
+                { "Stats", 5, token::stats },
+                { "entries", 7, token::entries },
+                { "AuthOnlyBatch", 13, token::auth_only_batch },
+                { "requestId", 9, token::request_id },
+                { "cgroup", 6, token::cgroup },
+                { "scope", 5, token::scope },
+                { "cpuWeight", 9, token::cpu_weight },
+                { "ioWeight", 8, token::io_weight },
+                { "memoryHigh", 10, token::memory_high },
+                { "memoryMax", 9, token::memory_max },
+                { "placement", 9, token::placement },
+                { "policy", 6, token::policy },
+                { "numaNode", 8, token::numa_node },
+                { "cpus", 4, token::cpus },
+                { "memoryPolicy", 12, token::memory_policy },
+            };
+
+            constexpr size_t keyword_count = sizeof keywords / sizeof keywords[0];
+            constexpr size_t keyword_slots = 128;
+
+            // Length, first and last character are enough to tell all keywords apart; the
+            // static_assert below fails the build if a new keyword collides.
+            constexpr size_t keyword_hash(const char* s, size_t length) {
+                return (length + 5 * static_cast<unsigned char>(s[0]) + 17 * static_cast<unsigned char>(s[length - 1])) % keyword_slots;
+            }
+
+            struct keyword_table {
+                // Index into keywords plus one; 0 for an empty slot.
+                uint8_t slots[keyword_slots];
+                bool perfect;
+            };
+
+            constexpr keyword_table build_keyword_table() {
+                keyword_table table = {};
+                table.perfect = true;
+                for (size_t i = 0; i < keyword_count; ++i) {
+                    size_t slot = keyword_hash(keywords[i].text, keywords[i].length);
+                    if (table.slots[slot] != 0) {
+                        table.perfect = false;
+                    }
+                    table.slots[slot] = static_cast<uint8_t>(i + 1);
+                }
+                return table;
+            }
+
+            constexpr keyword_table keyword_lookup = build_keyword_table();
+            static_assert(keyword_lookup.perfect, "Keyword hash collision; change the multipliers in keyword_hash.");
+
+            token find_keyword(boost::string_ref s) {
+                if (s.empty()) {
+                    return token::none;
+                }
+                size_t index = keyword_lookup.slots[keyword_hash(s.data(), s.size())];
+                if (index == 0) {
+                    return token::none;
+                }
+                const keyword& k = keywords[index - 1];
+                return k.length == s.size() && memcmp(k.text, s.data(), s.size()) == 0 ? k.value : token::none;
+            }
+
+            message_type message_type_of(token t) {
+                switch (t) {
+                case token::auth_only:
+                    return message_type::auth_only;
+                case token::auth_and_run:
+                    return message_type::auth_and_run;
+                case token::kill_process:
+                    return message_type::kill_process;
+                case token::set_encoding:
+                    return message_type::set_encoding;
+                case token::stats:
+                    return message_type::stats;
+                case token::auth_only_batch:
+                    return message_type::auth_only_batch;
+                default:
+                    return message_type::unknown;
+                }
+            }
+
+            enum class value_kind {
+                invalid,
+                null,
+                boolean,
+                number,
+                string,
+                array,
+                object
+            };
+
+            // Iteration state of an array or object being read.
+            struct container {
+                bool first;
+                uint32_t remaining;
+            };
+
+            constexpr int max_depth = 32;
+
+            // Pull reader over a JSON text. Strings are unescaped in place, so every string it
+            // returns points into the text.
+            class json_reader {
+            public:
+                json_reader(char* begin, char* end)
+                    : _begin(begin), _p(begin), _end(end), _error(nullptr) {}
+
+                value_kind peek() {
+                    skip_whitespace();
+                    if (_p == _end) {
+                        fail("unexpected end of input");
+                        return value_kind::invalid;
+                    }
+                    switch (*_p) {
+                    case '"':
+                        return value_kind::string;
+                    case '[':
+                        return value_kind::array;
+                    case '{':
+                        return value_kind::object;
+                    case 't':
+                    case 'f':
+                        return value_kind::boolean;
+                    case 'n':
+                        return value_kind::null;
+                    case '-':
+                    case '0': case '1': case '2': case '3': case '4':
+                    case '5': case '6': case '7': case '8': case '9':
+                        return value_kind::number;
+                    default:
+                        fail("unexpected character");
+                        return value_kind::invalid;
+                    }
+                }
+
+                bool read_string(boost::string_ref& out) {
+                    char* start = ++_p;
+                    char* w = start;
+                    while (_p < _end) {
+                        char c = *_p++;
+                        if (c == '"') {
+                            out = boost::string_ref(start, w - start);
+                            return true;
+                        } else if (c == '\\') {
+                            if (!unescape(w)) {
+                                return false;
+                            }
+                        } else if (static_cast<unsigned char>(c) < 0x20) {
+                            return fail("control character in string");
+                        } else {
+                            *w++ = c;
+                        }
+                    }
+                    return fail("unterminated string");
+                }
+
+                bool read_number(double& out) {
+                    const char* start = _p;
+                    if (_p < _end && *_p == '-') {
+                        ++_p;
+                    }
+                    if (_p < _end && *_p == '0') {
+                        ++_p;
+                    } else if (!digits()) {
+                        return fail("invalid number");
+                    }
+                    if (_p < _end && *_p == '.') {
+                        ++_p;
+                        if (!digits()) {
+                            return fail("invalid number");
+                        }
+                    }
+                    if (_p < _end && (*_p == 'e' || *_p == 'E')) {
+                        ++_p;
+                        if (_p < _end && (*_p == '+' || *_p == '-')) {
+                            ++_p;
+                        }
+                        if (!digits()) {
+                            return fail("invalid number");
+                        }
+                    }
+
+                    // The frame isn't null terminated where the number ends.
+                    char buf[64];
+                    size_t length = _p - start;
+                    if (length >= sizeof buf) {
+                        return fail("number too long");
+                    }
+                    memcpy(buf, start, length);
+                    buf[length] = '\0';
+                    out = strtod(buf, nullptr);
+                    return true;
+                }
+
+                bool read_bool(bool& out) {
+                    if (literal("true")) {
+                        out = true;
+                        return true;
+                    }
+                    if (literal("false")) {
+                        out = false;
+                        return true;
+                    }
+                    return fail("invalid literal");
+                }
+
+                bool enter_array(container& c) {
+                    ++_p;
+                    c.first = true;
+                    return true;
+                }
+
+                bool next_item(container& c, bool& more) {
+                    skip_whitespace();
+                    if (_p == _end) {
+                        return fail("unexpected end of input");
+                    }
+                    // A trailing comma is caught when the value after it is read.
+                    if (*_p == ']') {
+                        ++_p;
+                        more = false;
+                        return true;
+                    }
+                    if (!c.first) {
+                        if (*_p != ',') {
+                            return fail("expected ',' or ']'");
+                        }
+                        ++_p;
+                    }
+                    c.first = false;
+                    more = true;
+                    return true;
+                }
+
+                bool enter_object(container& c) {
+                    ++_p;
+                    c.first = true;
+                    return true;
+                }
+
+                bool next_member(container& c, boost::string_ref& key, bool& more) {
+                    skip_whitespace();
+                    if (_p == _end) {
+                        return fail("unexpected end of input");
+                    }
+                    if (*_p == '}') {
+                        ++_p;
+                        more = false;
+                        return true;
+                    }
+                    if (!c.first) {
+                        if (*_p != ',') {
+                            return fail("expected ',' or '}'");
+                        }
+                        ++_p;
+                        skip_whitespace();
+                    }
+                    c.first = false;
+
+                    if (_p == _end || *_p != '"') {
+                        return fail("expected member name");
+                    }
+                    if (!read_string(key)) {
+                        return false;
+                    }
+                    skip_whitespace();
+                    if (_p == _end || *_p != ':') {
+                        return fail("expected ':'");
+                    }
+                    ++_p;
+                    more = true;
+                    return true;
+                }
+
+                bool skip(int depth) {
+                    if (depth > max_depth) {
+                        return fail("nesting too deep");
+                    }
+
+                    boost::string_ref s;
+                    double d;
+                    container c;
+                    bool more;
+                    switch (peek()) {
+                    case value_kind::string:
+                        return read_string(s);
+                    case value_kind::number:
+                        return read_number(d);
+                    case value_kind::boolean: {
+                        bool b;
+                        return read_bool(b);
+                    }
+                    case value_kind::null:
+                        return literal("null") || fail("invalid literal");
+                    case value_kind::array:
+                        enter_array(c);
+                        while (next_item(c, more)) {
+                            if (!more) {
+                                return true;
+                            }
+                            if (!skip(depth + 1)) {
+                                return false;
+                            }
+                        }
+                        return false;
+                    case value_kind::object:
+                        enter_object(c);
+                        while (next_member(c, s, more)) {
+                            if (!more) {
+                                return true;
+                            }
+                            if (!skip(depth + 1)) {
+                                return false;
+                            }
+                        }
+                        return false;
+                    default:
+                        return false;
+                    }
+                }
+
+                bool finish() {
+                    skip_whitespace();
+                    return _p == _end || fail("unexpected data after the request");
+                }
+
+                std::string error() const {
+                    return std::string(_error ? _error : "syntax error") + " at offset " + std::to_string(_p - _begin);
+                }
+
+            private:
+                bool fail(const char* error) {
+                    if (!_error) {
+                        _error = error;
+                    }
+                    return false;
+                }
+
+                void skip_whitespace() {
+                    while (_p < _end && (*_p == ' ' || *_p == '\t' || *_p == '\n' || *_p == '\r')) {
+                        ++_p;
+                    }
+                }
+
+                bool digits() {
+                    const char* start = _p;
+                    while (_p < _end && *_p >= '0' && *_p <= '9') {
+                        ++_p;
+                    }
+                    return _p != start;
+                }
+
+                bool literal(const char* text) {
+                    size_t length = strlen(text);
+                    if (static_cast<size_t>(_end - _p) >= length && memcmp(_p, text, length) == 0) {
+                        _p += length;
+                        return true;
+                    }
+                    return false;
+                }
+
+                bool hex4(unsigned& value) {
+                    if (_end - _p < 4) {
+                        return fail("invalid \\u escape");
+                    }
+                    value = 0;
+                    for (int i = 0; i < 4; ++i) {
+                        char c = *_p++;
+                        value <<= 4;
+                        if (c >= '0' && c <= '9') {
+                            value |= c - '0';
+                        } else if (c >= 'a' && c <= 'f') {
+                            value |= c - 'a' + 10;
+                        } else if (c >= 'A' && c <= 'F') {
+                            value |= c - 'A' + 10;
+                        } else {
+                            return fail("invalid \\u escape");
+                        }
+                    }
+                    return true;
+                }
+
+                // Writes the character for the escape at _p to w. The result is never longer
+                // than the escape, so w can't overtake _p.
+                bool unescape(char*& w) {
+                    if (_p == _end) {
+                        return fail("unterminated string");
+                    }
+                    switch (*_p++) {
+                    case '"': *w++ = '"'; return true;
+                    case '\\': *w++ = '\\'; return true;
+                    case '/': *w++ = '/'; return true;
+                    case 'b': *w++ = '\b'; return true;
+                    case 'f': *w++ = '\f'; return true;
+                    case 'n': *w++ = '\n'; return true;
+                    case 'r': *w++ = '\r'; return true;
+                    case 't': *w++ = '\t'; return true;
+                    case 'u': break;
+                    default: return fail("invalid escape");
+                    }
+
+                    unsigned cp;
+                    if (!hex4(cp)) {
+                        return false;
+                    }
+                    if (cp >= 0xDC00 && cp < 0xE000) {
+                        return fail("unpaired surrogate");
+                    }
+                    if (cp >= 0xD800 && cp < 0xDC00) {
+                        unsigned low;
+                        if (_end - _p < 2 || _p[0] != '\\' || _p[1] != 'u') {
+                            return fail("unpaired surrogate");
+                        }
+                        _p += 2;
+                        if (!hex4(low)) {
+                            return false;
+                        }
+                        if (low < 0xDC00 || low >= 0xE000) {
+                            return fail("unpaired surrogate");
+                        }
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+
+                    if (cp < 0x80) {
+                        *w++ = static_cast<char>(cp);
+                    } else if (cp < 0x800) {
+                        *w++ = static_cast<char>(0xC0 | (cp >> 6));
+                        *w++ = static_cast<char>(0x80 | (cp & 0x3F));
+                    } else if (cp < 0x10000) {
+                        *w++ = static_cast<char>(0xE0 | (cp >> 12));
+                        *w++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                        *w++ = static_cast<char>(0x80 | (cp & 0x3F));
+                    } else {
+                        *w++ = static_cast<char>(0xF0 | (cp >> 18));
+                        *w++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                        *w++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                        *w++ = static_cast<char>(0x80 | (cp & 0x3F));
+                    }
+                    return true;
+                }
+
+                const char* _begin;
+                char* _p;
+                const char* _end;
+                const char* _error;
+            };
+
+            // Pull reader over the binary encoding described in codec.h.
+            class binary_reader {
+            public:
+                binary_reader(const char* begin, const char* end)
+                    : _begin(begin), _p(begin), _end(end), _error(nullptr) {}
+
+                value_kind peek() {
+                    if (_p == _end) {
+                        fail("unexpected end of frame");
+                        return value_kind::invalid;
+                    }
+                    switch (static_cast<uint8_t>(*_p)) {
+                    case codec::binary_type::null:
+                        return value_kind::null;
+                    case codec::binary_type::false_value:
+                    case codec::binary_type::true_value:
+                        return value_kind::boolean;
+                    case codec::binary_type::number:
+                        return value_kind::number;
+                    case codec::binary_type::string:
+                        return value_kind::string;
+                    case codec::binary_type::array:
+                        return value_kind::array;
+                    case codec::binary_type::object:
+                        return value_kind::object;
+                    default:
+                        fail("unknown type");
+                        return value_kind::invalid;
+                    }
+                }
+
+                bool read_string(boost::string_ref& out) {
+                    ++_p;
+                    return read_key(out);
+                }
+
+                bool read_number(double& out) {
+                    ++_p;
+                    boost::endian::little_float64_buf_t buf;
+                    if (!take(&buf, sizeof buf)) {
+                        return false;
+                    }
+                    out = buf.value();
+                    return true;
+                }
+
+                bool read_bool(bool& out) {
+                    out = static_cast<uint8_t>(*_p++) == codec::binary_type::true_value;
+                    return true;
+                }
+
+                bool enter_array(container& c) {
+                    ++_p;
+                    return take_count(c.remaining);
+                }
+
+                bool next_item(container& c, bool& more) {
+                    more = c.remaining > 0;
+                    if (more) {
+                        --c.remaining;
+                    }
+                    return true;
+                }
+
+                bool enter_object(container& c) {
+                    ++_p;
+                    return take_count(c.remaining);
+                }
+
+                bool next_member(container& c, boost::string_ref& key, bool& more) {
+                    more = c.remaining > 0;
+                    if (!more) {
+                        return true;
+                    }
+                    --c.remaining;
+                    return read_key(key);
+                }
+
+                bool skip(int depth) {
+                    if (depth > max_depth) {
+                        return fail("nesting too deep");
+                    }
+
+                    boost::string_ref s;
+                    double d;
+                    container c;
+                    bool more;
+                    switch (peek()) {
+                    case value_kind::null:
+                    case value_kind::boolean:
+                        ++_p;
+                        return true;
+                    case value_kind::number:
+                        return read_number(d);
+                    case value_kind::string:
+                        return read_string(s);
+                    case value_kind::array:
+                        if (!enter_array(c)) {
+                            return false;
+                        }
+                        while (next_item(c, more) && more) {
+                            if (!skip(depth + 1)) {
+                                return false;
+                            }
+                        }
+                        return true;
+                    case value_kind::object:
+                        if (!enter_object(c)) {
+                            return false;
+                        }
+                        while (next_member(c, s, more)) {
+                            if (!more) {
+                                return true;
+                            }
+                            if (!skip(depth + 1)) {
+                                return false;
+                            }
+                        }
+                        return false;
+                    default:
+                        return false;
+                    }
+                }
+
+                bool finish() {
+                    return _p == _end || fail("unexpected data after the request");
+                }
+
+                std::string error() const {
+                    return std::string(_error ? _error : "malformed frame") + " at offset " + std::to_string(_p - _begin);
+                }
+
+            private:
+                bool fail(const char* error) {
+                    if (!_error) {
+                        _error = error;
+                    }
+                    return false;
+                }
+
+                bool take(void* out, size_t size) {
+                    if (static_cast<size_t>(_end - _p) < size) {
+                        return fail("unexpected end of frame");
+                    }
+                    memcpy(out, _p, size);
+                    _p += size;
+                    return true;
+                }
+
+                // Every element takes at least a byte, so no count can exceed what is left.
+                bool take_count(uint32_t& count) {
+                    boost::endian::little_uint32_buf_t buf;
+                    if (!take(&buf, sizeof buf)) {
+                        return false;
+                    }
+                    count = buf.value();
+                    return count <= static_cast<size_t>(_end - _p) || fail("count exceeds frame");
+                }
+
+                bool read_key(boost::string_ref& out) {
+                    uint32_t size;
+                    if (!take_count(size)) {
+                        return false;
+                    }
+                    out = boost::string_ref(_p, size);
+                    _p += size;
+                    return true;
+                }
+
+                const char* _begin;
+                const char* _p;
+                const char* _end;
+                const char* _error;
+            };
+
+            // Walks a request object with either reader and fills in the fields it knows.
+            template<class Reader>
+            class request_decoder {
+            public:
+                request_decoder(Reader& reader, request& out, std::string& error)
+                    : _reader(reader), _out(out), _error(error), _status(parse_status::ok) {}
+
+                parse_status decode() {
+                    value_kind kind = _reader.peek();
+                    if (kind != value_kind::object) {
+                        if (kind == value_kind::invalid || !_reader.skip(0) || !_reader.finish()) {
+                            return syntax_error();
+                        }
+                        return schema_error("request is not an object");
+                    }
+
+                    container c;
+                    if (!_reader.enter_object(c)) {
+                        return syntax_error();
+                    }
+                    for (;;) {
+                        boost::string_ref key;
+                        bool more;
+                        if (!_reader.next_member(c, key, more)) {
+                            return syntax_error();
+                        }
+                        if (!more) {
+                            break;
+                        }
+                        if (!member(find_keyword(key))) {
+                            return _status;
+                        }
+                    }
+
+                    if (!_reader.finish()) {
+                        return syntax_error();
+                    }
+                    return parse_status::ok;
+                }
+
+            private:
+                bool member(token key) {
+                    switch (key) {
+                    case token::name:
+                        if (!string_value(_out.name, field::name, "name")) {
+                            return false;
+                        }
+                        _out.type = message_type_of(find_keyword(_out.name));
+                        return true;
+                    case token::username:
+                        return string_value(_out.username, field::username, "username");
+                    case token::password:
+                        return string_value(_out.password, field::password, "password");
+                    case token::allowed_group:
+                        return string_value(_out.allowed_group, field::allowed_group, "allowedGroup");
+                    case token::working_directory:
+                        return string_value(_out.working_directory, field::working_directory, "workingDirectory");
+                    case token::encoding:
+                        return string_value(_out.encoding, field::encoding, "encoding");
+                    case token::arguments:
+                        return string_array(_out.arguments, field::arguments, "arguments");
+                    case token::environment:
+                        return string_array(_out.environment, field::environment, "environment");
+                    case token::process_id:
+                        if (!expect(value_kind::number, "processId") || !_reader.read_number(_out.process_id)) {
+                            return fail();
+                        }
+                        _out.present |= field::process_id;
+                        return true;
+                    case token::signals:
+                        return kill_steps();
+                    case token::entries:
+                        return auth_entries();
+                    case token::request_id:
+                        return request_id();
+                    case token::cgroup:
+                        return cgroup_limits();
+                    case token::placement:
+                        return placement();
+                    case token::timing:
+                        if (!expect(value_kind::boolean, "timing") || !_reader.read_bool(_out.timing)) {
+                            return fail();
+                        }
+                        _out.present |= field::timing;
+                        return true;
+                    default:
+                        return _reader.skip(0) || syntax_error_bool();
+                    }
+                }
+
+                bool string_value(boost::string_ref& out, uint32_t bit, const char* key) {
+                    if (!expect(value_kind::string, key) || !_reader.read_string(out)) {
+                        return fail();
+                    }
+                    _out.present |= bit;
+                    return true;
+                }
+
+                bool string_array(std::vector<boost::string_ref>& out, uint32_t bit, const char* key) {
+                    if (!expect(value_kind::array, key)) {
+                        return fail();
+                    }
+
+                    out.clear();
+                    container c;
+                    if (!_reader.enter_array(c)) {
+                        return syntax_error_bool();
+                    }
+                    for (;;) {
+                        bool more;
+                        if (!_reader.next_item(c, more)) {
+                            return syntax_error_bool();
+                        }
+                        if (!more) {
+                            break;
+                        }
+                        boost::string_ref item;
+                        if (!expect(value_kind::string, key) || !_reader.read_string(item)) {
+                            return fail();
+                        }
+                        out.push_back(item);
+                    }
+                    _out.present |= bit;
+                    return true;
+                }
+
+                bool kill_steps() {
+                    if (!expect(value_kind::array, "signals")) {
+                        return fail();
+                    }
+
+                    _out.signals.clear();
+                    container c;
+                    if (!_reader.enter_array(c)) {
+                        return syntax_error_bool();
+                    }
+                    for (;;) {
+                        bool more_steps;
+                        if (!_reader.next_item(c, more_steps)) {
+                            return syntax_error_bool();
+                        }
+                        if (!more_steps) {
+                            break;
+                        }
+                        if (!expect(value_kind::object, "signals")) {
+                            return fail();
+                        }
+
+                        kill_step_spec step = {};
+                        container m;
+                        if (!_reader.enter_object(m)) {
+                            return syntax_error_bool();
+                        }
+                        for (;;) {
+                            boost::string_ref key;
+                            bool more_members;
+                            if (!_reader.next_member(m, key, more_members)) {
+                                return syntax_error_bool();
+                            }
+                            if (!more_members) {
+                                break;
+                            }
+                            bool ok;
+                            switch (find_keyword(key)) {
+                            case token::signal: {
+                                value_kind kind = _reader.peek();
+                                if (kind == value_kind::string) {
+                                    ok = _reader.read_string(step.signal_name);
+                                } else if (kind == value_kind::number) {
+                                    ok = _reader.read_number(step.signal_number);
+                                } else {
+                                    ok = kind != value_kind::invalid && schema_error_bool("signal must be a name or a number");
+                                }
+                                break;
+                            }
+                            case token::timeout:
+                                ok = expect(value_kind::number, "timeout") && _reader.read_number(step.timeout);
+                                break;
+                            default:
+                                ok = _reader.skip(0);
+                                break;
+                            }
+                            if (!ok) {
+                                return fail();
+                            }
+                        }
+                        _out.signals.push_back(step);
+                    }
+                    _out.present |= field::signals;
+                    return true;
+                }
+
+                bool request_id() {
+                    bool ok;
+                    value_kind kind = _reader.peek();
+                    if (kind == value_kind::string) {
+                        _out.request_id_is_string = true;
+                        ok = _reader.read_string(_out.request_id_string);
+                    } else if (kind == value_kind::number) {
+                        ok = _reader.read_number(_out.request_id_number);
+                    } else {
+                        ok = kind != value_kind::invalid && schema_error_bool("requestId must be a string or a number");
+                    }
+                    if (!ok) {
+                        return fail();
+                    }
+                    _out.present |= field::request_id;
+                    return true;
+                }
+
+                bool cgroup_limits() {
+                    if (!expect(value_kind::object, "cgroup")) {
+                        return fail();
+                    }
+
+                    cgroup_spec& spec = _out.cgroup;
+                    container m;
+                    bool more = true;
+                    if (!_reader.enter_object(m)) {
+                        return syntax_error_bool();
+                    }
+                    boost::string_ref key;
+                    while (_reader.next_member(m, key, more) && more) {
+                        bool ok;
+                        switch (find_keyword(key)) {
+                        case token::scope:
+                            ok = expect(value_kind::string, "scope") && _reader.read_string(spec.scope);
+                            break;
+                        case token::cpu_weight:
+                            ok = expect(value_kind::number, "cpuWeight") && _reader.read_number(spec.cpu_weight);
+                            break;
+                        case token::io_weight:
+                            ok = expect(value_kind::number, "ioWeight") && _reader.read_number(spec.io_weight);
+                            break;
+                        case token::memory_high:
+                            ok = expect(value_kind::number, "memoryHigh") && _reader.read_number(spec.memory_high);
+                            break;
+                        case token::memory_max:
+                            ok = expect(value_kind::number, "memoryMax") && _reader.read_number(spec.memory_max);
+                            break;
+                        default:
+                            ok = _reader.skip(0);
+                            break;
+                        }
+                        if (!ok) {
+                            return fail();
+                        }
+                    }
+                    if (more) {
+                        return syntax_error_bool();
+                    }
+                    _out.present |= field::cgroup;
+                    return true;
+                }
+
+                bool placement() {
+                    if (!expect(value_kind::object, "placement")) {
+                        return fail();
+                    }
+
+                    placement_spec& spec = _out.placement;
+                    container m;
+                    bool more = true;
+                    if (!_reader.enter_object(m)) {
+                        return syntax_error_bool();
+                    }
+                    boost::string_ref key;
+                    while (_reader.next_member(m, key, more) && more) {
+                        bool ok;
+                        switch (find_keyword(key)) {
+                        case token::policy:
+                            ok = expect(value_kind::string, "policy") && _reader.read_string(spec.policy);
+                            break;
+                        case token::numa_node:
+                            ok = expect(value_kind::number, "numaNode") && _reader.read_number(spec.node);
+                            break;
+                        case token::cpus:
+                            ok = expect(value_kind::string, "cpus") && _reader.read_string(spec.cpus);
+                            break;
+                        case token::memory_policy:
+                            ok = expect(value_kind::string, "memoryPolicy") && _reader.read_string(spec.memory_policy);
+                            break;
+                        default:
+                            ok = _reader.skip(0);
+                            break;
+                        }
+                        if (!ok) {
+                            return fail();
+                        }
+                    }
+                    if (more) {
+                        return syntax_error_bool();
+                    }
+                    _out.present |= field::placement;
+                    return true;
+                }
+
+                bool auth_entries() {
+                    if (!expect(value_kind::array, "entries")) {
+                        return fail();
+                    }
+
+                    _out.entries.clear();
+                    container c;
+                    if (!_reader.enter_array(c)) {
+                        return syntax_error_bool();
+                    }
+                    for (;;) {
+                        bool more_entries;
+                        if (!_reader.next_item(c, more_entries)) {
+                            return syntax_error_bool();
+                        }
+                        if (!more_entries) {
+                            break;
+                        }
+                        if (!expect(value_kind::object, "entries")) {
+                            return fail();
+                        }
+
+                        auth_entry entry = {};
+                        container m;
+                        if (!_reader.enter_object(m)) {
+                            return syntax_error_bool();
+                        }
+                        for (;;) {
+                            boost::string_ref key;
+                            bool more_members;
+                            if (!_reader.next_member(m, key, more_members)) {
+                                return syntax_error_bool();
+                            }
+                            if (!more_members) {
+                                break;
+                            }
+                            bool ok;
+                            switch (find_keyword(key)) {
+                            case token::username:
+                                ok = expect(value_kind::string, "username") && _reader.read_string(entry.username);
+                                entry.present |= ok ? field::username : 0;
+                                break;
+                            case token::password:
+                                ok = expect(value_kind::string, "password") && _reader.read_string(entry.password);
+                                entry.present |= ok ? field::password : 0;
+                                break;
+                            case token::allowed_group:
+                                ok = expect(value_kind::string, "allowedGroup") && _reader.read_string(entry.allowed_group);
+                                entry.present |= ok ? field::allowed_group : 0;
+                                break;
+                            default:
+                                ok = _reader.skip(0);
+                                break;
+                            }
+                            if (!ok) {
+                                return fail();
+                            }
+                        }
+                        _out.entries.push_back(entry);
+                    }
+                    _out.present |= field::entries;
+                    return true;
+                }
+
+                // Checks the type of the next value; a mismatch is a schema error unless the
+                // input isn't valid at all.
+                bool expect(value_kind kind, const char* key) {
+                    value_kind actual = _reader.peek();
+                    if (actual == kind) {
+                        return true;
+                    }
+                    if (actual == value_kind::invalid) {
+                        return false;
+                    }
+                    return schema_error_bool(std::string(key) + " has the wrong type");
+                }
+
+                // After a failed read: keeps a schema error if one was recorded, otherwise it
+                // was the syntax.
+                bool fail() {
+                    if (_status == parse_status::ok) {
+                        syntax_error();
+                    }
+                    return false;
+                }
+
+                parse_status syntax_error() {
+                    _status = parse_status::syntax_error;
+                    _error = _reader.error();
+                    return _status;
+                }
+
+                bool syntax_error_bool() {
+                    syntax_error();
+                    return false;
+                }
+
+                parse_status schema_error(const std::string& error) {
+                    _status = parse_status::schema_error;
+                    _error = error;
+                    return _status;
+                }
+
+                bool schema_error_bool(const std::string& error) {
+                    schema_error(error);
+                    return false;
+                }
+
+                Reader& _reader;
+                request& _out;
+                std::string& _error;
+                parse_status _status;
+            };
+        }
+
+        void request::clear() {
+            type = message_type::unknown;
+            present = 0;
+            name.clear();
+            username.clear();
+            password.clear();
+            allowed_group.clear();
+            working_directory.clear();
+            encoding.clear();
+            arguments.clear();
+            environment.clear();
+            process_id = 0;
+            signals.clear();
+            entries.clear();
+            timing = false;
+            request_id_is_string = false;
+            request_id_string.clear();
+            request_id_number = 0;
+            cgroup = cgroup_spec();
+            placement = placement_spec();
+            placement.node = -1;
+        }
+
+        const char* message_name(message_type type) {
+            switch (type) {
+            case message_type::auth_only:
+                return "AuthOnly";
+            case message_type::auth_and_run:
+                return "AuthAndRun";
+            case message_type::kill_process:
+                return "KillProcess";
+            case message_type::set_encoding:
+                return "SetEncoding";
+            case message_type::stats:
+                return "Stats";
+            case message_type::auth_only_batch:
+                return "AuthOnlyBatch";
+            default:
+                return "Unknown";
+            }
+        }
+
+        parse_status parse(std::string& frame, codec::wire_encoding encoding, request& out, std::string& error) {
+            out.clear();
+            char* begin = &frame[0];
+            char* end = begin + frame.size();
+
+            if (encoding == codec::wire_encoding::binary) {
+                binary_reader reader(begin, end);
+                return request_decoder<binary_reader>(reader, out, error).decode();
+            }
+
+            json_reader reader(begin, end);
+            return request_decoder<json_reader>(reader, out, error).decode();
+        }
+    }
+}
@@ -0,0 +1,154 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "codec.h"
+
+namespace rau {
+    namespace request {
+        enum class message_type {
+            unknown,
+            auth_only,
+            auth_and_run,
+            kill_process,
+            set_encoding,
+            stats,
+            auth_only_batch,
+            count
+        };
+
+        constexpr size_t message_type_count = static_cast<size_t>(message_type::count);
+
+        // The name a message of this type carries; "Unknown" for unknown.
+        const char* message_name(message_type type);
+
+        // Bits of request::present, one per field that was found in the message.
+        namespace field {
+            constexpr uint32_t name = 1 << 0;
+            constexpr uint32_t username = 1 << 1;
+            constexpr uint32_t password = 1 << 2;
+            constexpr uint32_t arguments = 1 << 3;
+            constexpr uint32_t environment = 1 << 4;
+            constexpr uint32_t working_directory = 1 << 5;
+            constexpr uint32_t allowed_group = 1 << 6;
+            constexpr uint32_t process_id = 1 << 7;
+            constexpr uint32_t signals = 1 << 8;
+            constexpr uint32_t encoding = 1 << 9;
+            constexpr uint32_t timing = 1 << 10;
+            constexpr uint32_t entries = 1 << 11;
+            constexpr uint32_t request_id = 1 << 12;
+            constexpr uint32_t cgroup = 1 << 13;
+            constexpr uint32_t placement = 1 << 14;
+        }
+
+        // One step of a KillProcess "signals" sequence, as sent.
+        struct kill_step_spec {
+            // Set if the signal was given by name.
+            boost::string_ref signal_name;
+            // Set if the signal was given by number; 0 if it was missing.
+            double signal_number;
+            // Milliseconds; 0 if missing.
+            double timeout;
+        };
+
+        // The "cgroup" object of AuthAndRun, as sent. Missing numbers are 0.
+        struct cgroup_spec {
+            // "user" or "session"; empty if missing.
+            boost::string_ref scope;
+            double cpu_weight;
+            double io_weight;
+            double memory_high;
+            double memory_max;
+        };
+
+        // The "placement" object of AuthAndRun, as sent. Missing strings are empty.
+        struct placement_spec {
+            boost::string_ref policy;
+            // numaNode; -1 if missing.
+            double node;
+            boost::string_ref cpus;
+            // "preferred" or "bind".
+            boost::string_ref memory_policy;
+        };
+
+        // One set of credentials of an AuthOnlyBatch "entries" array, as sent.
+        struct auth_entry {
+            uint32_t present;
+            boost::string_ref username;
+            boost::string_ref password;
+            boost::string_ref allowed_group;
+
+            bool has(uint32_t fields) const {
+                return (present & fields) == fields;
+            }
+        };
+
+        // A decoded request. Strings point into the frame it was decoded from, which has to
+        // outlive it. Decoding many frames into the same request reuses the vectors' storage,
+        // so once they have grown to fit, decoding doesn't allocate.
+        struct request {
+            message_type type;
+            uint32_t present;
+
+            boost::string_ref name;
+            boost::string_ref username;
+            boost::string_ref password;
+            boost::string_ref allowed_group;
+            boost::string_ref working_directory;
+            boost::string_ref encoding;
+            std::vector<boost::string_ref> arguments;
+            std::vector<boost::string_ref> environment;
+            double process_id;
+            std::vector<kill_step_spec> signals;
+            std::vector<auth_entry> entries;
+            cgroup_spec cgroup;
+            placement_spec placement;
+            // Whether the client asked for an rtvs-timing response.
+            bool timing;
+            // requestId, which the client may send as a string or as a number.
+            bool request_id_is_string;
+            boost::string_ref request_id_string;
+            double request_id_number;
+
+            bool has(uint32_t fields) const {
+                return (present & fields) == fields;
+            }
+
+            void clear();
+        };
+
+        enum class parse_status {
+            ok,
+            // Not valid JSON (or binary encoding) at all.
+            syntax_error,
+            // Well-formed, but not an object, or a known field has the wrong type.
+            schema_error
+        };
+
+        // Decodes a request straight from the frame, without building a document first. Known
+        // keys are recognized with a perfect hash, unknown ones are skipped. JSON escapes are
+        // resolved in place, which is why the frame isn't const. On failure, error says why.
+        parse_status parse(std::string& frame, codec::wire_encoding encoding, request& out, std::string& error);
+    }
+}
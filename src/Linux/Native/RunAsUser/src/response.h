@@ -0,0 +1,53 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "picojson.h"
+#include "util.h"
+#include "channel.h"
+
+static constexpr char RTVS_RESPONSE_TYPE_PAM_INFO[] = "pam-info";
+static constexpr char RTVS_RESPONSE_TYPE_PAM_ERROR[] = "pam-error";
+static constexpr char RTVS_RESPONSE_TYPE_SYSTEM_ERROR[] = "unix-error";
+static constexpr char RTVS_RESPONSE_TYPE_JSON_ERROR[] = "json-error";
+static constexpr char RTVS_RESPONSE_TYPE_RTVS_RESULT[] = "rtvs-result";
+static constexpr char RTVS_RESPONSE_TYPE_RTVS_ERROR[] = "rtvs-error";
+static constexpr char RTVS_RESPONSE_TYPE_RTVS_DONE[] = "rtvs-done";
+static constexpr char RTVS_RESPONSE_TYPE_RTVS_EXIT[] = "rtvs-exit";
+static constexpr char RTVS_RESPONSE_TYPE_RTVS_TIMING[] = "rtvs-timing";
+// Only sent by the socket server, before the rtvs-result of a supervised AuthAndRun.
+static constexpr char RTVS_RESPONSE_TYPE_RTVS_PLACEMENT[] = "rtvs-placement";
+
+// Sends a response: an array of the response type, the request's requestId if it had one,
+// and the response's values, in the channel's encoding.
+template<class Arg, class... Args>
+inline void write_json(rau::response_channel& channel, Arg&& arg, Args&&... args) {
+    picojson::array msg;
+    msg.push_back(picojson::value(std::forward<Arg>(arg)));
+    if (const picojson::value* id = channel.correlation_id()) {
+        msg.push_back(*id);
+    }
+    append_json(msg, std::forward<Args>(args)...);
+    channel.write_frame(rau::codec::encode(picojson::value(msg), channel.encoding()));
+}
@@ -0,0 +1,800 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "picojson.h"
+#include "util.h"
+#include "server.h"
+#include "worker_pool.h"
+#include "framing.h"
+#include "log.h"
+#include "timing.h"
+
+using namespace rau::log;
+
+namespace rau {
+    namespace server {
+#ifndef _APPLE
+        namespace {
+            constexpr int max_events = 64;
+            constexpr size_t read_chunk_size = 0x10000;
+            constexpr uint32_t read_events = EPOLLIN | EPOLLRDHUP;
+            // More than AuthAndRun's stdin, stdout and stderr; anything beyond this is dropped.
+            constexpr size_t max_fds_per_read = 8;
+            // Received descriptors not yet handed to a request. A client that sends more without
+            // the frames they go with is dropped rather than allowed to fill the fd table.
+            constexpr size_t max_pending_fds = 64;
+            // Responses not yet taken by a client that has stopped reading them.
+            constexpr size_t max_queued_output = 0x1000000;
+
+            typedef std::chrono::steady_clock clock;
+
+            bool epoll_add(int epfd, int fd, uint32_t events) {
+                epoll_event ev = {};
+                ev.events = events;
+                ev.data.fd = fd;
+                return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+            }
+
+            void close_fds(const std::vector<int>& fds) {
+                for (int fd : fds) {
+                    close(fd);
+                }
+            }
+
+            struct pending_request {
+                std::string message;
+                std::vector<int> fds;
+            };
+
+
+            // Connection state is owned by the event loop thread, except for the output
+            // buffer, which worker threads append responses to under _out_mutex.
+            class connection : public response_channel, public std::enable_shared_from_this<connection> {
+            public:
+                connection(int epfd, int fd, const ucred& peer, size_t max_frame_size, size_t max_in_flight)
+                    : _epfd(epfd), _fd(fd), _peer(peer), _broken(false), _eof(false), _registered(true), _closed(false)
+                    , _in(max_frame_size), _pending_fds(0), _in_flight(0), _exclusive(0), _max_in_flight(std::max<size_t>(max_in_flight, 1)) {}
+
+                ~connection() {
+                    for (auto& request : _pending) {
+                        close_fds(request.fds);
+                    }
+                    for (auto& batch : _fd_batches) {
+                        close_fds(batch.second);
+                    }
+                    close(_fd);
+                }
+
+                int fd() const {
+                    return _fd;
+                }
+
+                const ucred& peer() const {
+                    return _peer;
+                }
+
+                bool broken() const {
+                    return _broken;
+                }
+
+                // Read by workers; the requests themselves are counted until they complete.
+                size_t in_flight() const {
+                    return _in_flight;
+                }
+
+                // Whether the peer is gone and everything it asked for has been answered.
+                bool finished() {
+                    std::lock_guard<std::mutex> lock(_out_mutex);
+                    if (_broken) {
+                        return true;
+                    }
+                    return _eof && _in_flight == 0 && _pending.empty() && _out.empty();
+                }
+
+                void write_frame(const std::string& frame) override {
+                    std::lock_guard<std::mutex> lock(_out_mutex);
+                    if (_broken) {
+                        return;
+                    }
+
+                    if (_out.size() + frame.size() > max_queued_output) {
+                        logf(log_verbosity::minimal, "Error: Too much output queued, closing connection from pid %d\n", _peer.pid);
+                        _broken = true;
+                        update_interest_locked();
+                        return;
+                    }
+
+                    boost::endian::little_uint32_buf_t data_size(static_cast<uint32_t>(frame.size()));
+                    _out.append(reinterpret_cast<const char*>(&data_size), sizeof data_size);
+                    _out.append(frame);
+                    flush_locked();
+                }
+
+                std::shared_ptr<response_channel> share() override {
+                    return shared_from_this();
+                }
+
+                void flush() {
+                    std::lock_guard<std::mutex> lock(_out_mutex);
+                    flush_locked();
+                }
+
+                // Reads everything available and queues each complete frame. File descriptors
+                // passed with SCM_RIGHTS go with the frame that contains the last byte of the
+                // read they arrived with: the kernel ends a read at the data they were sent with,
+                // and clients send them along with the frame they belong to.
+                void receive() {
+                    for (;;) {
+                        iovec iov = { _in.prepare(read_chunk_size), read_chunk_size };
+                        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_fds_per_read)];
+                        msghdr msg = {};
+                        msg.msg_iov = &iov;
+                        msg.msg_iovlen = 1;
+                        msg.msg_control = control;
+                        msg.msg_controllen = sizeof control;
+
+                        ssize_t n = recvmsg(_fd, &msg, MSG_CMSG_CLOEXEC);
+                        if (n > 0) {
+                            take_fds(msg, _in.received() + n - 1);
+                        }
+                        if (n < 0) {
+                            if (errno == EINTR) {
+                                continue;
+                            }
+                            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                                logf(log_verbosity::normal, "Error [recv]: %s (pid %d)\n", strerror(errno), _peer.pid);
+                                _broken = true;
+                            }
+                            break;
+                        } else if (n == 0) {
+                            std::lock_guard<std::mutex> lock(_out_mutex);
+                            _eof = true;
+                            update_interest_locked();
+                            break;
+                        }
+                        _in.commit(n);
+                        if (_broken) {
+                            return;
+                        }
+                    }
+
+                    boost::string_ref frame;
+                    framing::frame_buffer::status status;
+                    while ((status = _in.next(frame)) == framing::frame_buffer::status::complete) {
+                        pending_request request;
+                        request.message.assign(frame.data(), frame.size());
+                        while (!_fd_batches.empty() && _fd_batches.front().first < _in.consumed()) {
+                            auto& fds = _fd_batches.front().second;
+                            request.fds.insert(request.fds.end(), fds.begin(), fds.end());
+                            _fd_batches.pop_front();
+                        }
+                        _pending.push_back(std::move(request));
+                    }
+
+                    if (status == framing::frame_buffer::status::too_large) {
+                        // There is no way to find the next frame after a bogus length prefix.
+                        logf(log_verbosity::minimal, "Error: Frame exceeds the maximum size, closing connection from pid %d\n", _peer.pid);
+                        _broken = true;
+                    }
+                }
+
+                // Takes the next request to run. A request runs alone until it has been found to
+                // carry a requestId (release_exclusive), since only then can its responses be
+                // told apart from those to the requests after it.
+                bool take_request(pending_request& request) {
+                    if (_exclusive > 0 || _in_flight >= _max_in_flight || _broken || _pending.empty()) {
+                        return false;
+                    }
+                    request = std::move(_pending.front());
+                    _pending.pop_front();
+                    _pending_fds -= request.fds.size();
+                    ++_in_flight;
+                    ++_exclusive;
+                    return true;
+                }
+
+                void release_exclusive() {
+                    --_exclusive;
+                }
+
+                void request_completed(bool exclusive) {
+                    --_in_flight;
+                    if (exclusive) {
+                        --_exclusive;
+                    }
+                }
+
+                // Called when the event loop forgets the connection. It stays open for as long as
+                // exit handlers of supervised hosts hold on to it, but is not watched any more.
+                void unregister() {
+                    std::lock_guard<std::mutex> lock(_out_mutex);
+                    if (_registered) {
+                        epoll_ctl(_epfd, EPOLL_CTL_DEL, _fd, nullptr);
+                        _registered = false;
+                    }
+                    _closed = true;
+                }
+
+            private:
+                void take_fds(msghdr& msg, uint64_t position) {
+                    if (msg.msg_flags & MSG_CTRUNC) {
+                        logf(log_verbosity::normal, "Error: Too many file descriptors from pid %d, extra ones dropped\n", _peer.pid);
+                    }
+
+                    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                            continue;
+                        }
+
+                        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                        std::vector<int> fds(count);
+                        memcpy(fds.data(), CMSG_DATA(cmsg), count * sizeof(int));
+                        if (_broken || _pending_fds + count > max_pending_fds) {
+                            if (!_broken) {
+                                logf(log_verbosity::minimal, "Error: Too many pending file descriptors, closing connection from pid %d\n", _peer.pid);
+                                _broken = true;
+                            }
+                            close_fds(fds);
+                            continue;
+                        }
+                        _pending_fds += count;
+                        _fd_batches.emplace_back(position, std::move(fds));
+                    }
+                }
+
+                void flush_locked() {
+                    while (!_out.empty() && !_broken) {
+                        ssize_t n = send(_fd, _out.data(), _out.size(), MSG_NOSIGNAL);
+                        if (n < 0) {
+                            if (errno == EINTR) {
+                                continue;
+                            }
+                            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                                logf(log_verbosity::normal, "Error [send]: %s (pid %d)\n", strerror(errno), _peer.pid);
+                                _broken = true;
+                            }
+                            break;
+                        }
+                        _out.erase(0, n);
+                    }
+
+                    update_interest_locked();
+                }
+
+                // Changed under _out_mutex so that a worker arming EPOLLOUT cannot race with
+                // the event loop disarming it after a flush. Once the peer has closed its end,
+                // the socket stays readable (and hung up) forever, so it is only watched for as
+                // long as there is output left to send.
+                void update_interest_locked() {
+                    if (_closed) {
+                        return;
+                    }
+
+                    uint32_t events = (_eof || _broken ? 0 : read_events) | (_out.empty() || _broken ? 0 : EPOLLOUT);
+
+                    epoll_event ev = {};
+                    ev.events = events;
+                    ev.data.fd = _fd;
+                    if (events == 0) {
+                        if (_registered) {
+                            epoll_ctl(_epfd, EPOLL_CTL_DEL, _fd, nullptr);
+                            _registered = false;
+                        }
+                    } else if (_registered) {
+                        epoll_ctl(_epfd, EPOLL_CTL_MOD, _fd, &ev);
+                    } else if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _fd, &ev) == 0) {
+                        _registered = true;
+                    }
+                }
+
+                int _epfd, _fd;
+                ucred _peer;
+                std::atomic<bool> _broken;
+                bool _eof, _registered, _closed;
+                framing::frame_buffer _in;
+                // Received descriptors by the stream position of the last byte of the read that
+                // brought them.
+                std::deque<std::pair<uint64_t, std::vector<int>>> _fd_batches;
+                std::deque<pending_request> _pending;
+                // Descriptors in _fd_batches and _pending.
+                size_t _pending_fds;
+                // Requests running on workers, and how many of them still run alone.
+                std::atomic<size_t> _in_flight;
+                size_t _exclusive;
+                size_t _max_in_flight;
+
+                std::mutex _out_mutex;
+                std::string _out;
+            };
+
+            typedef std::shared_ptr<connection> connection_ptr;
+
+            class completion_queue;
+
+            // The responses to one request. They go straight to its connection, except after
+            // PAM asked for its failure delay: instead of keeping a worker asleep, they are held
+            // back, and the event loop completes the request once the delay is over. Other
+            // requests on the connection are not held up.
+            class request_stream : public response_channel, public std::enable_shared_from_this<request_stream> {
+            public:
+                request_stream(const connection_ptr& conn, completion_queue& completions)
+                    : _conn(conn), _completions(completions), _overlap(false), _done(false), _overlapped(false), _finished(false) {}
+
+                const connection_ptr& conn() const {
+                    return _conn;
+                }
+
+                codec::wire_encoding encoding() const override {
+                    return _conn->encoding();
+                }
+
+                void request_encoding(codec::wire_encoding encoding) override {
+                    _conn->request_encoding(encoding);
+                }
+
+                void apply_encoding() override {
+                    _conn->apply_encoding();
+                }
+
+                void write_frame(const std::string& frame) override {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if (_hold_until == clock::time_point()) {
+                        _conn->write_frame(frame);
+                    } else {
+                        _held.push_back(frame);
+                    }
+                }
+
+                void delay_responses(std::chrono::microseconds delay) override {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _hold_until = std::max(_hold_until, clock::now() + delay);
+                }
+
+                std::shared_ptr<response_channel> share() override {
+                    return _conn->share();
+                }
+
+                // Called on the worker; the event loop learns of it from the completion queue.
+                void allow_overlap() override;
+
+                bool others_in_flight() const override {
+                    return _conn->in_flight() > 1;
+                }
+
+                // Called on the worker once the handler has returned.
+                void done();
+
+                // Event loop side: whether allow_overlap or done happened since the last call.
+                bool take_overlap() {
+                    if (_overlapped || !_overlap) {
+                        return false;
+                    }
+                    _overlapped = true;
+                    return true;
+                }
+
+                bool take_done() {
+                    if (_finished || !_done) {
+                        return false;
+                    }
+                    _finished = true;
+                    return true;
+                }
+
+                // Whether the request stopped running alone before it completed.
+                bool overlapped() const {
+                    return _overlapped;
+                }
+
+                clock::time_point hold_deadline() {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    return _hold_until;
+                }
+
+                void release_held() {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    for (const std::string& frame : _held) {
+                        _conn->write_frame(frame);
+                    }
+                    _held.clear();
+                    _hold_until = clock::time_point();
+                }
+
+            private:
+                connection_ptr _conn;
+                completion_queue& _completions;
+                std::atomic<bool> _overlap, _done;
+                // Owned by the event loop.
+                bool _overlapped, _finished;
+
+                std::mutex _mutex;
+                std::vector<std::string> _held;
+                clock::time_point _hold_until;
+            };
+
+            typedef std::shared_ptr<request_stream> stream_ptr;
+
+            // Requests that finished, or stopped running alone, on a worker thread; the event
+            // loop is woken through an eventfd to start the next requests of their connections.
+            class completion_queue {
+            public:
+                completion_queue()
+                    : _fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+
+                ~completion_queue() {
+                    if (_fd != -1) {
+                        close(_fd);
+                    }
+                }
+
+                int fd() const {
+                    return _fd;
+                }
+
+                void push(const stream_ptr& stream) {
+                    {
+                        std::lock_guard<std::mutex> lock(_mutex);
+                        _completed.push_back(stream);
+                    }
+                    uint64_t one = 1;
+                    write(_fd, &one, sizeof one);
+                }
+
+                std::vector<stream_ptr> drain() {
+                    uint64_t count;
+                    read(_fd, &count, sizeof count);
+
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    std::vector<stream_ptr> completed;
+                    completed.swap(_completed);
+                    return completed;
+                }
+
+            private:
+                int _fd;
+                std::mutex _mutex;
+                std::vector<stream_ptr> _completed;
+            };
+
+            void request_stream::allow_overlap() {
+                if (!_overlap.exchange(true)) {
+                    _completions.push(shared_from_this());
+                }
+            }
+
+            void request_stream::done() {
+                _done = true;
+                _completions.push(shared_from_this());
+            }
+
+            bool is_peer_allowed(const server_options& options, const ucred& peer) {
+                return peer.uid == 0 ||
+                    std::find(options.allowed_uids.begin(), options.allowed_uids.end(), peer.uid) != options.allowed_uids.end();
+            }
+
+            int create_listener(const std::string& socket_path) {
+                sockaddr_un addr = {};
+                addr.sun_family = AF_UNIX;
+                if (socket_path.size() >= sizeof addr.sun_path) {
+                    logf(log_verbosity::minimal, "Error: Socket path is too long: %s\n", socket_path.c_str());
+                    errno = ENAMETOOLONG;
+                    return -1;
+                }
+                strcpy(addr.sun_path, socket_path.c_str());
+
+                int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (fd == -1) {
+                    logf(log_verbosity::minimal, "Error [socket]: %s\n", strerror(errno));
+                    return -1;
+                }
+
+                // Only replace a stale socket; never unlink anything else that happens to live there.
+                struct stat st;
+                if (lstat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+                    unlink(socket_path.c_str());
+                }
+
+                // Anyone may connect; who gets served is decided with SO_PEERCRED on accept.
+                mode_t old_umask = umask(0);
+                int result = bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr);
+                umask(old_umask);
+
+                if (result == -1 || listen(fd, SOMAXCONN) == -1) {
+                    int err = errno;
+                    logf(log_verbosity::minimal, "Error [bind/listen]: %s (%s)\n", strerror(err), socket_path.c_str());
+                    close(fd);
+                    errno = err;
+                    return -1;
+                }
+
+                return fd;
+            }
+
+            // Must run before any thread is started, so that the signals are blocked in all of them.
+            int create_signal_fd() {
+                sigset_t mask;
+                sigemptyset(&mask);
+                sigaddset(&mask, SIGTERM);
+                sigaddset(&mask, SIGINT);
+                sigaddset(&mask, SIGUSR1);
+                if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) {
+                    return -1;
+                }
+                return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+            }
+
+            void log_pool_counters(const worker_pool& pool) {
+                auto c = pool.get_counters();
+                double utilization = c.uptime.count() > 0 && c.workers > 0
+                    ? 100.0 * c.busy_time.count() / (static_cast<double>(c.uptime.count()) * c.workers)
+                    : 0.0;
+                logf(log_verbosity::minimal, log_level::information,
+                     "Workers: %zu/%zu busy, %.1f%% utilization; queue: %zu (peak %zu); completed: %llu, rejected: %llu\n",
+                     c.busy_workers, c.workers, utilization, c.queue_depth, c.peak_queue_depth,
+                     static_cast<unsigned long long>(c.completed), static_cast<unsigned long long>(c.rejected));
+            }
+
+            void accept_connections(int epfd, int listen_fd, const server_options& options,
+                                    std::unordered_map<int, connection_ptr>& connections) {
+                for (;;) {
+                    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd == -1) {
+                        if (errno == EINTR || errno == ECONNABORTED) {
+                            continue;
+                        }
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                            logf(log_verbosity::minimal, "Error [accept4]: %s\n", strerror(errno));
+                        }
+                        return;
+                    }
+
+                    ucred peer = {};
+                    socklen_t len = sizeof peer;
+                    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &len) == -1) {
+                        logf(log_verbosity::minimal, "Error [getsockopt(SO_PEERCRED)]: %s\n", strerror(errno));
+                        close(fd);
+                        continue;
+                    }
+
+                    if (!is_peer_allowed(options, peer)) {
+                        logf(log_verbosity::minimal, "Error: Rejected connection from pid %d uid %d\n", peer.pid, peer.uid);
+                        close(fd);
+                        continue;
+                    }
+
+                    if (!epoll_add(epfd, fd, read_events)) {
+                        logf(log_verbosity::minimal, "Error [epoll_ctl]: %s\n", strerror(errno));
+                        close(fd);
+                        continue;
+                    }
+
+                    logf(log_verbosity::traffic, "Accepted connection from pid %d uid %d\n", peer.pid, peer.uid);
+                    connections[fd] = std::make_shared<connection>(epfd, fd, peer, options.max_frame_size, options.max_in_flight);
+                }
+            }
+        }
+
+        int run(const server_options& options, const request_handler& handler, const request_handler& overload_handler) {
+            int listen_fd = create_listener(options.socket_path);
+            if (listen_fd == -1) {
+                return errno;
+            }
+
+            int signal_fd = create_signal_fd();
+            int epfd = epoll_create1(EPOLL_CLOEXEC);
+            completion_queue completions;
+            if (signal_fd == -1 || epfd == -1 || completions.fd() == -1 ||
+                !epoll_add(epfd, listen_fd, EPOLLIN) || !epoll_add(epfd, signal_fd, EPOLLIN) ||
+                !epoll_add(epfd, completions.fd(), EPOLLIN) ||
+                (options.supervisor && !epoll_add(epfd, options.supervisor->fd(), EPOLLIN))) {
+                int err = errno;
+                logf(log_verbosity::minimal, "Error [epoll]: %s\n", strerror(err));
+                close(listen_fd);
+                return err;
+            }
+
+            std::unordered_map<int, connection_ptr> connections;
+            SCOPE_WARDEN(server_exit, {
+                connections.clear();
+                close(epfd);
+                close(signal_fd);
+                close(listen_fd);
+                unlink(options.socket_path.c_str());
+            });
+
+            // Declared after the warden so that in-flight requests finish before connections go away.
+            worker_pool pool(std::max<size_t>(options.workers, 1), options.max_queue_depth);
+
+            auto dispatch = [&](const connection_ptr& conn) {
+                pending_request request;
+                while (conn->take_request(request)) {
+                    auto stream = std::make_shared<request_stream>(conn, completions);
+                    auto job = [&handler, stream, request]() mutable {
+                        handler(request.message, request.fds, *stream);
+                        close_fds(request.fds);
+                        stream->done();
+                    };
+                    if (pool.try_submit(job)) {
+                        continue;
+                    }
+
+                    logf(log_verbosity::normal, "Error: All workers busy, rejecting request from pid %d\n", conn->peer().pid);
+                    overload_handler(request.message, request.fds, *conn);
+                    close_fds(request.fds);
+                    conn->request_completed(true);
+                }
+            };
+
+            // Exit handlers close PAM sessions, which can block just like opening them, so
+            // they run on the workers too. They are never dropped: if the queue is full, the
+            // handler runs on the event loop instead.
+            auto handle_exits = [&]() {
+                for (auto& host : options.supervisor->collect_exited()) {
+                    auto job = [host]() {
+                        host.handler(host.pid, host.status);
+                    };
+                    if (!pool.try_submit(job)) {
+                        job();
+                    }
+                }
+            };
+
+            // Requests whose responses are held back for the PAM failure delay, earliest first.
+            typedef std::pair<clock::time_point, stream_ptr> deferred_completion;
+            std::priority_queue<deferred_completion, std::vector<deferred_completion>, std::greater<deferred_completion>> deferred;
+
+            auto update = [&](const connection_ptr& conn) {
+                if (conn->finished()) {
+                    logf(log_verbosity::traffic, "Closing connection from pid %d\n", conn->peer().pid);
+                    conn->unregister();
+                    connections.erase(conn->fd());
+                }
+            };
+
+            auto registered = [&](const connection_ptr& conn) {
+                auto it = connections.find(conn->fd());
+                return it != connections.end() && it->second == conn;
+            };
+
+            auto complete = [&](const stream_ptr& stream) {
+                const connection_ptr& conn = stream->conn();
+                stream->release_held();
+                conn->request_completed(!stream->overlapped());
+                if (registered(conn)) {
+                    dispatch(conn);
+                    update(conn);
+                }
+            };
+
+            logf(log_verbosity::minimal, "Listening on %s with %zu workers\n", options.socket_path.c_str(), options.workers);
+
+            epoll_event events[max_events];
+            for (bool stopping = false; !stopping;) {
+                int timeout = -1;
+                if (!deferred.empty()) {
+                    auto remaining = deferred.top().first - clock::now();
+                    // Round up, so that the loop doesn't wake up just before the deadline.
+                    timeout = remaining.count() > 0 ? static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count()) + 1 : 0;
+                }
+
+                int count = epoll_wait(epfd, events, max_events, timeout);
+                if (count == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    int err = errno;
+                    logf(log_verbosity::minimal, "Error [epoll_wait]: %s\n", strerror(err));
+                    return err;
+                }
+
+                for (int i = 0; i < count; ++i) {
+                    int fd = events[i].data.fd;
+                    if (fd == listen_fd) {
+                        accept_connections(epfd, listen_fd, options, connections);
+                        continue;
+                    }
+
+                    if (fd == signal_fd) {
+                        signalfd_siginfo info;
+                        while (read(signal_fd, &info, sizeof info) == sizeof info) {
+                            if (info.ssi_signo == SIGUSR1) {
+                                log_pool_counters(pool);
+                                rau::timing::log_summary();
+                                if (options.supervisor) {
+                                    logf(log_verbosity::minimal, log_level::information, "Supervised hosts: %zu\n", options.supervisor->watched());
+                                }
+                            } else {
+                                logf(log_verbosity::minimal, "Received signal %u, shutting down.\n", info.ssi_signo);
+                                stopping = true;
+                            }
+                        }
+                        continue;
+                    }
+
+                    if (options.supervisor && fd == options.supervisor->fd()) {
+                        handle_exits();
+                        continue;
+                    }
+
+                    if (fd == completions.fd()) {
+                        auto now = clock::now();
+                        for (auto& stream : completions.drain()) {
+                            const connection_ptr& conn = stream->conn();
+                            if (stream->take_overlap()) {
+                                conn->release_exclusive();
+                                if (registered(conn)) {
+                                    dispatch(conn);
+                                }
+                            }
+                            if (stream->take_done()) {
+                                auto deadline = stream->hold_deadline();
+                                if (deadline > now) {
+                                    deferred.emplace(deadline, stream);
+                                } else {
+                                    complete(stream);
+                                }
+                            }
+                        }
+                        continue;
+                    }
+
+                    auto it = connections.find(fd);
+                    if (it == connections.end()) {
+                        continue;
+                    }
+
+                    connection_ptr conn = it->second;
+                    if (events[i].events & EPOLLOUT) {
+                        conn->flush();
+                    }
+                    if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                        conn->receive();
+                        dispatch(conn);
+                    }
+                    update(conn);
+                }
+
+                for (auto now = clock::now(); !deferred.empty() && deferred.top().first <= now;) {
+                    stream_ptr stream = deferred.top().second;
+                    deferred.pop();
+                    complete(stream);
+                }
+            }
+
+            log_pool_counters(pool);
+            rau::timing::log_summary();
+            if (options.supervisor && options.supervisor->watched() > 0) {
+                // R sessions outlive a restart of the helper; only their PAM sessions are lost.
+                logf(log_verbosity::minimal, "Leaving %zu hosts running without supervision.\n", options.supervisor->watched());
+            }
+            return 0;
+        }
+#else
+        int run(const server_options& options, const request_handler& handler, const request_handler& overload_handler) {
+            logf(log_verbosity::minimal, "Error: Socket server is not supported on this platform.\n");
+            return ENOTSUP;
+        }
+#endif
+    }
+}
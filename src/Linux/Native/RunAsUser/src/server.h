@@ -0,0 +1,71 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+#include "channel.h"
+#include "host_supervisor.h"
+#include "framing.h"
+
+namespace rau {
+    namespace server {
+        struct server_options {
+            // Path of the AF_UNIX socket to listen on.
+            std::string socket_path;
+
+            // Peers are identified with SO_PEERCRED; root is always allowed, everyone
+            // else has to be listed here.
+            std::vector<uid_t> allowed_uids;
+
+            // Requests are handled on this many worker threads. Requests on one connection
+            // are handled in order, one at a time, except that a request found to carry a
+            // requestId lets the next one start; different connections run concurrently.
+            size_t workers = 8;
+
+            // Requests of one connection that may be running at the same time.
+            size_t max_in_flight = 16;
+
+            // Requests waiting for a worker beyond this are answered by overload_handler.
+            size_t max_queue_depth = 256;
+
+            // Connections announcing a larger request are closed.
+            size_t max_frame_size = framing::default_max_frame_size;
+
+            // If set, the exit handlers of hosts watched by this supervisor run on the workers.
+            host_supervisor* supervisor = nullptr;
+        };
+
+        // fds are the file descriptors that arrived with the request as SCM_RIGHTS ancillary
+        // data. They are closed after the handler returns. The handler may decode message in
+        // place, and calls channel.allow_overlap() if the next request needn't wait for it.
+        typedef std::function<void(std::string& message, const std::vector<int>& fds, response_channel& channel)> request_handler;
+
+        // Accepts connections on options.socket_path and dispatches every framed request
+        // to handler on a worker thread until SIGTERM or SIGINT is received. When all workers
+        // are busy and the queue is full, overload_handler is called on the event loop
+        // instead, and must not block. SIGUSR1 logs the worker pool counters.
+        // Returns 0 on orderly shutdown, or the errno of the failure that prevented the
+        // server from starting.
+        int run(const server_options& options, const request_handler& handler, const request_handler& overload_handler);
+    }
+}
@@ -0,0 +1,329 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "spawn.h"
+
+namespace rau {
+    namespace spawn {
+        namespace {
+            // Filled in by the child if it fails before execve.
+            struct child_result {
+                int err;
+                const char* step;
+            };
+
+            template <typename TInt>
+            inline bool check_interrupted(TInt result) {
+                return result < 0 && errno == EINTR;
+            }
+
+            int change_cwd(const char* cwd) {
+                int result;
+                while (check_interrupted(result = chdir(cwd)));
+                return result;
+            }
+
+            // Moves the calling process into the cgroup whose cgroup.procs is open as fd.
+            bool join_cgroup(int fd) {
+                ssize_t n;
+                while (check_interrupted(n = write(fd, "0", 1)));
+                return n == 1;
+            }
+
+            // Applies the CPU affinity and memory policy of options to the calling process.
+            // Only makes raw system calls, so it's safe in the child of a vfork-style spawn.
+            const char* apply_placement(const launch_options& options) {
+#ifndef _APPLE
+                if (options.cpus && sched_setaffinity(0, sizeof(cpu_set_t), options.cpus) == -1) {
+                    return "sched_setaffinity";
+                }
+                if (options.memory_node >= 0) {
+                    constexpr size_t mask_bits = 1024;
+                    unsigned long mask[mask_bits / (8 * sizeof(unsigned long))] = {};
+                    size_t bits_per_word = 8 * sizeof(unsigned long);
+                    if (static_cast<size_t>(options.memory_node) >= mask_bits) {
+                        errno = EINVAL;
+                        return "set_mempolicy";
+                    }
+                    mask[options.memory_node / bits_per_word] |= 1UL << (options.memory_node % bits_per_word);
+                    int mode = options.memory_bind ? MPOL_BIND : MPOL_PREFERRED;
+                    if (syscall(SYS_set_mempolicy, mode, mask, mask_bits + 1) == -1) {
+                        return "set_mempolicy";
+                    }
+                }
+#endif
+                return nullptr;
+            }
+
+            // Installs fds as descriptors 0, 1 and 2. Sources below 3 are moved out of the way
+            // first, so that one of them can't be overwritten before it has been duplicated.
+            // Only uses calls that are safe in the child of a vfork-style spawn.
+            bool redirect_stdio(const int* fds) {
+                int sources[3];
+                for (int i = 0; i < 3; ++i) {
+                    sources[i] = fds[i] < 3 ? fcntl(fds[i], F_DUPFD_CLOEXEC, 3) : fds[i];
+                    if (sources[i] == -1) {
+                        return false;
+                    }
+                }
+                for (int i = 0; i < 3; ++i) {
+                    int result;
+                    while (check_interrupted(result = dup2(sources[i], i)));
+                    if (result == -1) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            pid_t spawn_with_fork(const launch_options& options, const char** failed_step) {
+                // The child reports where it failed over a close-on-exec pipe, which is only
+                // closed without data once execve has succeeded.
+                // It must be close-on-exec from the start: a host that another worker forks in
+                // between would keep the write end, and the read below would wait for it to exit.
+                int pipe_fds[2];
+#ifndef _APPLE
+                if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+                    *failed_step = "pipe";
+                    return -1;
+                }
+#else
+                // No pipe2, but also no socket server, so no other thread that forks.
+                if (pipe(pipe_fds) == -1) {
+                    *failed_step = "pipe";
+                    return -1;
+                }
+                fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+                fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+                pid_t pid = fork();
+                if (pid == -1) {
+                    int err = errno;
+                    close(pipe_fds[0]);
+                    close(pipe_fds[1]);
+                    *failed_step = "fork";
+                    errno = err;
+                    return -1;
+                }
+
+                if (pid == 0) {
+                    close(pipe_fds[0]);
+
+                    child_result result = {};
+                    sigset_t none;
+                    sigemptyset(&none);
+                    const char* placement_step = nullptr;
+                    if (options.cgroup_procs_fd != -1 && !join_cgroup(options.cgroup_procs_fd)) {
+                        result = { errno, "cgroup" };
+                    } else if ((placement_step = apply_placement(options)) != nullptr) {
+                        result = { errno, placement_step };
+                    } else if (options.stdio_fds && !redirect_stdio(options.stdio_fds)) {
+                        result = { errno, "dup2" };
+                    } else if (options.cwd && *options.cwd && change_cwd(options.cwd) == -1) {
+                        result = { errno, "chdir" };
+                    } else if (setgroups(options.groups->size(), options.groups->data()) == -1) {
+                        result = { errno, "setgroups" };
+                    } else if (setgid(options.gid) == -1) {
+                        result = { errno, "setgid" };
+                    } else if (setuid(options.uid) == -1) {
+                        result = { errno, "setuid" };
+                    } else {
+                        sigprocmask(SIG_SETMASK, &none, nullptr);
+                        execve(options.path, options.argv, options.envp);
+                        result = { errno, "execve" };
+                    }
+
+                    write(pipe_fds[1], &result, sizeof result);
+                    _exit(result.err);
+                }
+
+                close(pipe_fds[1]);
+                child_result result = {};
+                ssize_t n;
+                while (check_interrupted(n = read(pipe_fds[0], &result, sizeof result)));
+                close(pipe_fds[0]);
+
+                if (n == sizeof result) {
+                    int ws;
+                    while (check_interrupted(waitpid(pid, &ws, 0)));
+                    *failed_step = result.step;
+                    errno = result.err;
+                    return -1;
+                }
+
+                return pid;
+            }
+
+#ifndef _APPLE
+            constexpr size_t child_stack_size = 0x10000;
+
+            struct vfork_args {
+                const launch_options* options;
+                child_result result;
+            };
+
+            // The credential calls in libc broadcast the change to every thread of the calling
+            // process, which would reach the parent's threads from a CLONE_VM child; the raw
+            // syscalls only change the calling task.
+#ifdef SYS_setresuid32
+            constexpr long sys_setgroups = SYS_setgroups32, sys_setresgid = SYS_setresgid32, sys_setresuid = SYS_setresuid32;
+#else
+            constexpr long sys_setgroups = SYS_setgroups, sys_setresgid = SYS_setresgid, sys_setresuid = SYS_setresuid;
+#endif
+
+            // Runs on its own stack but in the parent's address space, with the parent
+            // suspended until execve or _exit. Must not allocate, lock, or log.
+            int vfork_child(void* arg) {
+                auto args = static_cast<vfork_args*>(arg);
+                const launch_options& options = *args->options;
+
+                gid_t gid = options.gid;
+                uid_t uid = options.uid;
+                const char* placement_step = nullptr;
+                if (options.cgroup_procs_fd != -1 && !join_cgroup(options.cgroup_procs_fd)) {
+                    args->result = { errno, "cgroup" };
+                } else if ((placement_step = apply_placement(options)) != nullptr) {
+                    args->result = { errno, placement_step };
+                } else if (options.stdio_fds && !redirect_stdio(options.stdio_fds)) {
+                    args->result = { errno, "dup2" };
+                } else if (options.cwd && *options.cwd && change_cwd(options.cwd) == -1) {
+                    args->result = { errno, "chdir" };
+                } else if (syscall(sys_setgroups, options.groups->size(), options.groups->data()) == -1) {
+                    args->result = { errno, "setgroups" };
+                } else if (syscall(sys_setresgid, gid, gid, gid) == -1) {
+                    args->result = { errno, "setgid" };
+                } else if (syscall(sys_setresuid, uid, uid, uid) == -1) {
+                    args->result = { errno, "setuid" };
+                } else {
+                    sigset_t none;
+                    sigemptyset(&none);
+                    sigprocmask(SIG_SETMASK, &none, nullptr);
+                    execve(options.path, options.argv, options.envp);
+                    args->result = { errno, "execve" };
+                }
+
+                _exit(args->result.err);
+            }
+
+            pid_t spawn_with_vfork(const launch_options& options, const char** failed_step) {
+                void* stack = mmap(nullptr, child_stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+                if (stack == MAP_FAILED) {
+                    *failed_step = "mmap";
+                    return -1;
+                }
+
+                // With every signal blocked, no handler can run in the child on the shared
+                // address space; the child unblocks them right before execve.
+                sigset_t all, old_mask;
+                sigfillset(&all);
+                pthread_sigmask(SIG_BLOCK, &all, &old_mask);
+
+                vfork_args args = { &options, {} };
+                pid_t pid = clone(vfork_child, static_cast<char*>(stack) + child_stack_size,
+                                  CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+                int err = errno;
+
+                pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+                munmap(stack, child_stack_size);
+
+                if (pid == -1) {
+                    *failed_step = "clone";
+                    errno = err;
+                    return -1;
+                }
+
+                // CLONE_VFORK only returns once the child has called execve or _exit.
+                if (args.result.step) {
+                    int ws;
+                    while (check_interrupted(waitpid(pid, &ws, 0)));
+                    *failed_step = args.result.step;
+                    errno = args.result.err;
+                    return -1;
+                }
+
+                return pid;
+            }
+#endif
+        }
+
+        command_block::~command_block() {
+            free(_memory);
+        }
+
+        bool command_block::assign(const char* path, const std::vector<boost::string_ref>& args, const std::vector<boost::string_ref>& env) {
+            size_t path_size = strlen(path) + 1;
+            size_t pointers = (args.size() + 2) + (env.size() + 1);
+            size_t size = pointers * sizeof(char*) + path_size;
+            for (const auto& arg : args) {
+                size += arg.size() + 1;
+            }
+            for (const auto& var : env) {
+                size += var.size() + 1;
+            }
+
+            void* memory = malloc(size);
+            if (!memory) {
+                return false;
+            }
+            free(_memory);
+            _memory = memory;
+            _argv = static_cast<char**>(memory);
+            _envp = _argv + args.size() + 2;
+
+            char* strings = reinterpret_cast<char*>(_envp + env.size() + 1);
+            auto append = [&strings](const char* data, size_t length) {
+                char* s = strings;
+                memcpy(s, data, length);
+                s[length] = '\0';
+                strings += length + 1;
+                return s;
+            };
+
+            char** arg_out = _argv;
+            *arg_out++ = append(path, path_size - 1);
+            for (const auto& arg : args) {
+                *arg_out++ = append(arg.data(), arg.size());
+            }
+            *arg_out = nullptr;
+
+            char** env_out = _envp;
+            for (const auto& var : env) {
+                *env_out++ = append(var.data(), var.size());
+            }
+            *env_out = nullptr;
+            return true;
+        }
+
+        pid_t spawn_process(const launch_options& options, const char** failed_step) {
+            *failed_step = nullptr;
+#ifndef _APPLE
+            if (options.method == spawn_method::vfork) {
+                return spawn_with_vfork(options, failed_step);
+            }
+#endif
+            return spawn_with_fork(options, failed_step);
+        }
+    }
+}
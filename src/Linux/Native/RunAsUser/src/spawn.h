@@ -0,0 +1,105 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace spawn {
+        enum class spawn_method {
+            // fork(), then switch credentials and cwd in the child. Copies the parent's page
+            // tables, which gets slower the larger a long-lived helper grows.
+            fork,
+            // clone(CLONE_VM | CLONE_VFORK): the child borrows the parent's memory until
+            // execve, so the cost doesn't depend on the parent's size.
+            vfork
+        };
+
+#ifdef _APPLE
+        constexpr spawn_method default_spawn_method = spawn_method::fork;
+#else
+        constexpr spawn_method default_spawn_method = spawn_method::vfork;
+#endif
+
+        struct launch_options {
+            const char* path;
+            char* const* argv;
+            char* const* envp;
+            // Working directory for the new process; ignored if null or empty.
+            const char* cwd;
+            uid_t uid;
+            gid_t gid;
+            // Complete supplementary group list, as initgroups would have set it.
+            const std::vector<gid_t>* groups;
+            // Descriptors to become the new process's stdin, stdout and stderr; if null, it
+            // inherits those of the caller.
+            const int* stdio_fds = nullptr;
+            // cgroup.procs of the cgroup v2 the new process is to run in, open for writing; the
+            // child moves itself there before it drops root. -1 to stay in the caller's cgroup.
+            int cgroup_procs_fd = -1;
+#ifndef _APPLE
+            // CPUs the new process may run on; if null, it inherits the caller's affinity.
+            const cpu_set_t* cpus = nullptr;
+#endif
+            // NUMA node the new process allocates memory from, preferably or, with
+            // memory_bind, exclusively; -1 to inherit the caller's memory policy.
+            int memory_node = -1;
+            bool memory_bind = false;
+            spawn_method method = default_spawn_method;
+        };
+
+        // argv and envp for execve in a single allocation: both null-terminated pointer arrays,
+        // followed by the strings they point to. Built in the parent, since the child of a
+        // vfork-style spawn must not allocate.
+        class command_block {
+        public:
+            command_block() = default;
+            command_block(const command_block&) = delete;
+            command_block& operator=(const command_block&) = delete;
+            ~command_block();
+
+            // argv[0] is path, followed by args. Returns false with errno set if the block
+            // couldn't be allocated.
+            bool assign(const char* path, const std::vector<boost::string_ref>& args, const std::vector<boost::string_ref>& env);
+
+            char* const* argv() const {
+                return _argv;
+            }
+
+            char* const* envp() const {
+                return _envp;
+            }
+
+        private:
+            void* _memory = nullptr;
+            char** _argv = nullptr;
+            char** _envp = nullptr;
+        };
+
+        // Starts options.path as options.uid/options.gid in options.cwd, with all signals
+        // unblocked. Returns the pid of the new process, or -1 with errno set. If the failure
+        // happened in the child before execve, *failed_step names the call that failed and
+        // the child has already been reaped.
+        pid_t spawn_process(const launch_options& options, const char** failed_step);
+    }
+}
@@ -29,11 +29,21 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
+#include <cmath>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
 #include <string>
 #include <mutex>
+#include <queue>
 #include <thread>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <algorithm>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -41,7 +51,17 @@
 #include <grp.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <dlfcn.h>
 #include <boost/endian/buffers.hpp>
+#include <boost/utility/string_ref.hpp>
 #include "boost/filesystem.hpp"
 
 #ifdef _APPLE
@@ -53,6 +73,15 @@
 #endif
 
 #ifndef _APPLE
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <linux/mempolicy.h>
 #include <libexplain/execv.h>
 #include <libexplain/fork.h>
 #include <libexplain/waitpid.h>
@@ -0,0 +1,146 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "timing.h"
+#include "log.h"
+
+using namespace rau::log;
+
+namespace rau {
+    namespace timing {
+        namespace {
+            const char* const phase_names[phase_count] = {
+                "pam_start",
+                "pam_authenticate",
+                "pam_acct_mgmt",
+                "pam_setcred",
+                "pam_open_session",
+                "getpwnam",
+                "getgrouplist",
+                "admission",
+                "cgroup",
+                "spawn",
+                "terminate",
+                "total",
+            };
+
+            histogram phase_histograms[phase_count];
+
+            size_t bucket_of(uint64_t us) {
+                if (us <= 1) {
+                    return 0;
+                }
+                size_t bucket = static_cast<size_t>(ceil(4 * log2(static_cast<double>(us))));
+                return std::min(bucket, histogram::bucket_count - 1);
+            }
+
+            double bucket_upper_bound_us(size_t bucket) {
+                return exp2(bucket / 4.0);
+            }
+        }
+
+        const char* phase_name(phase p) {
+            return phase_names[static_cast<size_t>(p)];
+        }
+
+        void phase_times::clear() {
+            for (auto& d : _durations) {
+                d = clock::duration::zero();
+            }
+            _measured = 0;
+        }
+
+        histogram::histogram()
+            : _count(0), _sum_us(0), _max_us(0) {
+            for (auto& b : _buckets) {
+                b.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void histogram::record(clock::duration d) {
+            uint64_t us = std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(d).count(), 0);
+            _buckets[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+            _sum_us.fetch_add(us, std::memory_order_relaxed);
+            _count.fetch_add(1, std::memory_order_relaxed);
+
+            uint64_t max = _max_us.load(std::memory_order_relaxed);
+            while (us > max && !_max_us.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+            }
+        }
+
+        histogram::snapshot histogram::get_snapshot() const {
+            snapshot s;
+            s.count = 0;
+            for (size_t i = 0; i < bucket_count; ++i) {
+                s.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+                s.count += s.buckets[i];
+            }
+            s.sum_us = _sum_us.load(std::memory_order_relaxed);
+            s.max_us = _max_us.load(std::memory_order_relaxed);
+            return s;
+        }
+
+        double histogram::snapshot::percentile_us(double q) const {
+            if (count == 0) {
+                return 0;
+            }
+
+            uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(ceil(q * count)), 1);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < bucket_count; ++i) {
+                seen += buckets[i];
+                if (seen >= rank) {
+                    // The bucket's bound can exceed the largest value actually seen.
+                    return std::min(bucket_upper_bound_us(i), static_cast<double>(max_us));
+                }
+            }
+            return static_cast<double>(max_us);
+        }
+
+        void aggregate(const phase_times& times) {
+            for (size_t i = 0; i < phase_count; ++i) {
+                phase p = static_cast<phase>(i);
+                if (times.measured(p)) {
+                    phase_histograms[i].record(times.get(p));
+                }
+            }
+        }
+
+        const histogram& phase_histogram(phase p) {
+            return phase_histograms[static_cast<size_t>(p)];
+        }
+
+        void log_summary() {
+            for (size_t i = 0; i < phase_count; ++i) {
+                histogram::snapshot s = phase_histograms[i].get_snapshot();
+                if (s.count == 0) {
+                    continue;
+                }
+                logf(log_verbosity::minimal, log_level::information,
+                     "Timing %s: %llu calls, p50 %.3fms, p95 %.3fms, p99 %.3fms, max %.3fms\n",
+                     phase_names[i], static_cast<unsigned long long>(s.count),
+                     s.percentile_us(0.5) / 1000, s.percentile_us(0.95) / 1000, s.percentile_us(0.99) / 1000, s.max_us / 1000.0);
+            }
+        }
+    }
+}
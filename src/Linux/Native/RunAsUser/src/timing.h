@@ -0,0 +1,127 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    namespace timing {
+        typedef std::chrono::steady_clock clock;
+
+        // Steps of a request that can take noticeably long, mostly because of PAM modules
+        // and directory services.
+        enum class phase {
+            pam_start,
+            pam_authenticate,
+            pam_acct_mgmt,
+            pam_setcred,
+            pam_open_session,
+            getpwnam,
+            getgrouplist,
+            admission,
+            cgroup,
+            spawn,
+            terminate,
+            total,
+            count
+        };
+
+        constexpr size_t phase_count = static_cast<size_t>(phase::count);
+
+        const char* phase_name(phase p);
+
+        // How long each phase of one request took.
+        class phase_times {
+        public:
+            phase_times() {
+                clear();
+            }
+
+            void clear();
+
+            void add(phase p, clock::duration d) {
+                _durations[static_cast<size_t>(p)] += d;
+                _measured |= 1u << static_cast<size_t>(p);
+            }
+
+            bool measured(phase p) const {
+                return (_measured & (1u << static_cast<size_t>(p))) != 0;
+            }
+
+            clock::duration get(phase p) const {
+                return _durations[static_cast<size_t>(p)];
+            }
+
+            // Calls f and adds the time it took to p; returns what f returned.
+            template<typename F>
+            auto measure(phase p, F&& f) -> decltype(f()) {
+                auto start = clock::now();
+                auto result = f();
+                add(p, clock::now() - start);
+                return result;
+            }
+
+        private:
+            clock::duration _durations[phase_count];
+            uint32_t _measured;
+        };
+
+        // Latency distribution that any thread can add to without locking. Buckets are a
+        // quarter of a power of two wide, so percentiles are accurate to within 19%.
+        class histogram {
+        public:
+            // 1us up to about 35 minutes.
+            static constexpr size_t bucket_count = 4 * 31 + 1;
+
+            struct snapshot {
+                uint64_t count;
+                uint64_t sum_us;
+                uint64_t max_us;
+                uint64_t buckets[bucket_count];
+
+                // Upper bound of the bucket that holds quantile q (0..1), in microseconds.
+                double percentile_us(double q) const;
+            };
+
+            histogram();
+
+            void record(clock::duration d);
+
+            snapshot get_snapshot() const;
+
+        private:
+            std::atomic<uint64_t> _count;
+            std::atomic<uint64_t> _sum_us;
+            std::atomic<uint64_t> _max_us;
+            std::atomic<uint64_t> _buckets[bucket_count];
+        };
+
+        // Adds a request's phases to the process-wide histograms kept by long-lived helpers.
+        void aggregate(const phase_times& times);
+
+        const histogram& phase_histogram(phase p);
+
+        // Logs count, p50/p95/p99 and maximum of every phase seen so far.
+        void log_summary();
+    }
+}
@@ -23,6 +23,7 @@
 
 #define SCOPE_WARDEN(NAME, ...) \
     auto xx##NAME##xx = [&](){ __VA_ARGS__ }; \
+    scope_warden<decltype(xx##NAME##xx)> NAME(xx##NAME##xx)
 
 template<typename F> class scope_warden {
 public:
@@ -0,0 +1,107 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#include "stdafx.h"
+#include "worker_pool.h"
+
+namespace rau {
+    worker_pool::worker_pool(size_t workers, size_t max_queue_depth)
+        : _max_queue_depth(max_queue_depth)
+        , _stopping(false)
+        , _busy_workers(0)
+        , _peak_queue_depth(0)
+        , _completed(0)
+        , _rejected(0)
+        , _busy_time(clock::duration::zero())
+        , _started(clock::now()) {
+        for (size_t i = 0; i < workers; ++i) {
+            _threads.emplace_back(&worker_pool::worker_main, this);
+        }
+    }
+
+    worker_pool::~worker_pool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+
+        for (auto& t : _threads) {
+            t.join();
+        }
+    }
+
+    bool worker_pool::try_submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stopping || _queue.size() >= _max_queue_depth) {
+                ++_rejected;
+                return false;
+            }
+
+            _queue.push_back(std::move(job));
+            _peak_queue_depth = std::max(_peak_queue_depth, _queue.size());
+        }
+        _cv.notify_one();
+        return true;
+    }
+
+    worker_pool::counters worker_pool::get_counters() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        counters c;
+        c.workers = _threads.size();
+        c.busy_workers = _busy_workers;
+        c.queue_depth = _queue.size();
+        c.peak_queue_depth = _peak_queue_depth;
+        c.completed = _completed;
+        c.rejected = _rejected;
+        c.busy_time = _busy_time;
+        c.uptime = clock::now() - _started;
+        return c;
+    }
+
+    void worker_pool::worker_main() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _cv.wait(lock, [this] { return _stopping || !_queue.empty(); });
+            if (_queue.empty()) {
+                return;
+            }
+
+            auto job = std::move(_queue.front());
+            _queue.pop_front();
+            ++_busy_workers;
+            lock.unlock();
+
+            auto start = clock::now();
+            job();
+            auto elapsed = clock::now() - start;
+
+            lock.lock();
+            --_busy_workers;
+            ++_completed;
+            _busy_time += elapsed;
+        }
+    }
+}
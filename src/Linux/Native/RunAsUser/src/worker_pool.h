@@ -0,0 +1,77 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+
+#pragma once
+#include "stdafx.h"
+
+namespace rau {
+    // Fixed set of threads running queued jobs. Used to keep blocking PAM transactions
+    // (pam_sss, LDAP) off the socket server's event loop, so one slow directory lookup
+    // only occupies one worker instead of stalling every connection.
+    class worker_pool {
+    public:
+        struct counters {
+            size_t workers;
+            size_t busy_workers;
+            size_t queue_depth;
+            size_t peak_queue_depth;
+            uint64_t completed;
+            uint64_t rejected;
+            // Sum of the time workers spent running jobs, and the pool's lifetime.
+            // busy_time / (uptime * workers) is the worker utilization.
+            std::chrono::nanoseconds busy_time;
+            std::chrono::nanoseconds uptime;
+        };
+
+        worker_pool(size_t workers, size_t max_queue_depth);
+
+        // Runs whatever is still queued, then joins the workers.
+        ~worker_pool();
+
+        // Queues job unless max_queue_depth jobs are already waiting.
+        bool try_submit(std::function<void()> job);
+
+        counters get_counters() const;
+
+    private:
+        void worker_main();
+
+        typedef std::chrono::steady_clock clock;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _cv;
+        std::deque<std::function<void()>> _queue;
+        std::vector<std::thread> _threads;
+        size_t _max_queue_depth;
+        bool _stopping;
+
+        size_t _busy_workers;
+        size_t _peak_queue_depth;
+        uint64_t _completed, _rejected;
+        clock::duration _busy_time;
+        clock::time_point _started;
+
+        worker_pool(const worker_pool&) = delete;
+        worker_pool& operator=(const worker_pool&) = delete;
+    };
+}
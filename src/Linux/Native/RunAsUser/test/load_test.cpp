@@ -0,0 +1,416 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "picojson.h"
+#include "framing.h"
+
+// Sends requests to Microsoft.R.Host.RunAsUser from many connections at once, and reports
+// throughput and latency percentiles per message type. Meant to be run by run_load_test.sh
+// against a helper that authenticates with pam_rtvs_stub.so.
+
+namespace {
+    enum class request_kind {
+        auth_only,
+        auth_and_run,
+        kill_process,
+        auth_only_batch,
+        count
+    };
+
+    const char* const kind_names[] = { "AuthOnly", "AuthAndRun", "KillProcess", "AuthOnlyBatch" };
+    constexpr size_t kind_count = static_cast<size_t>(request_kind::count);
+
+    struct options {
+        std::string socket_path;
+        std::string helper_path;
+        size_t requests = 1000;
+        size_t connections = 8;
+        unsigned weights[kind_count] = { 1, 0, 0, 0 };
+        std::string username;
+        std::string password = "password";
+        std::string allowed_group;
+        // How long the Microsoft.R.Host started by AuthAndRun is asked to live.
+        std::string host_lifetime = "0.1";
+        // Credentials in each AuthOnlyBatch.
+        size_t batch_size = 100;
+    };
+
+    struct result {
+        request_kind kind;
+        double latency_ms;
+        int exit_code;
+        bool pam_error;
+    };
+
+    // One client: a connection to the socket server, or a -s helper of its own on a pipe.
+    class connection {
+    public:
+        explicit connection(const options& options)
+            : _in(-1), _out(-1), _helper(-1) {
+            if (!options.socket_path.empty()) {
+                int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                sockaddr_un addr = {};
+                addr.sun_family = AF_UNIX;
+                strncpy(addr.sun_path, options.socket_path.c_str(), sizeof addr.sun_path - 1);
+                if (fd == -1 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == -1) {
+                    fprintf(stderr, "Error: Can't connect to %s: %s\n", options.socket_path.c_str(), strerror(errno));
+                    exit(1);
+                }
+                _in = _out = fd;
+            } else {
+                int to_helper[2], from_helper[2];
+                if (pipe2(to_helper, O_CLOEXEC) == -1 || pipe2(from_helper, O_CLOEXEC) == -1) {
+                    fprintf(stderr, "Error [pipe]: %s\n", strerror(errno));
+                    exit(1);
+                }
+                _helper = fork();
+                if (_helper == 0) {
+                    dup2(to_helper[0], STDIN_FILENO);
+                    dup2(from_helper[1], STDOUT_FILENO);
+                    execl(options.helper_path.c_str(), options.helper_path.c_str(), "-s", nullptr);
+                    _exit(127);
+                }
+                close(to_helper[0]);
+                close(from_helper[1]);
+                _out = to_helper[1];
+                _in = from_helper[0];
+            }
+            _reader.reset(new rau::framing::frame_reader(_in));
+        }
+
+        ~connection() {
+            close(_out);
+            if (_in != _out) {
+                close(_in);
+            }
+            if (_helper > 0) {
+                waitpid(_helper, nullptr, 0);
+            }
+        }
+
+        // Sends one request frame, with stdio_fds attached if given (socket server only).
+        bool send(const std::string& payload, const int* stdio_fds) {
+            rau::framing::frame_header header(static_cast<uint32_t>(payload.size()));
+            iovec iov[2] = { { &header, sizeof header }, { const_cast<char*>(payload.data()), payload.size() } };
+
+            msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = 2;
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 3)];
+            if (stdio_fds && _helper == -1) {
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof control;
+                cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+                memcpy(CMSG_DATA(cmsg), stdio_fds, sizeof(int) * 3);
+            }
+
+            size_t total = sizeof header + payload.size();
+            ssize_t n = _helper == -1 ? sendmsg(_out, &msg, MSG_NOSIGNAL) : writev(_out, iov, 2);
+            if (n < 0) {
+                return false;
+            }
+            // The rest of a large frame goes without the descriptors.
+            for (size_t sent = n; sent < total; sent += n) {
+                size_t offset = sent - sizeof header;
+                if (sent < sizeof header) {
+                    n = ::write(_out, reinterpret_cast<char*>(&header) + sent, sizeof header - sent);
+                } else {
+                    n = ::write(_out, payload.data() + offset, payload.size() - offset);
+                }
+                if (n <= 0) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Reads responses up to the rtvs-done that completes the request. Anything else,
+        // such as rtvs-exit for a host started earlier, is skipped.
+        bool receive(int& exit_code, bool& pam_error) {
+            pam_error = false;
+            for (;;) {
+                boost::string_ref frame;
+                if (_reader->read(frame) != rau::framing::frame_reader::status::ok) {
+                    return false;
+                }
+
+                picojson::value response;
+                std::string err;
+                picojson::parse(response, frame.begin(), frame.end(), &err);
+                if (!err.empty() || !response.is<picojson::array>() || response.get<picojson::array>().empty()) {
+                    return false;
+                }
+
+                const picojson::array& values = response.get<picojson::array>();
+                const std::string& type = values[0].to_str();
+                if (type == "pam-error") {
+                    pam_error = true;
+                } else if (type == "rtvs-done" && values.size() > 1) {
+                    exit_code = static_cast<int>(values[1].get<double>());
+                    return true;
+                }
+            }
+        }
+
+    private:
+        int _in, _out;
+        pid_t _helper;
+        std::unique_ptr<rau::framing::frame_reader> _reader;
+    };
+
+    std::string make_request(const options& options, request_kind kind, pid_t target) {
+        picojson::object request;
+        request["name"] = picojson::value(kind_names[static_cast<size_t>(kind)]);
+        switch (kind) {
+        case request_kind::auth_only:
+            request["username"] = picojson::value(options.username);
+            request["password"] = picojson::value(options.password);
+            request["allowedGroup"] = picojson::value(options.allowed_group);
+            break;
+        case request_kind::auth_and_run: {
+            request["username"] = picojson::value(options.username);
+            request["password"] = picojson::value(options.password);
+            request["workingDirectory"] = picojson::value("/");
+            picojson::array arguments, environment;
+            arguments.push_back(picojson::value("--rhost-name"));
+            arguments.push_back(picojson::value("LoadTest"));
+            environment.push_back(picojson::value("RTVS_STUB_HOST_LIFETIME=" + options.host_lifetime));
+            request["arguments"] = picojson::value(arguments);
+            request["environment"] = picojson::value(environment);
+            break;
+        }
+        case request_kind::kill_process:
+            request["processId"] = picojson::value(static_cast<double>(target));
+            break;
+        case request_kind::auth_only_batch: {
+            picojson::object entry;
+            entry["username"] = picojson::value(options.username);
+            entry["password"] = picojson::value(options.password);
+            entry["allowedGroup"] = picojson::value(options.allowed_group);
+            request["entries"] = picojson::value(picojson::array(options.batch_size, picojson::value(entry)));
+            break;
+        }
+        default:
+            break;
+        }
+        return picojson::value(request).serialize();
+    }
+
+    // The i-th request of the run, so that the mix is exact rather than random.
+    request_kind kind_of(const options& options, size_t i) {
+        unsigned total = 0;
+        for (unsigned weight : options.weights) {
+            total += weight;
+        }
+        unsigned slot = static_cast<unsigned>(i % total);
+        for (size_t k = 0; k < kind_count; ++k) {
+            if (slot < options.weights[k]) {
+                return static_cast<request_kind>(k);
+            }
+            slot -= options.weights[k];
+        }
+        return request_kind::auth_only;
+    }
+
+    // A process for KillProcess to end; it waits for a signal and nothing else.
+    pid_t start_target() {
+        pid_t pid = fork();
+        if (pid == 0) {
+            for (;;) {
+                pause();
+            }
+        }
+        return pid;
+    }
+
+    void run_client(const options& options, std::atomic<size_t>& next, std::vector<result>& results, std::atomic<size_t>& failures) {
+        connection conn(options);
+        int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+        int stdio_fds[3] = { devnull, devnull, devnull };
+
+        for (size_t i; (i = next++) < options.requests;) {
+            request_kind kind = kind_of(options, i);
+            pid_t target = kind == request_kind::kill_process ? start_target() : 0;
+            std::string payload = make_request(options, kind, target);
+
+            result r = { kind, 0, -1, false };
+            auto start = std::chrono::steady_clock::now();
+            if (!conn.send(payload, kind == request_kind::auth_and_run ? stdio_fds : nullptr) || !conn.receive(r.exit_code, r.pam_error)) {
+                fprintf(stderr, "Error: Connection to the helper was lost.\n");
+                ++failures;
+                break;
+            }
+            r.latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            results.push_back(r);
+
+            if (target > 0) {
+                kill(target, SIGKILL);
+                waitpid(target, nullptr, 0);
+            }
+        }
+        close(devnull);
+    }
+
+    double percentile(const std::vector<double>& sorted, double q) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        size_t index = static_cast<size_t>(std::ceil(q * sorted.size()));
+        return sorted[std::min(sorted.size(), std::max<size_t>(index, 1)) - 1];
+    }
+
+    bool parse_mix(const char* mix, options& options) {
+        std::fill(std::begin(options.weights), std::end(options.weights), 0);
+        std::string text(mix);
+        size_t start = 0;
+        unsigned total = 0;
+        while (start < text.size()) {
+            size_t end = text.find(',', start);
+            std::string item = text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            size_t eq = item.find('=');
+            std::string name = item.substr(0, eq);
+            unsigned weight = eq == std::string::npos ? 1 : strtoul(item.c_str() + eq + 1, nullptr, 10);
+
+            size_t k = 0;
+            while (k < kind_count && name != kind_names[k]) {
+                ++k;
+            }
+            if (k == kind_count) {
+                return false;
+            }
+            options.weights[k] = weight;
+            total += weight;
+            start = end == std::string::npos ? text.size() : end + 1;
+        }
+        return total > 0;
+    }
+}
+
+// usage: Microsoft.R.Host.RunAsUser.LoadTest (-l socket | -x helper) [-n requests] [-c connections] [-m mix] [-u user] [-p password] [-g group] [-t seconds] [-e entries]
+//    -l: Send requests to the socket server listening on socket
+//    -x: Start helper -s for every connection, and send requests to its stdin
+//    -n: Requests to send in all (default 1000)
+//    -c: Connections sending requests at the same time (default 8)
+//    -m: Request types and their weights (default AuthOnly=1), e.g. AuthOnly=8,AuthAndRun=1,KillProcess=1;
+//        AuthAndRun needs -l, since a -s helper has no standard handles to give a host
+//    -u: User to authenticate as (default the current user)
+//    -p: Password to authenticate with (default "password")
+//    -g: allowedGroup of AuthOnly requests (default none)
+//    -t: Seconds each host started by AuthAndRun lives (default 0.1)
+//    -e: Credentials in each AuthOnlyBatch request (default 100)
+int main(int argc, char** argv) {
+    options options;
+    if (passwd* pw = getpwuid(geteuid())) {
+        options.username = pw->pw_name;
+    }
+
+    int opt;
+    while ((opt = getopt(argc, argv, "l:x:n:c:m:u:p:g:t:e:")) != -1) {
+        switch (opt) {
+        case 'l':
+            options.socket_path = optarg;
+            break;
+        case 'x':
+            options.helper_path = optarg;
+            break;
+        case 'n':
+            options.requests = strtoul(optarg, nullptr, 10);
+            break;
+        case 'c':
+            options.connections = std::max<size_t>(1, strtoul(optarg, nullptr, 10));
+            break;
+        case 'm':
+            if (!parse_mix(optarg, options)) {
+                fprintf(stderr, "Error: Invalid request mix %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'u':
+            options.username = optarg;
+            break;
+        case 'p':
+            options.password = optarg;
+            break;
+        case 'g':
+            options.allowed_group = optarg;
+            break;
+        case 't':
+            options.host_lifetime = optarg;
+            break;
+        case 'e':
+            options.batch_size = strtoul(optarg, nullptr, 10);
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    if (options.socket_path.empty() == options.helper_path.empty()) {
+        fprintf(stderr, "Error: Either -l or -x is required.\n");
+        return 1;
+    }
+
+    std::atomic<size_t> next(0), failures(0);
+    std::vector<std::vector<result>> results(options.connections);
+    std::vector<std::thread> clients;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < options.connections; ++c) {
+        clients.emplace_back([&, c] { run_client(options, next, results[c], failures); });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> latencies[kind_count];
+    size_t failed[kind_count] = {}, pam_errors[kind_count] = {};
+    size_t completed = 0;
+    for (const auto& client : results) {
+        for (const result& r : client) {
+            size_t k = static_cast<size_t>(r.kind);
+            latencies[k].push_back(r.latency_ms);
+            failed[k] += r.exit_code != 0;
+            pam_errors[k] += r.pam_error;
+            ++completed;
+        }
+    }
+
+    printf("Completed %zu requests in %.3fs over %zu connections: %.1f requests/s\n",
+           completed, seconds, options.connections, completed / seconds);
+    printf("%-14s %8s %8s %8s %10s %10s %10s %10s\n", "Type", "Count", "Failed", "PAM err", "p50 ms", "p95 ms", "p99 ms", "max ms");
+    for (size_t k = 0; k < kind_count; ++k) {
+        std::vector<double>& sorted = latencies[k];
+        if (sorted.empty()) {
+            continue;
+        }
+        std::sort(sorted.begin(), sorted.end());
+        printf("%-14s %8zu %8zu %8zu %10.3f %10.3f %10.3f %10.3f\n", kind_names[k], sorted.size(), failed[k], pam_errors[k],
+               percentile(sorted, 0.5), percentile(sorted, 0.95), percentile(sorted, 0.99), sorted.back());
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,190 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+// PAM module for load testing Microsoft.R.Host.RunAsUser without real accounts or directory
+// services. Any user is accepted; what each call costs and how it ends is set by the
+// module arguments in the service config (see rtvs-stub.pam):
+//
+//    delay=ms       Time every call takes (default 0)
+//    jitter=ms      Up to this much is added to delay at random (default 0)
+//    success=ratio  Fraction of authentications that succeed, 0 to 1 (default 1)
+//    password=text  Only this password is accepted; any password if not given
+//    info=text      Sent as a PAM_TEXT_INFO message along with the password prompt
+//    error=text     Sent as a PAM_ERROR_MSG message along with the password prompt
+//
+// Arguments with spaces are written in brackets, as in [info=Welcome to the test box].
+
+#define PAM_SM_AUTH
+#define PAM_SM_ACCOUNT
+#define PAM_SM_SESSION
+
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <security/pam_appl.h>
+#include <security/pam_modules.h>
+
+namespace {
+    struct stub_options {
+        long delay_ms = 0;
+        long jitter_ms = 0;
+        double success = 1.0;
+        const char* password = nullptr;
+        std::vector<const char*> info;
+        std::vector<const char*> errors;
+    };
+
+    const char* value_of(const char* arg, const char* name) {
+        size_t length = strlen(name);
+        if (strncmp(arg, name, length) == 0 && arg[length] == '=') {
+            return arg + length + 1;
+        }
+        return nullptr;
+    }
+
+    stub_options parse_options(int argc, const char** argv) {
+        stub_options options;
+        for (int i = 0; i < argc; ++i) {
+            const char* value;
+            if ((value = value_of(argv[i], "delay"))) {
+                options.delay_ms = strtol(value, nullptr, 10);
+            } else if ((value = value_of(argv[i], "jitter"))) {
+                options.jitter_ms = strtol(value, nullptr, 10);
+            } else if ((value = value_of(argv[i], "success"))) {
+                options.success = strtod(value, nullptr);
+            } else if ((value = value_of(argv[i], "password"))) {
+                options.password = value;
+            } else if ((value = value_of(argv[i], "info"))) {
+                options.info.push_back(value);
+            } else if ((value = value_of(argv[i], "error"))) {
+                options.errors.push_back(value);
+            }
+        }
+        return options;
+    }
+
+    std::mt19937& random_engine() {
+        static thread_local std::mt19937 engine{ std::random_device()() };
+        return engine;
+    }
+
+    // Stands in for the directory lookups and network round trips of a real module.
+    void simulate_work(const stub_options& options) {
+        long ms = options.delay_ms;
+        if (options.jitter_ms > 0) {
+            ms += std::uniform_int_distribution<long>(0, options.jitter_ms)(random_engine());
+        }
+        if (ms > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+        }
+    }
+
+    // Asks for the password, passing on the configured messages in the same conversation.
+    int converse(pam_handle_t* pamh, const stub_options& options, std::string& password) {
+        const pam_conv* conv = nullptr;
+        int err = pam_get_item(pamh, PAM_CONV, reinterpret_cast<const void**>(&conv));
+        if (err != PAM_SUCCESS || !conv || !conv->conv) {
+            return PAM_CONV_ERR;
+        }
+
+        std::vector<pam_message> messages;
+        messages.push_back({ PAM_PROMPT_ECHO_OFF, "Password: " });
+        for (const char* text : options.info) {
+            messages.push_back({ PAM_TEXT_INFO, text });
+        }
+        for (const char* text : options.errors) {
+            messages.push_back({ PAM_ERROR_MSG, text });
+        }
+
+        std::vector<const pam_message*> pointers;
+        for (const pam_message& message : messages) {
+            pointers.push_back(&message);
+        }
+
+        pam_response* responses = nullptr;
+        err = conv->conv(static_cast<int>(pointers.size()), pointers.data(), &responses, conv->appdata_ptr);
+        if (err != PAM_SUCCESS || !responses) {
+            return PAM_CONV_ERR;
+        }
+
+        password = responses[0].resp ? responses[0].resp : "";
+        for (size_t i = 0; i < messages.size(); ++i) {
+            if (responses[i].resp) {
+                memset(responses[i].resp, 0, strlen(responses[i].resp));
+                free(responses[i].resp);
+            }
+        }
+        free(responses);
+        return PAM_SUCCESS;
+    }
+}
+
+extern "C" {
+    PAM_EXTERN int pam_sm_authenticate(pam_handle_t* pamh, int flags, int argc, const char** argv) {
+        stub_options options = parse_options(argc, argv);
+
+        const char* user = nullptr;
+        int err = pam_get_user(pamh, &user, nullptr);
+        if (err != PAM_SUCCESS || !user || !*user) {
+            return PAM_USER_UNKNOWN;
+        }
+
+        std::string password;
+        if ((err = converse(pamh, options, password)) != PAM_SUCCESS) {
+            return err;
+        }
+
+        simulate_work(options);
+
+        if (options.password && password != options.password) {
+            return PAM_AUTH_ERR;
+        }
+        if (options.success < 1.0 && std::uniform_real_distribution<double>(0.0, 1.0)(random_engine()) >= options.success) {
+            return PAM_AUTH_ERR;
+        }
+        return PAM_SUCCESS;
+    }
+
+    PAM_EXTERN int pam_sm_setcred(pam_handle_t* pamh, int flags, int argc, const char** argv) {
+        simulate_work(parse_options(argc, argv));
+        return PAM_SUCCESS;
+    }
+
+    PAM_EXTERN int pam_sm_acct_mgmt(pam_handle_t* pamh, int flags, int argc, const char** argv) {
+        simulate_work(parse_options(argc, argv));
+        return PAM_SUCCESS;
+    }
+
+    PAM_EXTERN int pam_sm_open_session(pam_handle_t* pamh, int flags, int argc, const char** argv) {
+        simulate_work(parse_options(argc, argv));
+        return PAM_SUCCESS;
+    }
+
+    PAM_EXTERN int pam_sm_close_session(pam_handle_t* pamh, int flags, int argc, const char** argv) {
+        simulate_work(parse_options(argc, argv));
+        return PAM_SUCCESS;
+    }
+}
@@ -0,0 +1,96 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "codec.h"
+#include "request.h"
+
+using rau::request::parse_status;
+
+namespace {
+    struct parse_case {
+        const char* name;
+        const char* frame;
+        parse_status expected;
+    };
+
+    // Arrays and objects nested in a request, well-formed and cut off or mismatched at each
+    // level. A request that is cut off must never come back ok.
+    const parse_case cases[] = {
+        { "arguments", R"({"name":"AuthAndRun","arguments":["a","b"]})", parse_status::ok },
+        { "arguments empty", R"({"name":"AuthAndRun","arguments":[]})", parse_status::ok },
+        { "arguments unterminated", R"({"name":"AuthAndRun","arguments":[)", parse_status::syntax_error },
+        { "arguments cut off", R"({"name":"AuthAndRun","arguments":["a",)", parse_status::syntax_error },
+        { "arguments closed by }", R"({"name":"AuthAndRun","arguments":["a"})", parse_status::syntax_error },
+        { "arguments not strings", R"({"name":"AuthAndRun","arguments":[1]})", parse_status::schema_error },
+
+        { "signals", R"({"name":"KillProcess","processId":1,"signals":[{"signal":"TERM","timeout":100},{"signal":9}]})", parse_status::ok },
+        { "signals empty", R"({"name":"KillProcess","processId":1,"signals":[]})", parse_status::ok },
+        { "signals empty step", R"({"name":"KillProcess","processId":1,"signals":[{}]})", parse_status::ok },
+        { "signals unterminated", R"({"name":"KillProcess","processId":1,"signals":[)", parse_status::syntax_error },
+        { "signals step unterminated", R"({"name":"KillProcess","processId":1,"signals":[{)", parse_status::syntax_error },
+        { "signals step cut off", R"({"name":"KillProcess","processId":1,"signals":[{"signal":9)", parse_status::syntax_error },
+        { "signals cut off after step", R"({"name":"KillProcess","processId":1,"signals":[{"signal":9})", parse_status::syntax_error },
+        { "signals closed by }", R"({"name":"KillProcess","processId":1,"signals":[{"signal":9}})", parse_status::syntax_error },
+        { "signals step closed by ]", R"({"name":"KillProcess","processId":1,"signals":[{"signal":9]]})", parse_status::syntax_error },
+        { "signals step not an object", R"({"name":"KillProcess","processId":1,"signals":[9]})", parse_status::schema_error },
+
+        { "entries", R"({"name":"AuthOnlyBatch","entries":[{"username":"a","password":"b","allowedGroup":""},{"username":"c"}]})", parse_status::ok },
+        { "entries empty", R"({"name":"AuthOnlyBatch","entries":[]})", parse_status::ok },
+        { "entries unterminated", R"({"name":"AuthOnlyBatch","entries":[)", parse_status::syntax_error },
+        { "entries entry unterminated", R"({"name":"AuthOnlyBatch","entries":[{)", parse_status::syntax_error },
+        { "entries entry cut off", R"({"name":"AuthOnlyBatch","entries":[{"username":"a")", parse_status::syntax_error },
+        { "entries cut off after entry", R"({"name":"AuthOnlyBatch","entries":[{"username":"a","password":"b"})", parse_status::syntax_error },
+        { "entries closed by }", R"({"name":"AuthOnlyBatch","entries":[{"username":"a","password":"b"}})", parse_status::syntax_error },
+        { "entries entry closed by ]", R"({"name":"AuthOnlyBatch","entries":[{"username":"a"]]})", parse_status::syntax_error },
+        { "entries entry not an object", R"({"name":"AuthOnlyBatch","entries":["a"]})", parse_status::schema_error },
+    };
+
+    const char* status_name(parse_status status) {
+        switch (status) {
+        case parse_status::ok:
+            return "ok";
+        case parse_status::syntax_error:
+            return "syntax_error";
+        case parse_status::schema_error:
+            return "schema_error";
+        }
+        return "?";
+    }
+}
+
+// usage: Microsoft.R.Host.RunAsUser.RequestTest
+// Parses each case as a JSON frame and reports the ones that don't come out as expected.
+int main() {
+    size_t failed = 0;
+    for (const parse_case& c : cases) {
+        std::string frame = c.frame, error;
+        rau::request::request req;
+        parse_status status = rau::request::parse(frame, rau::codec::wire_encoding::json, req, error);
+        if (status != c.expected) {
+            fprintf(stderr, "FAIL %s: %s, expected %s (%s)\n", c.name, status_name(status), status_name(c.expected), error.c_str());
+            ++failed;
+        }
+    }
+    printf("%zu of %zu request parsing cases passed.\n", sizeof cases / sizeof cases[0] - failed, sizeof cases / sizeof cases[0]);
+    return failed ? 1 : 0;
+}
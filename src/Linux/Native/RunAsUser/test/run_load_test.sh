@@ -0,0 +1,115 @@
+#!/usr/bin/env bash
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License. See LICENSE in the project root for license information.
+
+usage()
+{
+    cat << EOF2
+Usage: $0 -b dir [options] [-- load test options]
+Runs Microsoft.R.Host.RunAsUser.LoadTest against a socket server (or with -s, against helpers
+on pipes) that authenticates with pam_rtvs_stub.so. /etc/pam.d and /usr/lib/rtvs are replaced
+in a private mount namespace only; as a regular user, the script runs itself in a new user
+namespace, where AuthAndRun fails because setgroups is not permitted there.
+ OPTIONS:
+    -h          Print this message.
+    -b dir      Directory with Microsoft.R.Host.RunAsUser, the load test and pam_rtvs_stub.so.
+    -d ms       Time each PAM call takes (default 0).
+    -j ms       Random extra time of up to this much per PAM call (default 0).
+    -r ratio    Fraction of authentications that succeed (default 1).
+    -s          Use a -s helper per connection instead of the socket server.
+    -w workers  Worker threads of the socket server (default 8).
+EOF2
+}
+
+BIN_DIR=
+DELAY=0
+JITTER=0
+SUCCESS=1
+PIPES=no
+WORKERS=8
+
+OPTIND=1
+
+while getopts "h?b:d:j:r:sw:" opt; do
+    case "$opt" in
+    h|\?)
+        usage
+        exit 0
+        ;;
+    b)
+        BIN_DIR=$(cd "$OPTARG" && pwd)
+        ;;
+    d)
+        DELAY=$OPTARG
+        ;;
+    j)
+        JITTER=$OPTARG
+        ;;
+    r)
+        SUCCESS=$OPTARG
+        ;;
+    s)
+        PIPES=yes
+        ;;
+    w)
+        WORKERS=$OPTARG
+        ;;
+    esac
+done
+
+shift $((OPTIND-1))
+[ "$1" = "--" ] && shift
+
+if [ -z "$BIN_DIR" ]; then
+    usage
+    exit 1
+fi
+
+TEST_DIR=$(cd "$(dirname "$0")" && pwd)
+
+# Everything below has to happen in a mount namespace of our own, so that the stub config
+# never replaces the real one.
+if [ "$RTVS_LOAD_TEST_NAMESPACE" != "1" ]; then
+    export RTVS_LOAD_TEST_NAMESPACE=1
+    ARGS=(-b "$BIN_DIR" -d "$DELAY" -j "$JITTER" -r "$SUCCESS" -w "$WORKERS")
+    [ "$PIPES" = yes ] && ARGS+=(-s)
+    if [ "$(id -u)" = "0" ]; then
+        exec unshare --mount --propagation private -- "$0" "${ARGS[@]}" -- "$@"
+    else
+        exec unshare --user --map-root-user --mount --propagation private -- "$0" "${ARGS[@]}" -- "$@"
+    fi
+fi
+
+WORK_DIR=$(mktemp -d)
+trap 'kill $SERVER_PID 2>/dev/null; wait 2>/dev/null; rm -rf "$WORK_DIR"' EXIT
+
+mkdir -p "$WORK_DIR/pam.d" "$WORK_DIR/rtvs"
+sed -e "s|@PAM_RTVS_STUB@|$BIN_DIR/pam_rtvs_stub.so|" \
+    -e "s|@AUTH_OPTIONS@|delay=$DELAY jitter=$JITTER success=$SUCCESS|" \
+    -e "s|@OPTIONS@|delay=$DELAY jitter=$JITTER|" \
+    "$TEST_DIR/rtvs-stub.pam" > "$WORK_DIR/pam.d/rtvs"
+mount --bind "$WORK_DIR/pam.d" /etc/pam.d || exit 1
+
+cp "$TEST_DIR/stub_host.sh" "$WORK_DIR/rtvs/Microsoft.R.Host"
+if [ -d /usr/lib/rtvs ]; then
+    mount --bind "$WORK_DIR/rtvs" /usr/lib/rtvs
+else
+    echo "Warning: /usr/lib/rtvs doesn't exist, so AuthAndRun can't start a host." >&2
+fi
+
+# Keeps the helper's log out of the real temp directory.
+export TMPDIR=$WORK_DIR
+
+if [ "$PIPES" = yes ]; then
+    "$BIN_DIR/Microsoft.R.Host.RunAsUser.LoadTest" -x "$BIN_DIR/Microsoft.R.Host.RunAsUser" "$@"
+    exit $?
+fi
+
+"$BIN_DIR/Microsoft.R.Host.RunAsUser" -q -l "$WORK_DIR/rau.sock" -w "$WORKERS" &
+SERVER_PID=$!
+for i in $(seq 50); do
+    [ -S "$WORK_DIR/rau.sock" ] && break
+    sleep 0.1
+done
+
+"$BIN_DIR/Microsoft.R.Host.RunAsUser.LoadTest" -l "$WORK_DIR/rau.sock" "$@"
@@ -0,0 +1,130 @@
+/* ****************************************************************************
+*
+* Copyright (c) Microsoft Corporation. All rights reserved.
+*
+*
+* This file is part of Microsoft R Host.
+*
+* Microsoft R Host is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 2 of the License, or
+* (at your option) any later version.
+*
+* Microsoft R Host is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with Microsoft R Host.  If not, see <http://www.gnu.org/licenses/>.
+*
+* ***************************************************************************/
+
+#include "stdafx.h"
+#include "framing.h"
+#include "server.h"
+
+using namespace std::literals;
+
+namespace {
+    // Stands in for the helper's handlers: "Slow" is an AuthAndRun that carries a requestId
+    // and takes a while, "SetEncoding" switches encodings unless other requests are running.
+    void handle(std::string& message, const std::vector<int>&, rau::response_channel& channel) {
+        if (message == "Slow") {
+            channel.allow_overlap();
+            std::this_thread::sleep_for(300ms);
+            channel.write_frame("slow done");
+        } else if (message == "SetEncoding") {
+            channel.write_frame(channel.others_in_flight() ? "in flight" : "switched");
+        } else {
+            channel.write_frame("unknown");
+        }
+    }
+
+    void busy(std::string&, const std::vector<int>&, rau::response_channel& channel) {
+        channel.write_frame("busy");
+    }
+
+    bool send_frame(int fd, const std::string& payload) {
+        rau::framing::frame_writer writer(fd);
+        writer.write(payload);
+        return writer.flush();
+    }
+
+    std::string read_frame(rau::framing::frame_reader& reader) {
+        boost::string_ref frame;
+        return reader.read(frame) == rau::framing::frame_reader::status::ok ? frame.to_string() : "(no frame)";
+    }
+
+    size_t failed = 0;
+
+    void expect(const char* what, const std::string& actual, const char* expected) {
+        if (actual != expected) {
+            fprintf(stderr, "FAIL %s: \"%s\", expected \"%s\"\n", what, actual.c_str(), expected);
+            ++failed;
+        }
+    }
+}
+
+// usage: Microsoft.R.Host.RunAsUser.ServerTest
+// Runs the socket server on a socket in a temporary directory, and checks that SetEncoding
+// is turned down while a request before it still runs, and accepted once it has finished.
+int main() {
+    char dir[] = "/tmp/rtvs-server-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    rau::server::server_options options;
+    options.socket_path = std::string(dir) + "/socket";
+    options.workers = 4;
+
+    // The server stops on SIGTERM, which has to be blocked before any thread starts.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    int result = -1;
+    std::thread server([&] { result = rau::server::run(options, handle, busy); });
+
+    int fd = -1;
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, options.socket_path.c_str(), sizeof addr.sun_path - 1);
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, (sockaddr*)&addr, sizeof addr) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+        std::this_thread::sleep_for(10ms);
+    }
+    if (fd == -1) {
+        fprintf(stderr, "FAIL connect: %s\n", strerror(errno));
+        ++failed;
+    } else {
+        rau::framing::frame_reader reader(fd);
+        send_frame(fd, "Slow");
+        send_frame(fd, "SetEncoding");
+        expect("SetEncoding behind a running request", read_frame(reader), "in flight");
+        expect("the running request", read_frame(reader), "slow done");
+
+        send_frame(fd, "SetEncoding");
+        expect("SetEncoding on its own", read_frame(reader), "switched");
+        close(fd);
+    }
+
+    kill(getpid(), SIGTERM);
+    server.join();
+    rmdir(dir);
+    if (result != 0) {
+        fprintf(stderr, "FAIL server: %s\n", strerror(result));
+        ++failed;
+    }
+
+    printf("%s\n", failed ? "Server test failed." : "Server test passed.");
+    return failed ? 1 : 0;
+}
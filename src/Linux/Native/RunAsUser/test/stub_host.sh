@@ -0,0 +1,8 @@
+#!/bin/sh
+# Copyright (c) Microsoft Corporation. All rights reserved.
+# Licensed under the MIT License. See LICENSE in the project root for license information.
+#
+# Stands in for Microsoft.R.Host during load tests: lives for RTVS_STUB_HOST_LIFETIME seconds
+# (default 0.1), which the load test passes in the AuthAndRun environment.
+
+exec sleep "${RTVS_STUB_HOST_LIFETIME:-0.1}"
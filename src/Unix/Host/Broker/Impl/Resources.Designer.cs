@@ -142,6 +142,15 @@ namespace Microsoft.R.Host.Broker {
             }
         }
         
+        /// <summary>
+        ///   Looks up a localized string similar to The server is under too much load to start another R session right now. Please try again later..
+        /// </summary>
+        internal static string Error_RunAsUser_HostOverloaded {
+            get {
+                return ResourceManager.GetString("Error_RunAsUser_HostOverloaded", resourceCulture);
+            }
+        }
+        
         /// <summary>
         ///   Looks up a localized string similar to Invalid input to RunAsUser.
         /// </summary>
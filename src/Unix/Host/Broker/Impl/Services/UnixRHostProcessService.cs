@@ -25,17 +25,19 @@ namespace Microsoft.R.Host.Broker.Services {
 
         public IProcess StartHost(Interpreter interpreter, string profilePath, string userName, ClaimsPrincipal principal, string commandLine) {
             IProcess process;
+            var runAsUser = false;
             if (principal.HasClaim((c) => c.Type == UnixClaims.RPassword)) {
                 var args = ParseArgumentsIntoList(commandLine);
                 var environment = GetHostEnvironment(interpreter, profilePath, userName);
                 var password = principal.FindFirst(UnixClaims.RPassword).Value;
                 process = Utility.AuthenticateAndRunAsUser(_sessionLogger, _ps, userName, password, profilePath, args, environment);
+                runAsUser = true;
             } else {
                 process = Utility.RunAsCurrentUser(_sessionLogger, _ps, commandLine, GetRHomePath(interpreter), GetLoadLibraryPath(interpreter));
             }
             process.WaitForExit(250);
             if (process.HasExited && process.ExitCode != 0) {
-                var message = _ps.MessageFromExitCode(process.ExitCode);
+                var message = (runAsUser ? Utility.GetRunAsUserExitMessage(process) : null) ?? _ps.MessageFromExitCode(process.ExitCode);
                 if (!string.IsNullOrEmpty(message)) {
                     throw new Win32Exception(message);
                 }
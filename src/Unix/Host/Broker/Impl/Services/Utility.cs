@@ -24,6 +24,9 @@ namespace Microsoft.R.Host.Broker.Services {
         private const string RtvsResult = "rtvs-result";
         private const string RtvsError = "rtvs-error";
 
+        // Exit code of a RunAsUser that didn't start the host because the machine was overloaded.
+        private const int HostOverloadedExitCode = 204;
+
         public static IProcess RunAsCurrentUser(ILogger<Session> logger, IProcessServices ps, string arguments, string rHomePath, string loadLibPath) {
             var psi = new ProcessStartInfo {
                 FileName = PathConstants.RunHostBinPath,
@@ -103,8 +106,7 @@ namespace Microsoft.R.Host.Broker.Services {
                                     }
                                     break;
                                 case RtvsError:
-                                    var resource = arr[1].Value<string>();
-                                    logger.LogCritical(Resources.Error_RunAsUserFailed.FormatInvariant(Resources.ResourceManager.GetString(resource)));
+                                    logger.LogCritical(Resources.Error_RunAsUserFailed.FormatInvariant(GetRtvsErrorMessage(arr)));
                                     break;
                             }
                         } else {
@@ -139,11 +141,43 @@ namespace Microsoft.R.Host.Broker.Services {
                     return Resources.Error_AuthBadInput;
                 case 202:
                     return Resources.Error_AuthNoInput;
+                case HostOverloadedExitCode:
+                    return Resources.Error_RunAsUser_HostOverloaded;
                 default:
                     return exitcode.ToString();
             }
         }
 
+        // Describes why an AuthenticateAndRunAsUser process exited before it started the host, or
+        // returns null if its exit code doesn't say. A launch that was turned away because the
+        // machine was overloaded leaves an rtvs-error on standard output, with what was overloaded.
+        public static string GetRunAsUserExitMessage(IProcess proc) {
+            if (proc.ExitCode != HostOverloadedExitCode) {
+                return null;
+            }
+
+            try {
+                using (var reader = new BinaryReader(proc.StandardOutput.BaseStream, Encoding.UTF8, true)) {
+                    var size = reader.ReadInt32();
+                    var arr = JsonConvert.DeserializeObject<JArray>(Encoding.UTF8.GetString(reader.ReadBytes(size)));
+                    if (arr.Count > 1 && arr[0].Value<string>() == RtvsError) {
+                        return GetRtvsErrorMessage(arr);
+                    }
+                }
+            } catch (Exception ex) when (!ex.IsCriticalException()) {
+            }
+            return Resources.Error_RunAsUser_HostOverloaded;
+        }
+
+        // The message for an rtvs-error response: the resource named by its code, followed by any
+        // details that came with it.
+        private static string GetRtvsErrorMessage(JArray arr) {
+            var resource = arr[1].Value<string>();
+            var message = Resources.ResourceManager.GetString(resource) ?? resource;
+            var details = arr.Skip(2).Select(d => d.ToString()).Where(d => d.Length > 0).ToArray();
+            return details.Length > 0 ? $"{message} ({string.Join(", ", details)})" : message;
+        }
+
         public static string GetUnixUserName(string source) {
             // This is needed because the windows credential UI uses domain\username format.
             // This will not be required if we can show generic credential UI for Linux remote.
@@ -4,8 +4,20 @@
 namespace Microsoft.Common.Core.OS {
     public class PathConstants {
         // usage:
-        // Microsoft.R.Host.RunAsUser [-q]
+        // Microsoft.R.Host.RunAsUser [-q] [-s] [-l socket [-u user]... [-w workers] [-b backlog]] [-c ttl] [-m bytes] [-e] [-r bytes] [-a seconds] [-d socket] [-p file]
         //    -q: Quiet
+        //    -s: Serve requests until end of input, completing each with rtvs-done
+        //    -l: Serve requests on a unix domain socket (root only)
+        //    -u: Also accept socket connections from this user
+        //    -w: Number of worker threads handling socket requests (default 8)
+        //    -b: Requests that may wait for a worker before being rejected as busy (default 256)
+        //    -c: Seconds passwd/group data is cached by -s and -l (default 30, 0 disables)
+        //    -m: Largest request accepted, in bytes (default 1048576)
+        //    -e: Log the arguments and environment of every Microsoft.R.Host launch
+        //    -r: Rotate the shared log file once it's larger than this (default 16777216)
+        //    -a: Rotate the shared log file once it's this many seconds old (default 86400)
+        //    -d: Log through the collector on this datagram socket; with -l, be that collector
+        //    -p: With -s or -l, keep request counters and latencies in this file, in Prometheus text format
         public const string RunAsUserBinPath = "/usr/lib/rtvs/Microsoft.R.Host.RunAsUser";
         public const string RunHostBinPath = "/usr/lib/rtvs/Microsoft.R.Host";
     }